@@ -0,0 +1,80 @@
+# Profile guided build of bench, run with "cmake --build <dir> --target pgo" or
+#
+#   cmake -DSOURCE_DIR=<repo> -DBINARY_DIR=<dir> -P cmake/pgo.cmake
+#
+# 1. builds bench without profiles in BINARY_DIR/baseline and records baseline.json
+# 2. builds an instrumented bench in BINARY_DIR/pgo and trains the profile by running
+#    its profile section, the representative train()/evaluate() workload
+# 3. rebuilds the same tree with the profile applied and prints the speedups over
+#    the baseline, writing pgo.json
+#
+# The library is header-only, so every program carries its own copy of the hot paths
+# and GCC keeps profiles per translation unit: a profile only helps the program that
+# produced it. That is why the workload lives in bench rather than in its own program.
+# Optional: GENERATOR, CXX_COMPILER, NN_NATIVE, NN_LTO, BENCH_SECTIONS.
+
+if( NOT SOURCE_DIR OR NOT BINARY_DIR )
+	message( FATAL_ERROR "SOURCE_DIR and BINARY_DIR are required" )
+endif()
+if( NOT BENCH_SECTIONS )
+	set( BENCH_SECTIONS layers net profile )
+endif()
+
+set( configureArgs -DCMAKE_BUILD_TYPE=Release )
+if( GENERATOR )
+	list( APPEND configureArgs -G ${GENERATOR} )
+endif()
+if( CXX_COMPILER )
+	list( APPEND configureArgs -DCMAKE_CXX_COMPILER=${CXX_COMPILER} )
+endif()
+if( DEFINED NN_NATIVE )
+	list( APPEND configureArgs -DNN_NATIVE=${NN_NATIVE} )
+endif()
+if( DEFINED NN_LTO )
+	list( APPEND configureArgs -DNN_LTO=${NN_LTO} )
+endif()
+
+function( run )
+	execute_process( COMMAND ${ARGN} RESULT_VARIABLE result )
+	if( NOT result EQUAL 0 )
+		message( FATAL_ERROR "failed: ${ARGN}" )
+	endif()
+endfunction()
+
+function( build_bench dir pgoMode )
+	run( ${CMAKE_COMMAND} -S ${SOURCE_DIR} -B ${dir} ${configureArgs} -DNN_PGO=${pgoMode} -DNN_PGO_DIR=${BINARY_DIR}/profile )
+	run( ${CMAKE_COMMAND} --build ${dir} --config Release --target bench --clean-first )
+endfunction()
+
+function( find_bench dir outVar )
+	find_program( bench_${outVar} NAMES bench PATHS ${dir} ${dir}/Release NO_DEFAULT_PATH )
+	if( NOT bench_${outVar} )
+		message( FATAL_ERROR "bench was not built in ${dir}" )
+	endif()
+	set( ${outVar} ${bench_${outVar}} PARENT_SCOPE )
+endfunction()
+
+message( STATUS "pgo: baseline build" )
+build_bench( ${BINARY_DIR}/baseline OFF )
+find_bench( ${BINARY_DIR}/baseline baselineBench )
+run( ${baselineBench} --json ${BINARY_DIR}/baseline.json ${BENCH_SECTIONS} WORKING_DIRECTORY ${BINARY_DIR} )
+
+message( STATUS "pgo: training the profile" )
+file( REMOVE_RECURSE ${BINARY_DIR}/profile )
+build_bench( ${BINARY_DIR}/pgo GENERATE )
+find_bench( ${BINARY_DIR}/pgo instrumentedBench )
+run( ${instrumentedBench} profile WORKING_DIRECTORY ${BINARY_DIR} )
+
+# Clang writes raw profiles that have to be merged first
+file( GLOB rawProfiles ${BINARY_DIR}/profile/*.profraw )
+if( rawProfiles )
+	find_program( LLVM_PROFDATA NAMES llvm-profdata )
+	if( NOT LLVM_PROFDATA )
+		message( FATAL_ERROR "llvm-profdata is needed to merge the Clang profile" )
+	endif()
+	run( ${LLVM_PROFDATA} merge -output=${BINARY_DIR}/profile/default.profdata ${rawProfiles} )
+endif()
+
+message( STATUS "pgo: optimized build" )
+build_bench( ${BINARY_DIR}/pgo USE )
+run( ${instrumentedBench} --json ${BINARY_DIR}/pgo.json --baseline ${BINARY_DIR}/baseline.json ${BENCH_SECTIONS} WORKING_DIRECTORY ${BINARY_DIR} )
@@ -0,0 +1,1612 @@
+/*=============================================================================
+
+MIT License
+
+Copyright (c) 2018 Ville Ruusutie
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+
+=============================================================================*/
+
+// Benchmarks for the layer kernels, whole nets and the surrounding machinery. Build with
+// optimizations, for example
+//   g++ -std=c++11 -O2 -pthread -Isrc src/bench.cpp -o bench
+// and run
+//   bench [--quick] [--json <file>] [--baseline <file>] [section ...]
+// Without sections everything runs. --json writes the results of every section that
+// ran as JSON, --baseline prints the speedup over such a file from another build and
+// --quick shortens timing runs and sweeps.
+
+#include "checkpoint.h"
+#include "inference.h"
+#include "neuralnet.h"
+#include "quantized.h"
+#include "samplefile.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+//----------------------------------------------------------------------------
+
+typedef std::chrono::steady_clock Clock;
+
+static double elapsedSeconds( Clock::time_point start )
+{
+	return std::chrono::duration< double >( Clock::now() - start ).count();
+}
+//----------------------------------------------------------------------------
+
+static bool s_bQuick = false;
+
+// Median seconds per call of five runs, each repeated until it lasts long enough to
+// swamp the clock resolution
+template< typename Function >
+static double measure( Function function )
+{
+	const double fMinRunSeconds = s_bQuick ? 0.005 : 0.02;
+	size_t iterationCount = 1;
+	for( ;; )
+	{
+		Clock::time_point start = Clock::now();
+		for( size_t i = 0; i < iterationCount; ++i )
+		{
+			function();
+		}
+		if( elapsedSeconds( start ) >= fMinRunSeconds )
+		{
+			break;
+		}
+		iterationCount *= 2;
+	}
+
+	double runs[ 5 ];
+	for( size_t r = 0; r < 5; ++r )
+	{
+		Clock::time_point start = Clock::now();
+		for( size_t i = 0; i < iterationCount; ++i )
+		{
+			function();
+		}
+		runs[ r ] = elapsedSeconds( start ) / double( iterationCount );
+	}
+	std::sort( runs, runs + 5 );
+	return runs[ 2 ];
+}
+//----------------------------------------------------------------------------
+
+// Results kept for --json, one object per measurement. The first paramCount values
+// say what was measured and the rest are the metrics, the first metric being the one
+// --baseline compares.
+struct BenchRecord
+{
+	std::string strSuite;
+	std::string strName;
+	std::vector< std::pair< std::string, double > > values;
+	size_t paramCount;
+};
+
+typedef std::initializer_list< std::pair< const char*, double > > BenchValues;
+
+static std::vector< BenchRecord > s_records;
+
+static void addRecord( const char* strSuite, const char* strName, BenchValues params, BenchValues metrics )
+{
+	BenchRecord record;
+	record.strSuite = strSuite;
+	record.strName = strName;
+	for( auto it = params.begin(); it != params.end(); ++it )
+	{
+		record.values.push_back( std::make_pair( std::string( it->first ), it->second ) );
+	}
+	record.paramCount = record.values.size();
+	for( auto it = metrics.begin(); it != metrics.end(); ++it )
+	{
+		record.values.push_back( std::make_pair( std::string( it->first ), it->second ) );
+	}
+	s_records.push_back( record );
+}
+//----------------------------------------------------------------------------
+
+static bool writeJson( const char* strPath )
+{
+	FILE* pFile = fopen( strPath, "w" );
+	if( pFile == nullptr )
+	{
+		return false;
+	}
+
+#if defined( __clang__ )
+	const char* strCompiler = "clang " __clang_version__;
+#elif defined( __GNUC__ )
+	const char* strCompiler = "gcc " __VERSION__;
+#elif defined( _MSC_VER )
+	const char* strCompiler = "msvc";
+#else
+	const char* strCompiler = "unknown";
+#endif
+	fprintf( pFile, "{\n  \"kernels\": \"%s\",\n  \"compiler\": \"%s\",\n  \"quick\": %s,\n  \"results\": [\n",
+		getKernels().strName, strCompiler, s_bQuick ? "true" : "false" );
+	for( size_t r = 0; r < s_records.size(); ++r )
+	{
+		const BenchRecord& record = s_records[ r ];
+		fprintf( pFile, "    { \"suite\": \"%s\", \"name\": \"%s\"", record.strSuite.c_str(), record.strName.c_str() );
+		for( size_t v = 0; v < record.values.size(); ++v )
+		{
+			fprintf( pFile, ", \"%s\": %.9g", record.values[ v ].first.c_str(), record.values[ v ].second );
+		}
+		fprintf( pFile, " }%s\n", r + 1 < s_records.size() ? "," : "" );
+	}
+	fprintf( pFile, "  ]\n}\n" );
+	return fclose( pFile ) == 0;
+}
+//----------------------------------------------------------------------------
+
+// Reads the results of an earlier --json run. Every result sits on its own line, so a
+// line scan for "key": value pairs is enough.
+static bool readJson( const char* strPath, std::vector< BenchRecord >& records )
+{
+	FILE* pFile = fopen( strPath, "r" );
+	if( pFile == nullptr )
+	{
+		return false;
+	}
+
+	char strLine[ 1024 ];
+	while( fgets( strLine, sizeof( strLine ), pFile ) != nullptr )
+	{
+		if( strstr( strLine, "\"suite\"" ) == nullptr )
+		{
+			continue;
+		}
+		BenchRecord record;
+		record.paramCount = 0;
+		const char* pChar = strLine;
+		while( ( pChar = strchr( pChar, '"' ) ) != nullptr )
+		{
+			const char* pKeyEnd = strchr( pChar + 1, '"' );
+			if( pKeyEnd == nullptr || pKeyEnd[ 1 ] != ':' )
+			{
+				break;
+			}
+			std::string strKey( pChar + 1, pKeyEnd );
+			pChar = pKeyEnd + 2;
+			while( *pChar == ' ' )
+			{
+				++pChar;
+			}
+			if( *pChar == '"' )
+			{
+				const char* pValueEnd = strchr( pChar + 1, '"' );
+				if( pValueEnd == nullptr )
+				{
+					break;
+				}
+				std::string strValue( pChar + 1, pValueEnd );
+				if( strKey == "suite" )
+				{
+					record.strSuite = strValue;
+				}
+				else if( strKey == "name" )
+				{
+					record.strName = strValue;
+				}
+				pChar = pValueEnd + 1;
+			}
+			else
+			{
+				char* pValueEnd = nullptr;
+				record.values.push_back( std::make_pair( strKey, strtod( pChar, &pValueEnd ) ) );
+				pChar = pValueEnd;
+			}
+		}
+		records.push_back( record );
+	}
+	fclose( pFile );
+	return true;
+}
+//----------------------------------------------------------------------------
+
+static const double* findValue( const BenchRecord& record, const std::string& strKey )
+{
+	for( size_t v = 0; v < record.values.size(); ++v )
+	{
+		if( record.values[ v ].first == strKey )
+		{
+			return &record.values[ v ].second;
+		}
+	}
+	return nullptr;
+}
+//----------------------------------------------------------------------------
+
+// Metrics starting with "ns" or ending in "ms", "us" or "seconds" are times, the rest
+// are rates or counts where more is better
+static bool isTimeMetric( const std::string& strMetric )
+{
+	const size_t length = strMetric.size();
+	return strMetric.compare( 0, 2, "ns" ) == 0
+		|| ( length >= 2 && ( strMetric.compare( length - 2, 2, "ms" ) == 0 || strMetric.compare( length - 2, 2, "us" ) == 0 ) )
+		|| ( length >= 7 && strMetric.compare( length - 7, 7, "seconds" ) == 0 );
+}
+//----------------------------------------------------------------------------
+
+// Speedup of every result over the matching one in baseline, on each record's first
+// metric
+static void compareWithBaseline( const std::vector< BenchRecord >& baseline )
+{
+	printf( "compared with baseline\n" );
+	printf( "%-10s %-28s %-24s %14s %14s %8s\n", "suite", "name", "params", "baseline", "current", "speedup" );
+	for( size_t r = 0; r < s_records.size(); ++r )
+	{
+		const BenchRecord& record = s_records[ r ];
+		if( record.paramCount >= record.values.size() )
+		{
+			continue;
+		}
+		const std::string& strMetric = record.values[ record.paramCount ].first;
+		const double fCurrent = record.values[ record.paramCount ].second;
+
+		for( size_t b = 0; b < baseline.size(); ++b )
+		{
+			const BenchRecord& other = baseline[ b ];
+			bool bMatch = ( other.strSuite == record.strSuite && other.strName == record.strName );
+			for( size_t p = 0; bMatch && p < record.paramCount; ++p )
+			{
+				const double* pValue = findValue( other, record.values[ p ].first );
+				bMatch = ( pValue != nullptr && *pValue == record.values[ p ].second );
+			}
+			const double* pBaseline = bMatch ? findValue( other, strMetric ) : nullptr;
+			if( pBaseline == nullptr || *pBaseline <= 0.0 || fCurrent <= 0.0 )
+			{
+				continue;
+			}
+
+			std::string strParams;
+			for( size_t p = 0; p < record.paramCount; ++p )
+			{
+				char strParam[ 32 ];
+				snprintf( strParam, sizeof( strParam ), "%s%s=%g", p > 0 ? " " : "", record.values[ p ].first.c_str(), record.values[ p ].second );
+				strParams += strParam;
+			}
+			const bool bTime = isTimeMetric( strMetric );
+			const double fSpeedup = bTime ? *pBaseline / fCurrent : fCurrent / *pBaseline;
+			printf( "%-10s %-28s %-24s %14.4g %14.4g %7.3fx\n", record.strSuite.c_str(), record.strName.c_str(), strParams.c_str(), *pBaseline, fCurrent, fSpeedup );
+			break;
+		}
+	}
+}
+//----------------------------------------------------------------------------
+
+// Backward pass as it was before rows were scattered: walks a column of the next
+// layer's row-major weights with a stride of the layer width.
+static void computeDeltasStrided( const Layer< Elu >& layer, const Layer< Elu >& nextLayer, const float* pNextDeltas, const float* pValues, float* pDeltas )
+{
+	const size_t outputCount = layer.getOutputCount();
+	const float* pNextWeights = nextLayer.getWeights();
+	for( size_t o = 0; o < outputCount; ++o )
+	{
+		float fError = 0.0f;
+		for( size_t i = 0; i < nextLayer.getOutputCount(); ++i )
+		{
+			fError += pNextDeltas[ i ] * pNextWeights[ outputCount * i + o ];
+		}
+		pDeltas[ o ] = fError * Elu::derivative( pValues[ o ] );
+	}
+}
+//----------------------------------------------------------------------------
+
+static void benchBackward()
+{
+	printf( "computeDeltas per sample, hidden layer followed by an equally wide layer\n" );
+	printf( "%8s %14s %14s %9s\n", "width", "strided ns", "scatter ns", "speedup" );
+
+	const size_t widths[] = { 64, 256, 1024, 2048, 4096 };
+	for( size_t w = 0; w < sizeof( widths ) / sizeof( widths[ 0 ] ); ++w )
+	{
+		const size_t width = widths[ w ];
+		std::vector< float > weights( width * width );
+		std::vector< float > nextWeights( width * width );
+		std::vector< float > biases( width );
+		randomize( &weights[ 0 ], width * width );
+		randomize( &nextWeights[ 0 ], width * width );
+		const Layer< Elu > layer( width, width, &weights[ 0 ], &biases[ 0 ] );
+		const Layer< Elu > nextLayer( width, width, &nextWeights[ 0 ], &biases[ 0 ] );
+
+		std::vector< float > nextDeltas( width );
+		std::vector< float > values( width );
+		std::vector< float > deltas( width );
+		randomize( &nextDeltas[ 0 ], width );
+		randomize( &values[ 0 ], width );
+
+		// Aim for roughly the same amount of work per width
+		const size_t iterationCount = 1 + ( size_t( 1 ) << 28 ) / ( width * width );
+
+		Clock::time_point start = Clock::now();
+		for( size_t i = 0; i < iterationCount; ++i )
+		{
+			computeDeltasStrided( layer, nextLayer, &nextDeltas[ 0 ], &values[ 0 ], &deltas[ 0 ] );
+		}
+		const double fStridedNs = elapsedSeconds( start ) * 1e9 / double( iterationCount );
+
+		start = Clock::now();
+		for( size_t i = 0; i < iterationCount; ++i )
+		{
+			layer.computeDeltas( &nextLayer, &nextDeltas[ 0 ], &values[ 0 ], &deltas[ 0 ] );
+		}
+		const double fScatterNs = elapsedSeconds( start ) * 1e9 / double( iterationCount );
+
+		printf( "%8d %14.1f %14.1f %8.2fx\n", ( int )width, fStridedNs, fScatterNs, fStridedNs / fScatterNs );
+		addRecord( "backward", "strided", { { "width", double( width ) } }, { { "ns_per_sample", fStridedNs } } );
+		addRecord( "backward", "scatter", { { "width", double( width ) } }, { { "ns_per_sample", fScatterNs } } );
+	}
+}
+//----------------------------------------------------------------------------
+
+static void benchTransfer()
+{
+	printf( "transfer functions, ns per element over 4096 values\n" );
+	printf( "%8s %10s %10s %10s %10s\n", "level", "sigmoid", "softplus", "elu", "elu'" );
+
+	const size_t count = 4096;
+	const size_t iterationCount = 2000;
+	std::vector< float > values( count );
+	std::vector< float > deltas( count, 1.0f );
+	for( int level = 0; level < SimdLevel_Count; ++level )
+	{
+		const Kernels& kernels = getKernels( SimdLevel( level ) );
+		if( kernels.level != level )
+		{
+			continue;
+		}
+
+		double fNs[ 4 ];
+		for( int function = 0; function < 4; ++function )
+		{
+			// Mostly negative inputs so every function takes its exp/log path
+			for( size_t v = 0; v < count; ++v )
+			{
+				values[ v ] = float( v ) * ( 8.0f / float( count ) ) - 6.0f;
+			}
+
+			Clock::time_point start = Clock::now();
+			for( size_t i = 0; i < iterationCount; ++i )
+			{
+				switch( function )
+				{
+				case 0: kernels.sigmoid( &values[ 0 ], count ); break;
+				case 1: kernels.softplus( &values[ 0 ], count ); break;
+				case 2: kernels.elu( &values[ 0 ], count ); break;
+				case 3: kernels.eluDerivative( &values[ 0 ], &deltas[ 0 ], count ); break;
+				}
+			}
+			fNs[ function ] = elapsedSeconds( start ) * 1e9 / double( iterationCount * count );
+		}
+		printf( "%8s %10.2f %10.2f %10.2f %10.2f\n", kernels.strName, fNs[ 0 ], fNs[ 1 ], fNs[ 2 ], fNs[ 3 ] );
+
+		const char* strFunctions[] = { "sigmoid", "softplus", "elu", "eluDerivative" };
+		for( int function = 0; function < 4; ++function )
+		{
+			addRecord( "transfer", strFunctions[ function ], { { "level", double( level ) } }, { { "ns_per_element", fNs[ function ] } } );
+		}
+	}
+}
+//----------------------------------------------------------------------------
+
+// Error reached after each epoch together with the wall-clock time spent so far.
+// Returns the mean squared error of the last epoch.
+static float runTraining( const char* strName, const std::vector< float >& inputs, const std::vector< float >& outputs, size_t testCount, const TrainingParams& params, size_t epochCount )
+{
+	// Every run starts from the same weights, the default seed is fixed
+	NeuralNet< Elu > net( { 16, 32, 1 } );
+
+	TrainingParams epochParams = params;
+	epochParams.epochCount = 1;
+	epochParams.bPrintProgress = false;
+
+	printf( "%-12s", strName );
+	double fSeconds = 0.0;
+	float fMeanError = 0.0f;
+	for( size_t epoch = 0; epoch < epochCount; ++epoch )
+	{
+		Clock::time_point start = Clock::now();
+		fMeanError = net.train( &inputs[ 0 ], &outputs[ 0 ], testCount, epochParams ) / float( testCount );
+		fSeconds += elapsedSeconds( start );
+		printf( " %7.3f@%.2fs", fMeanError, fSeconds );
+	}
+	printf( "\n" );
+	return fMeanError;
+}
+//----------------------------------------------------------------------------
+
+static void benchHogwild()
+{
+	printf( "training convergence, mean squared error @ elapsed seconds per epoch\n" );
+
+	// Each target depends on a few inputs only, so Hogwild updates rarely collide
+	const size_t inputCount = 16;
+	const size_t testCount = 16384;
+	std::vector< float > inputs( testCount * inputCount );
+	std::vector< float > outputs( testCount );
+	srand( 7 );
+	for( size_t t = 0; t < testCount; ++t )
+	{
+		float* pInputs = &inputs[ t * inputCount ];
+		for( size_t i = 0; i < inputCount; ++i )
+		{
+			pInputs[ i ] = ( rand() % 4 ) == 0 ? float( rand() ) / float( RAND_MAX ) : 0.0f;
+		}
+		outputs[ t ] = 0.5f * ( pInputs[ t % inputCount ] + pInputs[ ( t * 7 ) % inputCount ] );
+	}
+
+	const size_t epochCount = 5;
+	TrainingParams params;
+	auto run = [ & ]( const char* strMode, const char* strName )
+	{
+		const Clock::time_point start = Clock::now();
+		const float fError = runTraining( strName, inputs, outputs, testCount, params, epochCount );
+		const double fSamplesPerSecond = double( testCount * epochCount ) / elapsedSeconds( start );
+		addRecord( "hogwild", strMode, { { "threads", double( params.threadCount ) }, { "batch", double( params.batchSize ) } },
+			{ { "samples_per_second", fSamplesPerSecond }, { "mean_squared_error", fError } } );
+	};
+
+	params.fLearningRate = 0.0002f;
+	params.batchSize = 1;
+	run( "serial", "serial" );
+
+	const size_t threadCounts[] = { 2, 4, 8 };
+	for( size_t c = 0; c < sizeof( threadCounts ) / sizeof( threadCounts[ 0 ] ); ++c )
+	{
+		char strName[ 32 ];
+		params.threadCount = threadCounts[ c ];
+
+		params.parallelMode = ParallelMode_Synchronous;
+		params.batchSize = 8 * threadCounts[ c ];
+		params.fLearningRate = 0.0002f * float( params.batchSize );
+		snprintf( strName, sizeof( strName ), "sync x%d", ( int )threadCounts[ c ] );
+		run( "synchronous", strName );
+
+		params.parallelMode = ParallelMode_Hogwild;
+		params.batchSize = 1;
+		params.fLearningRate = 0.0002f;
+		snprintf( strName, sizeof( strName ), "hogwild x%d", ( int )threadCounts[ c ] );
+		run( "hogwild", strName );
+	}
+}
+//----------------------------------------------------------------------------
+
+// Epoch time of synchronous data-parallel training with a fixed large batch against the
+// thread count. Each thread count runs twice from the same weights and prints "failed"
+// unless both runs end with identical weights.
+static void benchScaling()
+{
+	const size_t inputCount = 256;
+	const size_t testCount = s_bQuick ? 4096 : 32768;
+	std::vector< float > inputs( testCount * inputCount );
+	std::vector< float > outputs( testCount * 16 );
+	randomize( &inputs[ 0 ], inputs.size(), 1 );
+	randomize( &outputs[ 0 ], outputs.size(), 2 );
+
+	std::vector< size_t > threadCounts;
+	const size_t hardwareThreadCount = std::thread::hardware_concurrency() > 0 ? std::thread::hardware_concurrency() : 1;
+	for( size_t threadCount = 1; threadCount < hardwareThreadCount && threadCount <= 8; threadCount *= 2 )
+	{
+		threadCounts.push_back( threadCount );
+	}
+	threadCounts.push_back( hardwareThreadCount );
+	if( s_bQuick && threadCounts.back() < 2 )
+	{
+		// Still exercise the threaded path where there is a single core
+		threadCounts.push_back( 2 );
+	}
+
+	const size_t batchSize = 256;
+	const size_t epochCount = 2;
+	printf( "data-parallel scaling, 256-512-512-16 net, batch %d, %d epochs of %d samples\n", ( int )batchSize, ( int )epochCount, ( int )testCount );
+	printf( "%8s %10s %14s %8s\n", "threads", "seconds", "samples/s", "speedup" );
+	double fSerialSeconds = 0.0;
+	for( size_t c = 0; c < threadCounts.size(); ++c )
+	{
+		TrainingParams params;
+		params.epochCount = epochCount;
+		params.batchSize = batchSize;
+		params.fLearningRate = 0.01f;
+		params.threadCount = threadCounts[ c ];
+		params.parallelMode = ParallelMode_Synchronous;
+		params.bPrintProgress = false;
+
+		NeuralNet< Relu > net( { inputCount, 512, 512, 16 } );
+		Clock::time_point start = Clock::now();
+		net.train( &inputs[ 0 ], &outputs[ 0 ], testCount, params );
+		const double fSeconds = elapsedSeconds( start );
+		if( c == 0 )
+		{
+			fSerialSeconds = fSeconds;
+		}
+
+		NeuralNet< Relu > repeatNet( { inputCount, 512, 512, 16 } );
+		repeatNet.train( &inputs[ 0 ], &outputs[ 0 ], testCount, params );
+		const bool bSame = memcmp( net.getParameters(), repeatNet.getParameters(), net.getParameterCount() * sizeof( float ) ) == 0;
+
+		const double fSamplesPerSecond = double( testCount * epochCount ) / fSeconds;
+		printf( "%8d %10.3f %14.0f %7.2fx\n", ( int )threadCounts[ c ], fSeconds, fSamplesPerSecond, fSerialSeconds / fSeconds );
+		if( !bSame )
+		{
+			printf( "%d threads failed, two runs ended with different weights\n", ( int )threadCounts[ c ] );
+		}
+		addRecord( "scaling", "synchronous", { { "threads", double( threadCounts[ c ] ) }, { "batch", double( batchSize ) } }, { { "samples_per_second", fSamplesPerSecond }, { "seconds", fSeconds } } );
+	}
+}
+//----------------------------------------------------------------------------
+
+// A smooth nonlinear target of a few inputs in [ -1, 1 ), for the 16-32-1 net of
+// runTraining. Different seeds give independent samples of the same task.
+static void makeSmoothTask( std::vector< float >& inputs, std::vector< float >& outputs, size_t testCount, uint64_t seed )
+{
+	inputs.resize( testCount * 16 );
+	outputs.resize( testCount );
+	randomize( &inputs[ 0 ], inputs.size(), seed );
+	for( size_t i = 0; i < inputs.size(); ++i )
+	{
+		inputs[ i ] = ( inputs[ i ] - 0.7f ) * 5.0f;
+	}
+	for( size_t t = 0; t < testCount; ++t )
+	{
+		const float* pInputs = &inputs[ t * 16 ];
+		outputs[ t ] = pInputs[ 0 ] * pInputs[ 1 ] + fabsf( pInputs[ 2 ] ) - 0.5f * pInputs[ 3 ];
+	}
+}
+//----------------------------------------------------------------------------
+
+// Convergence of every optimizer on the smooth task, then the cost of an update step:
+// the optimizer kernels against the axpy of plain descent. A run that ends no better
+// than the untrained net prints "failed".
+static void benchOptimizers()
+{
+	printf( "optimizer convergence, mean squared error @ elapsed seconds per epoch\n" );
+
+	const size_t testCount = s_bQuick ? 4096 : 16384;
+	std::vector< float > inputs;
+	std::vector< float > outputs;
+	makeSmoothTask( inputs, outputs, testCount, 2 );
+	const float fUntrainedError = NeuralNet< Elu >( { 16, 32, 1 } ).computeQuadraticError( &inputs[ 0 ], &outputs[ 0 ], testCount ) / float( testCount );
+
+	struct Setting
+	{
+		const char*	strName;
+		Optimizer	optimizer;
+		float		fLearningRate;
+	};
+	const Setting settings[] = {
+		{ "sgd", Optimizer_Sgd, 0.05f },
+		{ "momentum", Optimizer_Momentum, 0.01f },
+		{ "nesterov", Optimizer_Nesterov, 0.01f },
+		{ "rmsprop", Optimizer_RMSProp, 0.001f },
+		{ "adam", Optimizer_Adam, 0.003f },
+	};
+	const size_t epochCount = s_bQuick ? 3 : 5;
+	for( size_t s = 0; s < sizeof( settings ) / sizeof( settings[ 0 ] ); ++s )
+	{
+		TrainingParams params;
+		params.batchSize = 16;
+		params.optimizer = settings[ s ].optimizer;
+		params.fLearningRate = settings[ s ].fLearningRate;
+		const float fError = runTraining( settings[ s ].strName, inputs, outputs, testCount, params, epochCount );
+		if( !( fError < fUntrainedError ) )
+		{
+			printf( "%s failed, error %.3f untrained %.3f\n", settings[ s ].strName, fError, fUntrainedError );
+		}
+		addRecord( "optimizer", settings[ s ].strName, { { "epochs", double( epochCount ) } }, { { "mean_squared_error", fError } } );
+	}
+
+	printf( "update step, ns per parameter over %d parameters\n", 1 << 20 );
+	printf( "%8s %10s %10s %10s %10s\n", "level", "sgd", "momentum", "rmsprop", "adam" );
+	const size_t count = 1 << 20;
+	std::vector< float > parameters( count );
+	std::vector< float > gradients( count );
+	std::vector< float > state( 2 * count, 0.0f );
+	randomize( &parameters[ 0 ], count, 2 );
+	randomize( &gradients[ 0 ], count, 3 );
+	OptimizerStep step = {};
+	step.fLearningRate = 1e-6f;
+	step.fGradientScale = 1.0f;
+	step.fMomentum = 0.9f;
+	step.fDecay = 0.999f;
+	step.fEpsilon = 1e-8f;
+	step.fCorrection1 = 1.0f;
+	step.fCorrection2 = 1.0f;
+	for( int level = 0; level < SimdLevel_Count; ++level )
+	{
+		const Kernels& kernels = getKernels( SimdLevel( level ) );
+		if( kernels.level != level )
+		{
+			continue;
+		}
+
+		double fNs[ 4 ];
+		for( int optimizer = 0; optimizer < 4; ++optimizer )
+		{
+			const double fSeconds = measure( [ & ]()
+			{
+				switch( optimizer )
+				{
+				case 0: kernels.axpy( step.fLearningRate, &gradients[ 0 ], &parameters[ 0 ], count ); break;
+				case 1: kernels.momentum( step, &parameters[ 0 ], &gradients[ 0 ], &state[ 0 ], &state[ count ], count ); break;
+				case 2: kernels.rmsprop( step, &parameters[ 0 ], &gradients[ 0 ], &state[ 0 ], &state[ count ], count ); break;
+				case 3: kernels.adam( step, &parameters[ 0 ], &gradients[ 0 ], &state[ 0 ], &state[ count ], count ); break;
+				}
+			} );
+			fNs[ optimizer ] = fSeconds * 1e9 / double( count );
+		}
+		printf( "%8s %10.3f %10.3f %10.3f %10.3f\n", kernels.strName, fNs[ 0 ], fNs[ 1 ], fNs[ 2 ], fNs[ 3 ] );
+
+		const char* strOptimizers[] = { "sgd", "momentum", "rmsprop", "adam" };
+		for( int optimizer = 0; optimizer < 4; ++optimizer )
+		{
+			addRecord( "update", strOptimizers[ optimizer ], { { "level", double( level ) } }, { { "ns_per_parameter", fNs[ optimizer ] } } );
+		}
+	}
+}
+//----------------------------------------------------------------------------
+
+// Learning rate schedules against a constant rate, and early stopping on a validation
+// set against running every epoch. Errors are validation mean squared errors; a run
+// that ends no better than the untrained net prints "failed".
+static void benchSchedule()
+{
+	const size_t testCount = s_bQuick ? 4096 : 16384;
+	std::vector< float > inputs;
+	std::vector< float > outputs;
+	std::vector< float > validationInputs;
+	std::vector< float > validationOutputs;
+	makeSmoothTask( inputs, outputs, testCount, 2 );
+	makeSmoothTask( validationInputs, validationOutputs, testCount / 4, 4 );
+	const size_t validationCount = validationOutputs.size();
+
+	const size_t epochCount = s_bQuick ? 10 : 40;
+	printf( "learning rate schedules, %d epochs of %d samples\n", ( int )epochCount, ( int )testCount );
+	printf( "%-22s %10s %10s\n", "schedule", "seconds", "error" );
+	struct Setting
+	{
+		const char*	strName;
+		Schedule	schedule;
+		size_t		warmupEpochs;
+		size_t		patience;
+	};
+	const Setting settings[] = {
+		{ "constant", Schedule_Constant, 0, 0 },
+		{ "step", Schedule_Step, 0, 0 },
+		{ "cosine", Schedule_Cosine, 0, 0 },
+		{ "warmup cosine", Schedule_Cosine, 2, 0 },
+		{ "cosine early stopping", Schedule_Cosine, 0, 3 },
+	};
+	for( size_t s = 0; s < sizeof( settings ) / sizeof( settings[ 0 ] ); ++s )
+	{
+		NeuralNet< Elu > net( { 16, 32, 1 } );
+		const float fUntrainedError = net.computeQuadraticError( &validationInputs[ 0 ], &validationOutputs[ 0 ], validationCount ) / float( validationCount );
+
+		TrainingParams params;
+		params.epochCount = epochCount;
+		params.batchSize = 16;
+		params.fLearningRate = 0.5f;
+		params.schedule = settings[ s ].schedule;
+		params.stepEpochs = epochCount / 4;
+		params.warmupEpochs = settings[ s ].warmupEpochs;
+		params.patience = settings[ s ].patience;
+		params.fMinImprovement = 0.01f;
+		params.pValidationInputs = &validationInputs[ 0 ];
+		params.pValidationOutputs = &validationOutputs[ 0 ];
+		params.validationCount = validationCount;
+		params.bPrintProgress = false;
+
+		Clock::time_point start = Clock::now();
+		net.train( &inputs[ 0 ], &outputs[ 0 ], testCount, params );
+		const double fSeconds = elapsedSeconds( start );
+
+		const float fError = net.computeQuadraticError( &validationInputs[ 0 ], &validationOutputs[ 0 ], validationCount ) / float( validationCount );
+		printf( "%-22s %10.3f %10.5f\n", settings[ s ].strName, fSeconds, fError );
+		if( !( fError < fUntrainedError ) )
+		{
+			printf( "%s failed, error %.5f untrained %.5f\n", settings[ s ].strName, fError, fUntrainedError );
+		}
+		addRecord( "schedule", settings[ s ].strName, { { "epochs", double( epochCount ) } }, { { "seconds", fSeconds }, { "mean_squared_error", fError } } );
+	}
+}
+//----------------------------------------------------------------------------
+
+// Training without a metrics sink against writing JSON lines and against a ring polled
+// by another thread. Prints "failed" unless every epoch arrives exactly once.
+static void benchTelemetry()
+{
+	const size_t testCount = s_bQuick ? 4096 : 16384;
+	std::vector< float > inputs;
+	std::vector< float > outputs;
+	makeSmoothTask( inputs, outputs, testCount, 2 );
+
+	const size_t epochCount = s_bQuick ? 5 : 20;
+	printf( "training telemetry, %d epochs of %d samples\n", ( int )epochCount, ( int )testCount );
+	printf( "%-12s %8s %10s %10s\n", "sink", "threads", "seconds", "overhead" );
+	const char* strPath = "bench_telemetry.jsonl";
+	for( size_t threadCount = 1; threadCount <= 2; ++threadCount )
+	{
+		double fBaseSeconds = 0.0;
+		for( int sink = 0; sink < 3; ++sink )
+		{
+			const char* strNames[] = { "none", "json lines", "ring" };
+			NeuralNet< Elu > net( { 16, 32, 1 } );
+			TrainingParams params;
+			params.epochCount = epochCount;
+			params.batchSize = 16;
+			params.threadCount = threadCount;
+			params.bPrintProgress = false;
+
+			FILE* pFile = nullptr;
+			JsonLinesSink jsonSink( nullptr );
+			MetricsRing ring;
+			std::atomic< bool > bTraining( true );
+			size_t polledCount = 0;
+			std::thread poller;
+			if( sink == 1 )
+			{
+				pFile = fopen( strPath, "w" );
+				if( pFile == nullptr )
+				{
+					printf( "telemetry failed, cannot write %s\n", strPath );
+					return;
+				}
+				jsonSink = JsonLinesSink( pFile );
+				params.pMetricsSink = &jsonSink;
+			}
+			else if( sink == 2 )
+			{
+				params.pMetricsSink = &ring;
+				poller = std::thread( [ & ]()
+				{
+					EpochMetrics metrics;
+					bool bRunning = true;
+					while( bRunning )
+					{
+						bRunning = bTraining.load( std::memory_order_acquire );
+						while( ring.poll( metrics ) )
+						{
+							++polledCount;
+						}
+						std::this_thread::yield();
+					}
+				} );
+			}
+
+			Clock::time_point start = Clock::now();
+			net.train( &inputs[ 0 ], &outputs[ 0 ], testCount, params );
+			const double fSeconds = elapsedSeconds( start );
+
+			size_t recordCount = epochCount;
+			if( sink == 1 )
+			{
+				fclose( pFile );
+				recordCount = 0;
+				pFile = fopen( strPath, "r" );
+				for( int c = fgetc( pFile ); c != EOF; c = fgetc( pFile ) )
+				{
+					recordCount += c == '\n' ? 1 : 0;
+				}
+				fclose( pFile );
+				remove( strPath );
+			}
+			else if( sink == 2 )
+			{
+				bTraining.store( false, std::memory_order_release );
+				poller.join();
+				recordCount = polledCount;
+			}
+
+			if( sink == 0 )
+			{
+				fBaseSeconds = fSeconds;
+			}
+			const double fOverhead = fSeconds / fBaseSeconds - 1.0;
+			printf( "%-12s %8d %10.3f %9.1f%%\n", strNames[ sink ], ( int )threadCount, fSeconds, 100.0 * fOverhead );
+			if( recordCount != epochCount )
+			{
+				printf( "%s failed, %d records for %d epochs\n", strNames[ sink ], ( int )recordCount, ( int )epochCount );
+			}
+			addRecord( "telemetry", strNames[ sink ], { { "threads", double( threadCount ) }, { "epochs", double( epochCount ) } }, { { "seconds", fSeconds }, { "overhead", fOverhead } } );
+		}
+	}
+}
+//----------------------------------------------------------------------------
+
+static void benchInference()
+{
+	printf( "inference server, 4 producers with up to 64 requests in flight each\n" );
+	printf( "%8s %8s %12s %10s %10s %10s\n", "workers", "batch", "requests/s", "mean batch", "p50 us", "p99 us" );
+
+	const NeuralNet< Elu > net( { 64, 256, 256, 16 } );
+	const size_t producerCount = 4;
+	const size_t inFlightCount = 64;
+	const size_t requestCount = 20000;
+
+	std::vector< float > inputs( inFlightCount * net.getInputCount() );
+	randomize( &inputs[ 0 ], inputs.size() );
+
+	const size_t batchSizes[] = { 1, 8, 32 };
+	for( size_t workerCount = 1; workerCount <= 2; ++workerCount )
+	{
+		for( size_t s = 0; s < sizeof( batchSizes ) / sizeof( batchSizes[ 0 ] ); ++s )
+		{
+			InferenceParams params;
+			params.workerCount = workerCount;
+			params.maxBatchSize = batchSizes[ s ];
+			InferenceServer< NeuralNet< Elu > > server( net, params );
+
+			auto producer = [ & ]( size_t )
+			{
+				std::vector< float > outputs( inFlightCount * net.getOutputCount() );
+				std::vector< std::future< void > > futures( inFlightCount );
+				for( size_t r = 0; r < requestCount / producerCount; ++r )
+				{
+					const size_t slot = r % inFlightCount;
+					if( futures[ slot ].valid() )
+					{
+						futures[ slot ].wait();
+					}
+					futures[ slot ] = server.submit( &inputs[ slot * net.getInputCount() ], &outputs[ slot * net.getOutputCount() ] );
+				}
+				for( size_t f = 0; f < futures.size(); ++f )
+				{
+					if( futures[ f ].valid() )
+					{
+						futures[ f ].wait();
+					}
+				}
+			};
+			runThreads( producerCount, producer );
+
+			const InferenceStats stats = server.getStats();
+			printf( "%8d %8d %12.0f %10.1f %10.1f %10.1f\n", ( int )workerCount, ( int )batchSizes[ s ],
+				stats.fRequestsPerSecond, stats.fMeanBatchSize, stats.fP50Microseconds, stats.fP99Microseconds );
+			addRecord( "inference", "server", { { "workers", double( workerCount ) }, { "batch", double( batchSizes[ s ] ) } },
+				{ { "requests_per_second", stats.fRequestsPerSecond }, { "p50_us", stats.fP50Microseconds }, { "p99_us", stats.fP99Microseconds },
+				{ "mean_batch", stats.fMeanBatchSize } } );
+		}
+	}
+}
+//----------------------------------------------------------------------------
+
+static void benchCheckpoint()
+{
+	printf( "checkpoint of a 1024-4096-4096-1024 net\n" );
+
+	const NeuralNet< Relu, Sigmoid > net( { 1024, 4096, 4096, 1024 } );
+	const char* strPath = "bench_checkpoint.nncp";
+
+	Clock::time_point start = Clock::now();
+	if( !saveCheckpoint( net, strPath ) )
+	{
+		printf( "saving %s failed\n", strPath );
+		return;
+	}
+	const double fSaveMs = elapsedSeconds( start ) * 1e3;
+	const double fMegabytes = double( net.getParameterCount() * sizeof( float ) ) / ( 1024.0 * 1024.0 );
+	printf( "%-28s %10.3f ms  %.1f MB\n", "save", fSaveMs, fMegabytes );
+	addRecord( "checkpoint", "save", {}, { { "ms", fSaveMs }, { "megabytes", fMegabytes } } );
+
+	std::vector< float > inputs( net.getInputCount() );
+	std::vector< float > outputs( net.getOutputCount() );
+	std::vector< float > mappedOutputs( net.getOutputCount() );
+	randomize( &inputs[ 0 ], inputs.size() );
+	Workspace workspace( net );
+	net.evaluate( &inputs[ 0 ], &outputs[ 0 ], workspace );
+
+	for( int verify = 0; verify < 2; ++verify )
+	{
+		start = Clock::now();
+		MappedCheckpoint checkpoint;
+		if( !checkpoint.open( strPath, verify != 0 ) || !checkpoint.matches< Relu, Sigmoid >() )
+		{
+			printf( "loading %s failed\n", strPath );
+			break;
+		}
+		const NeuralNet< Relu, Sigmoid > mappedNet( checkpoint.getLayerSizes(), checkpoint.getLayerSizeCount(), checkpoint.getParameters() );
+		const double fOpenMs = elapsedSeconds( start ) * 1e3;
+
+		mappedNet.evaluate( &inputs[ 0 ], &mappedOutputs[ 0 ], workspace );
+		const bool bSame = memcmp( &outputs[ 0 ], &mappedOutputs[ 0 ], outputs.size() * sizeof( float ) ) == 0;
+		printf( "%-28s %10.3f ms  outputs %s\n", verify ? "map, checksum verified" : "map", fOpenMs, bSame ? "identical" : "DIFFER" );
+		addRecord( "checkpoint", verify ? "map verified" : "map", {}, { { "ms", fOpenMs } } );
+		if( !bSame )
+		{
+			printf( "mapped outputs failed, they differ from the saved net\n" );
+		}
+
+		// The mapping is read-only, writing it would fault
+		NeuralNet< Relu, Sigmoid > viewNet( checkpoint.getLayerSizes(), checkpoint.getLayerSizeCount(), checkpoint.getParameters() );
+		TrainingParams params;
+		params.epochCount = 1;
+		params.bPrintProgress = false;
+		const float fError = viewNet.train( &inputs[ 0 ], &outputs[ 0 ], 1, params );
+		if( viewNet.initialize( InitParams() ) || fError == fError )
+		{
+			printf( "read-only view failed, it accepted training or initialization\n" );
+		}
+	}
+	remove( strPath );
+}
+//----------------------------------------------------------------------------
+
+static void benchStreaming()
+{
+	printf( "streamed and memory-mapped datasets against in-memory training, 3 epochs\n" );
+
+	const size_t inputCount = 16;
+	const size_t testCount = 262144;
+	std::vector< float > inputs( testCount * inputCount );
+	std::vector< float > outputs( testCount );
+	srand( 7 );
+	for( size_t t = 0; t < testCount; ++t )
+	{
+		float* pInputs = &inputs[ t * inputCount ];
+		for( size_t i = 0; i < inputCount; ++i )
+		{
+			pInputs[ i ] = float( rand() ) / float( RAND_MAX );
+		}
+		outputs[ t ] = 0.5f * ( pInputs[ t % inputCount ] + pInputs[ ( t * 7 ) % inputCount ] );
+	}
+
+	const char* strPath = "bench_samples.bin";
+	FILE* pFile = fopen( strPath, "wb" );
+	if( pFile == nullptr )
+	{
+		printf( "writing %s failed\n", strPath );
+		return;
+	}
+	for( size_t t = 0; t < testCount; ++t )
+	{
+		fwrite( &inputs[ t * inputCount ], sizeof( float ), inputCount, pFile );
+		fwrite( &outputs[ t ], sizeof( float ), 1, pFile );
+	}
+	fclose( pFile );
+
+	TrainingParams params;
+	params.epochCount = 3;
+	params.fLearningRate = 0.0002f;
+	params.batchSize = 16;
+	params.bPrintProgress = false;
+
+	auto record = [ & ]( const char* strName, double fSeconds, float fError )
+	{
+		addRecord( "streaming", strName, {}, { { "samples_per_second", double( testCount * params.epochCount ) / fSeconds }, { "error", fError } } );
+	};
+
+	NeuralNet< Elu > memoryNet( { 16, 32, 1 } );
+	Clock::time_point start = Clock::now();
+	const float fMemoryError = memoryNet.train( &inputs[ 0 ], &outputs[ 0 ], testCount, params );
+	const double fMemorySeconds = elapsedSeconds( start );
+	printf( "%-12s %8.3f s  error %.6f\n", "in memory", fMemorySeconds, fMemoryError );
+	record( "in memory", fMemorySeconds, fMemoryError );
+
+	NeuralNet< Elu > streamNet( { 16, 32, 1 } );
+	StreamingDataset dataset;
+	start = Clock::now();
+	if( !dataset.open( strPath, inputCount, 1, 16384 ) )
+	{
+		printf( "opening %s failed\n", strPath );
+		return;
+	}
+	const float fStreamError = streamNet.train( dataset, params );
+	const double fStreamSeconds = elapsedSeconds( start );
+	// The errors differ in summation order only, the updates must match exactly
+	const bool bSame = memcmp( memoryNet.getParameters(), streamNet.getParameters(), memoryNet.getParameterCount() * sizeof( float ) ) == 0;
+	printf( "%-12s %8.3f s  error %.6f  weights %s\n", "streamed", fStreamSeconds, fStreamError, bSame ? "identical" : "DIFFER" );
+	record( "streamed", fStreamSeconds, fStreamError );
+	if( !bSame )
+	{
+		printf( "streamed training failed, weights differ from in-memory training\n" );
+	}
+
+	// A file cut short while streaming must fail the training, not end the epoch early
+	if( dataset.open( strPath, 0, 0 ) )
+	{
+		printf( "empty rows check failed, the dataset opened\n" );
+	}
+	if( dataset.open( strPath, inputCount, 1, 16384 ) )
+	{
+		FILE* pTruncated = fopen( strPath, "wb" );
+		if( pTruncated != nullptr )
+		{
+			fclose( pTruncated );
+			const float fTruncatedError = streamNet.train( dataset, params );
+			if( fTruncatedError == fTruncatedError )
+			{
+				printf( "truncated stream check failed, training did not report the read error\n" );
+			}
+		}
+	}
+	dataset.close();
+	remove( strPath );
+
+	for( int storage = SampleStorage_Float32; storage <= SampleStorage_Float16; ++storage )
+	{
+		SampleFileWriter writer;
+		bool bWritten = writer.open( strPath, inputCount, 1, testCount, SampleStorage( storage ) );
+		for( size_t t = 0; bWritten && t < testCount; ++t )
+		{
+			bWritten = writer.write( &inputs[ t * inputCount ], &outputs[ t ] );
+		}
+		bWritten = writer.close() && bWritten;
+
+		MappedSampleFile sampleFile;
+		if( !bWritten || !sampleFile.open( strPath, 16384 ) )
+		{
+			printf( "sample file %s failed\n", strPath );
+			remove( strPath );
+			return;
+		}
+
+		NeuralNet< Elu > mappedNet( { 16, 32, 1 } );
+		start = Clock::now();
+		const float fMappedError = mappedNet.train( sampleFile, params );
+		const double fSeconds = elapsedSeconds( start );
+		if( storage == SampleStorage_Float32 )
+		{
+			const bool bMappedSame = memcmp( memoryNet.getParameters(), mappedNet.getParameters(), memoryNet.getParameterCount() * sizeof( float ) ) == 0;
+			printf( "%-12s %8.3f s  error %.6f  weights %s\n", "mapped f32", fSeconds, fMappedError, bMappedSame ? "identical" : "DIFFER" );
+			if( !bMappedSame )
+			{
+				printf( "mapped training failed, weights differ from in-memory training\n" );
+			}
+		}
+		else
+		{
+			printf( "%-12s %8.3f s  error %.6f\n", "mapped f16", fSeconds, fMappedError );
+		}
+		record( storage == SampleStorage_Float32 ? "mapped f32" : "mapped f16", fSeconds, fMappedError );
+		sampleFile.close();
+		remove( strPath );
+	}
+}
+//----------------------------------------------------------------------------
+
+static void benchShuffle()
+{
+	printf( "epoch order over 256 MB of samples, one epoch each\n" );
+	printf( "%-10s %14s\n", "order", "samples/s" );
+
+	// Larger than the last level cache, so a fully random order misses on every sample
+	const size_t inputCount = 32;
+	const size_t testCount = 2 * 1024 * 1024;
+	std::vector< float > inputs( testCount * inputCount );
+	std::vector< float > outputs( testCount );
+	srand( 7 );
+	for( size_t t = 0; t < testCount; ++t )
+	{
+		float* pInputs = &inputs[ t * inputCount ];
+		for( size_t i = 0; i < inputCount; ++i )
+		{
+			pInputs[ i ] = float( rand() ) / float( RAND_MAX );
+		}
+		outputs[ t ] = pInputs[ t % inputCount ];
+	}
+
+	const char* strNames[] = { "sequential", "blocked", "full" };
+	for( int mode = ShuffleMode_None; mode <= ShuffleMode_Full; ++mode )
+	{
+		TrainingParams params;
+		params.epochCount = 1;
+		params.fLearningRate = 0.0001f;
+		params.batchSize = 32;
+		params.shuffleMode = ShuffleMode( mode );
+		params.shuffleBlockSize = 1024;
+		params.bPrintProgress = false;
+
+		NeuralNet< Elu > net( { 32, 8, 1 } );
+		Clock::time_point start = Clock::now();
+		net.train( &inputs[ 0 ], &outputs[ 0 ], testCount, params );
+		const double fSamplesPerSecond = double( testCount ) / elapsedSeconds( start );
+		printf( "%-10s %14.0f\n", strNames[ mode ], fSamplesPerSecond );
+		addRecord( "shuffle", strNames[ mode ], { { "block", double( params.shuffleBlockSize ) } }, { { "samples_per_second", fSamplesPerSecond } } );
+	}
+}
+//----------------------------------------------------------------------------
+
+static void benchInit()
+{
+	printf( "initializing a 4096-4096-4096-1024 net, %.1f M parameters\n", ( 4096.0 * 4096.0 * 2.0 + 4096.0 * 1024.0 ) / 1e6 );
+
+	// What initialization cost with the global rand()
+	const size_t sizes[] = { 4096, 4096, 4096, 1024 };
+	std::vector< float > values( computeParameterCount( sizes, 4 ) );
+	srand( 1 );
+	Clock::time_point start = Clock::now();
+	for( size_t i = 0; i < values.size(); ++i )
+	{
+		values[ i ] = ( float( rand() ) / float( RAND_MAX ) ) * 0.4f + 0.5f;
+	}
+	const double fRandMs = elapsedSeconds( start ) * 1e3;
+	printf( "%-16s %10.2f ms\n", "rand()", fRandMs );
+	addRecord( "init", "rand", { { "threads", 1.0 } }, { { "ms", fRandMs } } );
+
+	NeuralNet< Relu > reference( sizes, 4 );
+	InitParams params;
+	const size_t threadCounts[] = { 1, 2, 4, 0 };
+	for( size_t c = 0; c < sizeof( threadCounts ) / sizeof( threadCounts[ 0 ] ); ++c )
+	{
+		params.threadCount = threadCounts[ c ];
+		NeuralNet< Relu > net( sizes, 4, params );
+		start = Clock::now();
+		net.initialize( params );
+		const double fMs = elapsedSeconds( start ) * 1e3;
+		const bool bSame = memcmp( net.getParameters(), reference.getParameters(), net.getParameterCount() * sizeof( float ) ) == 0;
+
+		char strName[ 32 ];
+		snprintf( strName, sizeof( strName ), threadCounts[ c ] ? "philox x%d" : "philox auto", ( int )threadCounts[ c ] );
+		printf( "%-16s %10.2f ms  %s\n", strName, fMs, bSame ? "identical" : "DIFFER" );
+		// 0 threads is one per core
+		addRecord( "init", "philox", { { "threads", double( threadCounts[ c ] ) } }, { { "ms", fMs } } );
+		if( !bSame )
+		{
+			printf( "%s failed, parameters depend on the thread count\n", strName );
+		}
+	}
+}
+//----------------------------------------------------------------------------
+
+// Layer passes on a square layer followed by another one of the same width. Flops
+// count multiply-adds as two; bytes per sample are weight bytes streamed, shared by
+// the batch, plus the sample's own activations. "propagate bf16" reads bfloat16
+// weights, see WeightStorage.
+static void benchLayers()
+{
+	printf( "layer passes on square layers\n" );
+	printf( "%-14s %6s %6s %12s %9s %14s %14s\n", "pass", "width", "batch", "ns", "GFLOP/s", "bytes/sample", "samples/s" );
+
+	const size_t widths[] = { 64, 256, 1024 };
+	const size_t batchSizes[] = { 1, 8, 32, 128 };
+	const size_t widthCount = s_bQuick ? 2 : 3;
+	for( size_t w = 0; w < widthCount; ++w )
+	{
+		const size_t width = widths[ w ];
+		NeuralNet< Relu > net( { width, width, width } );
+		// Copies of the views, updateWeights writes into the net's slab
+		Layer< Relu > layer = net.getHiddenLayer( 0 );
+		const Layer< Relu >& nextLayer = net.getOutputLayer();
+		std::vector< uint16_t > weightsBf16( width * width );
+		getKernels().toBf16( layer.getWeights(), &weightsBf16[ 0 ], weightsBf16.size() );
+		Layer< Relu > layerBf16 = layer;
+		layerBf16.setWeightsBf16( &weightsBf16[ 0 ] );
+
+		for( size_t b = 0; b < sizeof( batchSizes ) / sizeof( batchSizes[ 0 ] ); ++b )
+		{
+			const size_t batchSize = batchSizes[ b ];
+			std::vector< float > inputs( width * batchSize );
+			std::vector< float > values( width * batchSize );
+			std::vector< float > nextDeltas( width * batchSize );
+			std::vector< float > deltas( width * batchSize );
+			randomize( &inputs[ 0 ], inputs.size(), 2 );
+			randomize( &nextDeltas[ 0 ], nextDeltas.size(), 3 );
+			layer.propagate( &inputs[ 0 ], &values[ 0 ], batchSize );
+
+			for( int pass = 0; pass < 4; ++pass )
+			{
+				double fSeconds = 0.0;
+				double fWeightBytes = double( width * width * sizeof( float ) );
+				const char* strPass = "";
+				switch( pass )
+				{
+				case 0:
+					strPass = "propagate";
+					fSeconds = measure( [ & ]() { layer.propagate( &inputs[ 0 ], &values[ 0 ], batchSize ); } );
+					break;
+				case 1:
+					strPass = "computeDeltas";
+					fSeconds = measure( [ & ]() { layer.computeDeltas( &nextLayer, &nextDeltas[ 0 ], &values[ 0 ], &deltas[ 0 ], batchSize ); } );
+					break;
+				case 2:
+					// Tiny rate so repeated updates leave the weights where they were
+					strPass = "updateWeights";
+					fWeightBytes *= 2.0;
+					fSeconds = measure( [ & ]() { layer.updateWeights( &inputs[ 0 ], &nextDeltas[ 0 ], 1e-12f, batchSize ); } );
+					break;
+				case 3:
+					strPass = "propagate bf16";
+					fWeightBytes /= 2.0;
+					fSeconds = measure( [ & ]() { layerBf16.propagate( &inputs[ 0 ], &values[ 0 ], batchSize ); } );
+					break;
+				}
+
+				const double fGflops = 2.0 * double( width * width * batchSize ) / fSeconds * 1e-9;
+				const double fBytesPerSample = fWeightBytes / double( batchSize ) + double( 2 * width * sizeof( float ) );
+				const double fSamplesPerSecond = double( batchSize ) / fSeconds;
+				printf( "%-14s %6d %6d %12.0f %9.2f %14.0f %14.0f\n", strPass, ( int )width, ( int )batchSize, fSeconds * 1e9, fGflops, fBytesPerSample, fSamplesPerSecond );
+				addRecord( "layer", strPass, { { "width", double( width ) }, { "batch", double( batchSize ) } }, { { "ns", fSeconds * 1e9 },
+					{ "gflops", fGflops }, { "bytes_per_sample", fBytesPerSample }, { "samples_per_second", fSamplesPerSecond } } );
+			}
+		}
+	}
+}
+//----------------------------------------------------------------------------
+
+// One training epoch and one evaluation pass over the same samples. A trained sample
+// costs about three forward passes: forward, deltas and weight update.
+static void benchNetwork()
+{
+	printf( "whole nets, %s\n", "train() one epoch and evaluate() over 4096 samples" );
+	printf( "%-10s %-20s %6s %9s %14s %14s\n", "loop", "topology", "batch", "GFLOP/s", "bytes/sample", "samples/s" );
+
+	const size_t topologies[][ 4 ] = { { 64, 256, 256, 10 }, { 256, 1024, 1024, 10 } };
+	const size_t batchSizes[] = { 1, 32, 128 };
+	const size_t testCount = s_bQuick ? 1024 : 4096;
+	for( size_t n = 0; n < sizeof( topologies ) / sizeof( topologies[ 0 ] ); ++n )
+	{
+		const size_t* pSizes = topologies[ n ];
+		char strTopology[ 32 ];
+		snprintf( strTopology, sizeof( strTopology ), "%d-%d-%d-%d", ( int )pSizes[ 0 ], ( int )pSizes[ 1 ], ( int )pSizes[ 2 ], ( int )pSizes[ 3 ] );
+		double fForwardFlops = 0.0;
+		for( size_t l = 0; l < 3; ++l )
+		{
+			fForwardFlops += 2.0 * double( pSizes[ l ] * pSizes[ l + 1 ] );
+		}
+
+		std::vector< float > inputs( testCount * pSizes[ 0 ] );
+		std::vector< float > outputs( testCount * pSizes[ 3 ] );
+		randomize( &inputs[ 0 ], inputs.size(), 2 );
+		randomize( &outputs[ 0 ], outputs.size(), 3 );
+
+		for( size_t b = 0; b < sizeof( batchSizes ) / sizeof( batchSizes[ 0 ] ); ++b )
+		{
+			const size_t batchSize = batchSizes[ b ];
+			NeuralNet< Relu > net( pSizes, 4 );
+			const double fParameterBytes = double( net.getParameterCount() * sizeof( float ) );
+
+			TrainingParams params;
+			params.epochCount = 1;
+			params.fLearningRate = 1e-6f;
+			params.batchSize = batchSize;
+			params.bPrintProgress = false;
+			const double fTrainSeconds = measure( [ & ]() { net.train( &inputs[ 0 ], &outputs[ 0 ], testCount, params ); } ) / double( testCount );
+
+			Workspace workspace( net, batchSize );
+			std::vector< float > results( batchSize * net.getOutputCount() );
+			const double fEvaluateSeconds = measure( [ & ]()
+			{
+				for( size_t test = 0; test < testCount; test += batchSize )
+				{
+					net.evaluate( &inputs[ test * net.getInputCount() ], &results[ 0 ], workspace, std::min( batchSize, testCount - test ) );
+				}
+			} ) / double( testCount );
+
+			for( int loop = 0; loop < 2; ++loop )
+			{
+				const bool bTrain = ( loop == 0 );
+				const double fSeconds = bTrain ? fTrainSeconds : fEvaluateSeconds;
+				const double fGflops = ( bTrain ? 3.0 : 1.0 ) * fForwardFlops / fSeconds * 1e-9;
+				const double fBytesPerSample = ( bTrain ? 3.0 : 1.0 ) * fParameterBytes / double( batchSize );
+				printf( "%-10s %-20s %6d %9.2f %14.0f %14.0f\n", bTrain ? "train" : "evaluate", strTopology, ( int )batchSize, fGflops, fBytesPerSample, 1.0 / fSeconds );
+				char strName[ 48 ];
+				snprintf( strName, sizeof( strName ), "%s %s", bTrain ? "train" : "evaluate", strTopology );
+				addRecord( "net", strName, { { "batch", double( batchSize ) } },
+					{ { "gflops", fGflops }, { "bytes_per_sample", fBytesPerSample }, { "samples_per_second", 1.0 / fSeconds } } );
+			}
+		}
+	}
+}
+//----------------------------------------------------------------------------
+
+// Training with the output layer fused into one pass over its weights against the
+// separate passes, on nets whose output layer is a large share of the weights
+static void benchFused()
+{
+	printf( "train() with a fused output layer\n" );
+	printf( "%-16s %6s %14s %14s %8s\n", "topology", "batch", "separate/s", "fused/s", "speedup" );
+
+	const size_t topologies[][ 3 ] = { { 256, 256, 1024 }, { 1024, 1024, 1024 } };
+	const size_t batchSizes[] = { 1, 32 };
+	const size_t sampleCount = s_bQuick ? 256 : 1024;
+	for( size_t n = 0; n < sizeof( topologies ) / sizeof( topologies[ 0 ] ); ++n )
+	{
+		const size_t* pSizes = topologies[ n ];
+		char strTopology[ 32 ];
+		snprintf( strTopology, sizeof( strTopology ), "%d-%d-%d", ( int )pSizes[ 0 ], ( int )pSizes[ 1 ], ( int )pSizes[ 2 ] );
+		std::vector< float > inputs( sampleCount * pSizes[ 0 ] );
+		std::vector< float > outputs( sampleCount * pSizes[ 2 ] );
+		randomize( &inputs[ 0 ], inputs.size(), 2 );
+		randomize( &outputs[ 0 ], outputs.size(), 3 );
+
+		for( size_t b = 0; b < sizeof( batchSizes ) / sizeof( batchSizes[ 0 ] ); ++b )
+		{
+			double fSamplesPerSecond[ 2 ];
+			for( int fused = 0; fused < 2; ++fused )
+			{
+				NeuralNet< Relu, Sigmoid > net( pSizes, 3 );
+				TrainingParams params;
+				params.epochCount = 1;
+				params.fLearningRate = 1e-6f;
+				params.batchSize = batchSizes[ b ];
+				params.bFuseOutputLayer = ( fused != 0 );
+				params.bPrintProgress = false;
+				fSamplesPerSecond[ fused ] = double( sampleCount ) / measure( [ & ]() { net.train( &inputs[ 0 ], &outputs[ 0 ], sampleCount, params ); } );
+			}
+			printf( "%-16s %6d %14.0f %14.0f %7.2fx\n", strTopology, ( int )batchSizes[ b ], fSamplesPerSecond[ 0 ], fSamplesPerSecond[ 1 ], fSamplesPerSecond[ 1 ] / fSamplesPerSecond[ 0 ] );
+			char strName[ 48 ];
+			snprintf( strName, sizeof( strName ), "train %s", strTopology );
+			addRecord( "fused", strName, { { "batch", double( batchSizes[ b ] ) } },
+				{ { "fused_samples_per_second", fSamplesPerSecond[ 1 ] }, { "separate_samples_per_second", fSamplesPerSecond[ 0 ] } } );
+		}
+	}
+}
+//----------------------------------------------------------------------------
+
+// int8 inference against float and bfloat16 weights. Accuracy is measured on a small
+// net trained to separate a synthetic task, throughput on a large freshly initialized one.
+static void benchQuantized()
+{
+	const size_t sampleCount = 4096;
+	{
+		NeuralNet< Relu, Sigmoid > net( { 64, 256, 256, 10 } );
+		std::vector< float > inputs( sampleCount * 64 );
+		std::vector< float > outputs( sampleCount * 10 );
+		randomize( &inputs[ 0 ], inputs.size(), 2 );
+		for( size_t i = 0; i < inputs.size(); ++i )
+		{
+			inputs[ i ] = ( inputs[ i ] - 0.7f ) * 5.0f;
+		}
+		for( size_t sample = 0; sample < sampleCount; ++sample )
+		{
+			for( size_t o = 0; o < 10; ++o )
+			{
+				float fSum = 0.0f;
+				for( size_t i = 0; i < 6; ++i )
+				{
+					fSum += inputs[ sample * 64 + o * 6 + i ];
+				}
+				outputs[ sample * 10 + o ] = fSum > 0.0f ? 0.9f : 0.1f;
+			}
+		}
+
+		TrainingParams params;
+		params.epochCount = s_bQuick ? 5 : 20;
+		params.fLearningRate = 0.01f;
+		params.batchSize = 8;
+		params.bPrintProgress = false;
+		net.train( &inputs[ 0 ], &outputs[ 0 ], sampleCount, params );
+
+		QuantizedNet< Relu, Sigmoid > quantizedNet( net );
+		printf( "int8 accuracy, trained 64-256-256-10\n" );
+		const QuantizationReport report = compareQuantized( net, quantizedNet, &inputs[ 0 ], sampleCount );
+		print( report );
+		addRecord( "quantized", "accuracy 64-256-256-10", {}, { { "max_abs_error", report.fMaxAbsError }, { "mean_abs_error", report.fMeanAbsError },
+			{ "rms_error", report.fRmsError }, { "argmax_agreement", report.fArgmaxAgreement } } );
+	}
+
+	printf( "evaluate() on 256-1024-1024-10 over %d samples\n", ( int )sampleCount );
+	printf( "%-10s %6s %12s %14s\n", "weights", "batch", "bytes", "samples/s" );
+	NeuralNet< Relu > net( { 256, 1024, 1024, 10 } );
+	NeuralNet< Relu > netBf16( { 256, 1024, 1024, 10 } );
+	netBf16.setWeightStorage( WeightStorage_BFloat16 );
+	QuantizedNet< Relu > quantizedNet( net );
+	std::vector< float > inputs( sampleCount * net.getInputCount() );
+	std::vector< float > results( sampleCount * net.getOutputCount() );
+	randomize( &inputs[ 0 ], inputs.size(), 2 );
+
+	const size_t batchSizes[] = { 1, 64 };
+	for( size_t b = 0; b < sizeof( batchSizes ) / sizeof( batchSizes[ 0 ] ); ++b )
+	{
+		const size_t batchSize = batchSizes[ b ];
+		for( int storage = 0; storage < 3; ++storage )
+		{
+			const char* strStorage[] = { "float", "bfloat16", "int8" };
+			const double fBytes[] = { double( net.getParameterCount() * sizeof( float ) ), double( net.getParameterCount() * sizeof( uint16_t ) ), double( quantizedNet.getByteCount() ) };
+			Workspace workspace;
+			workspace.resize( quantizedNet.getHiddenValueCount(), net.getOutputCount(), batchSize );
+			const double fSeconds = measure( [ & ]()
+			{
+				for( size_t sample = 0; sample < sampleCount; sample += batchSize )
+				{
+					const size_t batchCount = std::min( batchSize, sampleCount - sample );
+					float* pResults = &results[ sample * net.getOutputCount() ];
+					const float* pInputs = &inputs[ sample * net.getInputCount() ];
+					switch( storage )
+					{
+					case 0: net.evaluate( pInputs, pResults, workspace, batchCount ); break;
+					case 1: netBf16.evaluate( pInputs, pResults, workspace, batchCount ); break;
+					case 2: quantizedNet.evaluate( pInputs, pResults, workspace, batchCount ); break;
+					}
+				}
+			} );
+			const double fSamplesPerSecond = double( sampleCount ) / fSeconds;
+			printf( "%-10s %6d %12.0f %14.0f\n", strStorage[ storage ], ( int )batchSize, fBytes[ storage ], fSamplesPerSecond );
+			addRecord( "quantized", strStorage[ storage ], { { "batch", double( batchSize ) } }, { { "samples_per_second", fSamplesPerSecond }, { "bytes", fBytes[ storage ] } } );
+		}
+	}
+}
+//----------------------------------------------------------------------------
+
+// Representative training and inference runs, the workload for profile guided builds
+// (see cmake/pgo.cmake). Covers every activation, per-sample and batched descent,
+// shuffling, threaded training and batched evaluation.
+template< typename HiddenActivation, typename OutputActivation >
+static void runWorkload( const char* strName, std::initializer_list< size_t > layerSizes, const TrainingParams& params, size_t sampleCount )
+{
+	NeuralNet< HiddenActivation, OutputActivation > net( layerSizes );
+	std::vector< float > inputs( sampleCount * net.getInputCount() );
+	std::vector< float > outputs( sampleCount * net.getOutputCount() );
+	randomize( &inputs[ 0 ], inputs.size(), 2 );
+	randomize( &outputs[ 0 ], outputs.size(), 3 );
+
+	Clock::time_point start = Clock::now();
+	const float fError = net.train( &inputs[ 0 ], &outputs[ 0 ], sampleCount, params );
+	const double fTrainSeconds = elapsedSeconds( start );
+
+	const size_t batchSize = 64;
+	Workspace workspace( net, batchSize );
+	std::vector< float > results( batchSize * net.getOutputCount() );
+	start = Clock::now();
+	for( size_t sample = 0; sample < sampleCount; sample += batchSize )
+	{
+		net.evaluate( &inputs[ sample * net.getInputCount() ], &results[ 0 ], workspace, std::min( batchSize, sampleCount - sample ) );
+	}
+	const double fEvaluateSeconds = elapsedSeconds( start );
+
+	const double fTrainRate = double( sampleCount * params.epochCount ) / fTrainSeconds;
+	const double fEvaluateRate = double( sampleCount ) / fEvaluateSeconds;
+	printf( "%-30s %14.0f %14.0f %10.5f\n", strName, fTrainRate, fEvaluateRate, fError );
+	addRecord( "profile", strName, {}, { { "train_samples_per_second", fTrainRate }, { "evaluate_samples_per_second", fEvaluateRate } } );
+}
+//----------------------------------------------------------------------------
+
+static void benchProfile()
+{
+	printf( "profile workload\n" );
+	printf( "%-30s %14s %14s %10s\n", "workload", "train/s", "evaluate/s", "error" );
+	const size_t sampleCount = s_bQuick ? 2048 : 8192;
+
+	TrainingParams params;
+	params.bPrintProgress = false;
+	params.epochCount = 2;
+	params.fLearningRate = 0.05f;
+	runWorkload< Sigmoid, Sigmoid >( "sgd sigmoid 16-32-1", { 16, 32, 1 }, params, sampleCount );
+
+	params.fLearningRate = 0.001f;
+	params.batchSize = 32;
+	params.shuffleMode = ShuffleMode_Blocked;
+	runWorkload< Relu, Sigmoid >( "batch relu 64-256-256-10", { 64, 256, 256, 10 }, params, sampleCount );
+
+	params.batchSize = 8;
+	params.shuffleMode = ShuffleMode_Full;
+	runWorkload< Elu, Elu >( "batch elu 32-128-128-4", { 32, 128, 128, 4 }, params, sampleCount );
+
+	params.batchSize = 64;
+	params.threadCount = 4;
+	params.shuffleMode = ShuffleMode_None;
+	runWorkload< Softplus, Sigmoid >( "parallel softplus 128-512-10", { 128, 512, 10 }, params, sampleCount );
+
+	params.batchSize = 1;
+	params.parallelMode = ParallelMode_Hogwild;
+	params.fLearningRate = 0.0002f;
+	runWorkload< Relu, Relu >( "hogwild relu 16-32-1", { 16, 32, 1 }, params, sampleCount );
+}
+//----------------------------------------------------------------------------
+
+int main( int argc, const char** argv )
+{
+	struct Section
+	{
+		const char* strName;
+		void ( *function )();
+	};
+	const Section sections[] = {
+		{ "layers", benchLayers },
+		{ "net", benchNetwork },
+		{ "backward", benchBackward },
+		{ "transfer", benchTransfer },
+		{ "hogwild", benchHogwild },
+		{ "scaling", benchScaling },
+		{ "optimizer", benchOptimizers },
+		{ "schedule", benchSchedule },
+		{ "telemetry", benchTelemetry },
+		{ "inference", benchInference },
+		{ "checkpoint", benchCheckpoint },
+		{ "streaming", benchStreaming },
+		{ "shuffle", benchShuffle },
+		{ "init", benchInit },
+		{ "quantized", benchQuantized },
+		{ "fused", benchFused },
+		{ "profile", benchProfile },
+	};
+	const size_t sectionCount = sizeof( sections ) / sizeof( sections[ 0 ] );
+
+	const char* strJsonPath = nullptr;
+	const char* strBaselinePath = nullptr;
+	std::vector< const char* > selected;
+	for( int arg = 1; arg < argc; ++arg )
+	{
+		if( strcmp( argv[ arg ], "--quick" ) == 0 )
+		{
+			s_bQuick = true;
+		}
+		else if( strcmp( argv[ arg ], "--json" ) == 0 && arg + 1 < argc )
+		{
+			strJsonPath = argv[ ++arg ];
+		}
+		else if( strcmp( argv[ arg ], "--baseline" ) == 0 && arg + 1 < argc )
+		{
+			strBaselinePath = argv[ ++arg ];
+		}
+		else
+		{
+			selected.push_back( argv[ arg ] );
+		}
+	}
+	for( size_t n = 0; n < selected.size(); ++n )
+	{
+		bool bKnown = false;
+		for( size_t s = 0; s < sectionCount; ++s )
+		{
+			bKnown = bKnown || strcmp( selected[ n ], sections[ s ].strName ) == 0;
+		}
+		if( !bKnown )
+		{
+			printf( "usage: bench [--quick] [--json <file>] [--baseline <file>] [section ...]\nsections:" );
+			for( size_t s = 0; s < sectionCount; ++s )
+			{
+				printf( " %s", sections[ s ].strName );
+			}
+			printf( "\n" );
+			return 1;
+		}
+	}
+
+	std::vector< BenchRecord > baseline;
+	if( strBaselinePath != nullptr && !readJson( strBaselinePath, baseline ) )
+	{
+		printf( "reading %s failed\n", strBaselinePath );
+		return 1;
+	}
+
+	printf( "kernels: %s\n", getKernels().strName );
+	for( size_t s = 0; s < sectionCount; ++s )
+	{
+		bool bRun = selected.empty();
+		for( size_t n = 0; n < selected.size(); ++n )
+		{
+			bRun = bRun || strcmp( selected[ n ], sections[ s ].strName ) == 0;
+		}
+		if( bRun )
+		{
+			sections[ s ].function();
+		}
+	}
+
+	if( strBaselinePath != nullptr )
+	{
+		compareWithBaseline( baseline );
+	}
+	if( strJsonPath != nullptr && !writeJson( strJsonPath ) )
+	{
+		printf( "writing %s failed\n", strJsonPath );
+		return 1;
+	}
+	return 0;
+}
@@ -0,0 +1,227 @@
+/*=============================================================================
+
+MIT License
+
+Copyright (c) 2018 Ville Ruusutie
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+
+=============================================================================*/
+
+#pragma once
+
+#include "mappedfile.h"
+#include "neuralnet.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <vector>
+//----------------------------------------------------------------------------
+
+// Checkpoint file layout, all little-endian:
+//   CheckpointHeader
+//   uint64_t layerSizes[ layerSizeCount ], input count, hidden widths, output count
+//   zero padding up to parameterOffset, a multiple of the alignment
+//   float parameters[ parameterCount ], the NeuralNet::getParameters slab as is
+// Since the parameters sit at an aligned offset and mappings start on a page, a mapped
+// file can back a NeuralNet directly.
+constexpr uint32_t s_checkpointMagic = 0x50434e4e; // "NNCP"
+constexpr uint32_t s_checkpointVersion = 1;
+
+struct CheckpointHeader
+{
+	uint32_t	magic;
+	uint32_t	version;
+	uint32_t	hiddenActivation;
+	uint32_t	outputActivation;
+	uint32_t	layerSizeCount;
+	// Byte alignment of the parameter regions, s_cacheLineSize of the writer
+	uint32_t	alignment;
+	uint64_t	parameterCount;
+	uint64_t	parameterOffset;
+	// Over the layer sizes and the parameters, see computeChecksum
+	uint64_t	checksum;
+};
+static_assert( sizeof( CheckpointHeader ) == 48, "checkpoint header must not contain padding" );
+//----------------------------------------------------------------------------
+
+// FNV-1a over 64-bit words, size must be a multiple of 8
+inline uint64_t computeChecksum( const void* pData, size_t size, uint64_t checksum = 0xcbf29ce484222325ull )
+{
+	const uint64_t* pWords = ( const uint64_t* )pData;
+	for( size_t i = 0; i < size / sizeof( uint64_t ); ++i )
+	{
+		checksum ^= pWords[ i ];
+		checksum *= 0x100000001b3ull;
+	}
+	return checksum;
+}
+//----------------------------------------------------------------------------
+
+template< typename HiddenActivation, typename OutputActivation >
+bool saveCheckpoint( const NeuralNet< HiddenActivation, OutputActivation >& net, const char* strPath )
+{
+	std::vector< uint64_t > layerSizes;
+	layerSizes.push_back( net.getInputCount() );
+	for( size_t l = 0; l < net.getHiddenLayerCount(); ++l )
+	{
+		layerSizes.push_back( net.getHiddenLayer( l ).getOutputCount() );
+	}
+	layerSizes.push_back( net.getOutputCount() );
+
+	CheckpointHeader header;
+	header.magic = s_checkpointMagic;
+	header.version = s_checkpointVersion;
+	header.hiddenActivation = HiddenActivation::s_id;
+	header.outputActivation = OutputActivation::s_id;
+	header.layerSizeCount = uint32_t( layerSizes.size() );
+	header.alignment = uint32_t( s_cacheLineSize );
+	header.parameterCount = net.getParameterCount();
+	const size_t prefixSize = sizeof( header ) + layerSizes.size() * sizeof( uint64_t );
+	header.parameterOffset = ( prefixSize + s_cacheLineSize - 1 ) / s_cacheLineSize * s_cacheLineSize;
+	header.checksum = computeChecksum( &layerSizes[ 0 ], layerSizes.size() * sizeof( uint64_t ) );
+	header.checksum = computeChecksum( net.getParameters(), net.getParameterCount() * sizeof( float ), header.checksum );
+
+	FILE* pFile = fopen( strPath, "wb" );
+	if( pFile == nullptr )
+	{
+		return false;
+	}
+	const char padding[ s_cacheLineSize ] = {};
+	bool bSuccess = fwrite( &header, sizeof( header ), 1, pFile ) == 1
+		&& fwrite( &layerSizes[ 0 ], sizeof( uint64_t ), layerSizes.size(), pFile ) == layerSizes.size()
+		&& fwrite( padding, 1, size_t( header.parameterOffset ) - prefixSize, pFile ) == size_t( header.parameterOffset ) - prefixSize
+		&& fwrite( net.getParameters(), sizeof( float ), net.getParameterCount(), pFile ) == net.getParameterCount();
+	bSuccess = ( fclose( pFile ) == 0 ) && bSuccess;
+	return bSuccess;
+}
+//----------------------------------------------------------------------------
+
+// Read-only memory mapping of a checkpoint. The pages are shared with every other
+// process mapping the same file, and a net built on top reads its weights straight
+// from them:
+//
+//	MappedCheckpoint checkpoint;
+//	if( checkpoint.open( "model.nncp" ) && checkpoint.matches< Elu, Elu >() )
+//	{
+//		NeuralNet< Elu > net( checkpoint.getLayerSizes(), checkpoint.getLayerSizeCount(), checkpoint.getParameters() );
+//		...
+//	}
+//
+// The net must not outlive the checkpoint.
+struct MappedCheckpoint
+{
+	MappedCheckpoint()
+	{
+	}
+	//------------------------------------------------------------------------
+
+	// Verifying the checksum reads every page of the file, skip it to only touch the
+	// pages inference ends up using
+	bool open( const char* strPath, bool bVerifyChecksum = true )
+	{
+		close();
+		if( !m_file.open( strPath ) )
+		{
+			return false;
+		}
+		if( !validate( bVerifyChecksum ) )
+		{
+			close();
+			return false;
+		}
+		return true;
+	}
+	//------------------------------------------------------------------------
+
+	void close()
+	{
+		m_file.close();
+		m_layerSizes.clear();
+	}
+	//------------------------------------------------------------------------
+
+	// True when the checkpoint was saved from a net with these activations
+	template< typename HiddenActivation, typename OutputActivation >
+	bool matches() const
+	{
+		return getHeader().hiddenActivation == HiddenActivation::s_id && getHeader().outputActivation == OutputActivation::s_id;
+	}
+	//------------------------------------------------------------------------
+
+	bool isOpen() const						{ return m_file.isOpen(); }
+	const CheckpointHeader& getHeader() const	{ return *( const CheckpointHeader* )m_file.getData(); }
+	const size_t* getLayerSizes() const		{ return &m_layerSizes[ 0 ]; }
+	size_t getLayerSizeCount() const		{ return m_layerSizes.size(); }
+	const float* getParameters() const		{ return ( const float* )( ( const char* )m_file.getData() + getHeader().parameterOffset ); }
+	//------------------------------------------------------------------------
+
+private:
+	MappedCheckpoint( const MappedCheckpoint& ) = delete;
+	MappedCheckpoint& operator=( const MappedCheckpoint& ) = delete;
+
+	// Everything is checked against the file size before it is dereferenced, so a
+	// truncated or foreign file fails cleanly
+	bool validate( bool bVerifyChecksum )
+	{
+		if( m_file.getSize() < sizeof( CheckpointHeader ) )
+		{
+			return false;
+		}
+		const CheckpointHeader& header = getHeader();
+		if( header.magic != s_checkpointMagic || header.version != s_checkpointVersion
+			|| header.alignment != s_cacheLineSize || header.layerSizeCount < 2
+			|| header.parameterOffset % s_cacheLineSize != 0
+			|| header.parameterOffset < sizeof( CheckpointHeader ) + uint64_t( header.layerSizeCount ) * sizeof( uint64_t )
+			|| header.parameterOffset > m_file.getSize()
+			|| header.parameterCount > ( m_file.getSize() - header.parameterOffset ) / sizeof( float ) )
+		{
+			return false;
+		}
+
+		const uint64_t* pLayerSizes = ( const uint64_t* )( &header + 1 );
+		for( size_t l = 0; l < header.layerSizeCount; ++l )
+		{
+			if( pLayerSizes[ l ] == 0 || pLayerSizes[ l ] > UINT32_MAX )
+			{
+				return false;
+			}
+			m_layerSizes.push_back( size_t( pLayerSizes[ l ] ) );
+		}
+		if( computeParameterCount( getLayerSizes(), getLayerSizeCount() ) != header.parameterCount )
+		{
+			return false;
+		}
+
+		if( bVerifyChecksum )
+		{
+			uint64_t checksum = computeChecksum( pLayerSizes, header.layerSizeCount * sizeof( uint64_t ) );
+			checksum = computeChecksum( getParameters(), size_t( header.parameterCount ) * sizeof( float ), checksum );
+			if( checksum != header.checksum )
+			{
+				return false;
+			}
+		}
+		return true;
+	}
+	//------------------------------------------------------------------------
+
+	MappedFile	m_file;
+	std::vector< size_t > m_layerSizes;
+};
@@ -0,0 +1,207 @@
+/*=============================================================================
+
+MIT License
+
+Copyright (c) 2018 Ville Ruusutie
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+
+=============================================================================*/
+
+// Converts a CSV file of samples into the memory-mappable sample format, see samplefile.h.
+// Every row holds the inputs followed by the expected outputs. Build with, for example
+//   g++ -std=c++11 -O2 -Isrc src/csvconvert.cpp -o csvconvert
+
+#include "samplefile.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <vector>
+//----------------------------------------------------------------------------
+
+static void printUsage()
+{
+	printf( "usage: csvconvert [--float16] [--skip-header] <input.csv> <output.nnsd> <input count>\n" );
+}
+//----------------------------------------------------------------------------
+
+// Reads one line of any length without the line break, false at end of file
+static bool readLine( FILE* pFile, std::string& line )
+{
+	line.clear();
+	char buffer[ 4096 ];
+	while( fgets( buffer, sizeof( buffer ), pFile ) != nullptr )
+	{
+		line += buffer;
+		if( !line.empty() && line[ line.size() - 1 ] == '\n' )
+		{
+			break;
+		}
+	}
+	while( !line.empty() && ( line[ line.size() - 1 ] == '\n' || line[ line.size() - 1 ] == '\r' ) )
+	{
+		line.erase( line.size() - 1 );
+	}
+	return !line.empty() || !feof( pFile );
+}
+//----------------------------------------------------------------------------
+
+static bool isBlank( const std::string& line )
+{
+	return line.find_first_not_of( " \t" ) == std::string::npos;
+}
+//----------------------------------------------------------------------------
+
+// Comma separated floats, surrounding blanks allowed
+static bool parseRow( const std::string& line, std::vector< float >& values )
+{
+	values.clear();
+	const char* pText = line.c_str();
+	for( ;; )
+	{
+		char* pEnd = nullptr;
+		const float fValue = strtof( pText, &pEnd );
+		if( pEnd == pText )
+		{
+			return false;
+		}
+		values.push_back( fValue );
+
+		while( *pEnd == ' ' || *pEnd == '\t' )
+		{
+			++pEnd;
+		}
+		if( *pEnd == '\0' )
+		{
+			return true;
+		}
+		if( *pEnd != ',' )
+		{
+			return false;
+		}
+		pText = pEnd + 1;
+	}
+}
+//----------------------------------------------------------------------------
+
+int main( int argc, const char** argv )
+{
+	SampleStorage storage = SampleStorage_Float32;
+	bool bSkipHeader = false;
+	int arg = 1;
+	for( ; arg < argc && strncmp( argv[ arg ], "--", 2 ) == 0; ++arg )
+	{
+		if( strcmp( argv[ arg ], "--float16" ) == 0 )
+		{
+			storage = SampleStorage_Float16;
+		}
+		else if( strcmp( argv[ arg ], "--skip-header" ) == 0 )
+		{
+			bSkipHeader = true;
+		}
+		else
+		{
+			printUsage();
+			return 1;
+		}
+	}
+	if( argc - arg != 3 || atoi( argv[ arg + 2 ] ) <= 0 )
+	{
+		printUsage();
+		return 1;
+	}
+	const char* strInputPath = argv[ arg ];
+	const char* strOutputPath = argv[ arg + 1 ];
+	const size_t inputCount = size_t( atoi( argv[ arg + 2 ] ) );
+
+	FILE* pFile = fopen( strInputPath, "rb" );
+	if( pFile == nullptr )
+	{
+		printf( "cannot open %s\n", strInputPath );
+		return 1;
+	}
+
+	// First pass validates every row and counts the samples, the writer needs the
+	// count before the first sample
+	std::string line;
+	std::vector< float > values;
+	size_t columnCount = 0;
+	size_t sampleCount = 0;
+	size_t lineNumber = 0;
+	if( bSkipHeader )
+	{
+		readLine( pFile, line );
+		++lineNumber;
+	}
+	while( readLine( pFile, line ) )
+	{
+		++lineNumber;
+		if( isBlank( line ) )
+		{
+			continue;
+		}
+		if( !parseRow( line, values ) || ( columnCount != 0 && values.size() != columnCount ) )
+		{
+			printf( "%s:%d: malformed row\n", strInputPath, ( int )lineNumber );
+			fclose( pFile );
+			return 1;
+		}
+		columnCount = values.size();
+		++sampleCount;
+	}
+	if( columnCount <= inputCount )
+	{
+		printf( "%s: rows need more than %d columns to hold outputs\n", strInputPath, ( int )inputCount );
+		fclose( pFile );
+		return 1;
+	}
+	const size_t outputCount = columnCount - inputCount;
+
+	SampleFileWriter writer;
+	if( !writer.open( strOutputPath, inputCount, outputCount, sampleCount, storage ) )
+	{
+		printf( "cannot write %s\n", strOutputPath );
+		fclose( pFile );
+		return 1;
+	}
+	rewind( pFile );
+	if( bSkipHeader )
+	{
+		readLine( pFile, line );
+	}
+	while( readLine( pFile, line ) )
+	{
+		if( !isBlank( line ) && ( !parseRow( line, values ) || !writer.write( &values[ 0 ], &values[ inputCount ] ) ) )
+		{
+			break;
+		}
+	}
+	fclose( pFile );
+	if( !writer.close() )
+	{
+		printf( "writing %s failed\n", strOutputPath );
+		return 1;
+	}
+
+	printf( "%s: %d samples, %d inputs, %d outputs, %s\n", strOutputPath, ( int )sampleCount, ( int )inputCount,
+		( int )outputCount, storage == SampleStorage_Float16 ? "float16" : "float32" );
+	return 0;
+}
@@ -0,0 +1,303 @@
+/*=============================================================================
+
+MIT License
+
+Copyright (c) 2018 Ville Ruusutie
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+
+=============================================================================*/
+
+#pragma once
+
+#include <algorithm>
+#include <condition_variable>
+#include <mutex>
+#include <stdint.h>
+#include <stdio.h>
+#include <thread>
+#include <vector>
+//----------------------------------------------------------------------------
+
+// Samples handed to the training loop, row-major like the arrays train() takes
+struct DataChunk
+{
+	const float*	pInputs;
+	const float*	pOutputs;
+	size_t			sampleCount;
+};
+//----------------------------------------------------------------------------
+
+// Streams a sample file that does not fit in memory. The file holds raw little-endian
+// floats, one row per sample with the inputs followed by the expected outputs.
+// A background thread reads the next chunk into the second of two buffers while the
+// trainer works on the first, so disk and compute overlap and memory use is bounded
+// by two chunks whatever the file size.
+struct StreamingDataset
+{
+	StreamingDataset()
+		: m_pFile( nullptr )
+		, m_inputCount( 0 )
+		, m_outputCount( 0 )
+		, m_chunkSampleCount( 0 )
+		, m_sampleCount( 0 )
+		, m_readSampleCount( 0 )
+		, m_fillIndex( 0 )
+		, m_consumeIndex( 0 )
+		, m_bHoldingChunk( false )
+		, m_bPassStarted( false )
+		, m_bReading( false )
+		, m_bFailed( false )
+		, m_bStopping( false )
+	{
+	}
+	//------------------------------------------------------------------------
+
+	~StreamingDataset()
+	{
+		close();
+	}
+	//------------------------------------------------------------------------
+
+	// Starts prefetching the first chunk right away
+	bool open( const char* strPath, size_t inputCount, size_t outputCount, size_t chunkSampleCount = 65536 )
+	{
+		close();
+		if( inputCount == 0 || outputCount == 0 || chunkSampleCount == 0 )
+		{
+			return false;
+		}
+		m_pFile = fopen( strPath, "rb" );
+		if( m_pFile == nullptr )
+		{
+			return false;
+		}
+
+		const uint64_t rowSize = ( inputCount + outputCount ) * sizeof( float );
+		const uint64_t fileSize = getFileSize( m_pFile );
+		if( fileSize % rowSize != 0 )
+		{
+			close();
+			return false;
+		}
+
+		m_inputCount = inputCount;
+		m_outputCount = outputCount;
+		m_chunkSampleCount = chunkSampleCount;
+		m_sampleCount = size_t( fileSize / rowSize );
+		m_rows.resize( chunkSampleCount * ( inputCount + outputCount ) );
+		for( size_t b = 0; b < 2; ++b )
+		{
+			m_buffers[ b ].inputs.resize( chunkSampleCount * inputCount );
+			m_buffers[ b ].outputs.resize( chunkSampleCount * outputCount );
+			m_buffers[ b ].sampleCount = 0;
+			m_buffers[ b ].bFull = false;
+		}
+		m_readSampleCount = 0;
+		m_fillIndex = 0;
+		m_consumeIndex = 0;
+		m_bHoldingChunk = false;
+		m_bPassStarted = false;
+		m_bFailed = false;
+		m_bStopping = false;
+		m_prefetchThread = std::thread( &StreamingDataset::prefetch, this );
+		return true;
+	}
+	//------------------------------------------------------------------------
+
+	void close()
+	{
+		if( m_prefetchThread.joinable() )
+		{
+			{
+				std::lock_guard< std::mutex > lock( m_mutex );
+				m_bStopping = true;
+			}
+			m_condition.notify_all();
+			m_prefetchThread.join();
+		}
+		if( m_pFile != nullptr )
+		{
+			fclose( m_pFile );
+			m_pFile = nullptr;
+		}
+	}
+	//------------------------------------------------------------------------
+
+	// Starts the next pass from the first sample. Free before the first call to next,
+	// the prefetched chunks are kept.
+	void rewind()
+	{
+		std::unique_lock< std::mutex > lock( m_mutex );
+		if( !m_bPassStarted )
+		{
+			return;
+		}
+		while( m_bReading )
+		{
+			m_condition.wait( lock );
+		}
+		fseek( m_pFile, 0, SEEK_SET );
+		m_buffers[ 0 ].bFull = false;
+		m_buffers[ 1 ].bFull = false;
+		m_readSampleCount = 0;
+		m_fillIndex = 0;
+		m_consumeIndex = 0;
+		m_bHoldingChunk = false;
+		m_bPassStarted = false;
+		m_bFailed = false;
+		m_condition.notify_all();
+	}
+	//------------------------------------------------------------------------
+
+	// Releases the chunk returned by the previous call and waits for the next one.
+	// Returns false at the end of the pass or when reading failed, see hasFailed.
+	bool next( DataChunk& chunk )
+	{
+		std::unique_lock< std::mutex > lock( m_mutex );
+		m_bPassStarted = true;
+		if( m_bHoldingChunk )
+		{
+			m_buffers[ m_consumeIndex ].bFull = false;
+			m_consumeIndex ^= 1;
+			m_bHoldingChunk = false;
+			m_condition.notify_all();
+		}
+
+		Buffer& buffer = m_buffers[ m_consumeIndex ];
+		while( !buffer.bFull && !m_bFailed && ( m_readSampleCount < m_sampleCount || m_bReading ) )
+		{
+			m_condition.wait( lock );
+		}
+		if( !buffer.bFull )
+		{
+			return false;
+		}
+
+		m_bHoldingChunk = true;
+		chunk.pInputs = &buffer.inputs[ 0 ];
+		chunk.pOutputs = &buffer.outputs[ 0 ];
+		chunk.sampleCount = buffer.sampleCount;
+		return true;
+	}
+	//------------------------------------------------------------------------
+
+	bool hasFailed() const
+	{
+		std::lock_guard< std::mutex > lock( m_mutex );
+		return m_bFailed;
+	}
+	//------------------------------------------------------------------------
+
+	size_t getInputCount() const		{ return m_inputCount; }
+	size_t getOutputCount() const		{ return m_outputCount; }
+	size_t getSampleCount() const		{ return m_sampleCount; }
+	//------------------------------------------------------------------------
+
+private:
+	StreamingDataset( const StreamingDataset& ) = delete;
+	StreamingDataset& operator=( const StreamingDataset& ) = delete;
+
+	struct Buffer
+	{
+		std::vector< float >	inputs;
+		std::vector< float >	outputs;
+		size_t					sampleCount;
+		bool					bFull;
+	};
+	//------------------------------------------------------------------------
+
+	static uint64_t getFileSize( FILE* pFile )
+	{
+#if defined(WIN32) || defined(__WIN32) || defined(__WIN32__) || defined(WIN64)
+		_fseeki64( pFile, 0, SEEK_END );
+		const uint64_t size = uint64_t( _ftelli64( pFile ) );
+#else
+		fseeko( pFile, 0, SEEK_END );
+		const uint64_t size = uint64_t( ftello( pFile ) );
+#endif
+		fseek( pFile, 0, SEEK_SET );
+		return size;
+	}
+	//------------------------------------------------------------------------
+
+	// Runs on the prefetch thread. The file and the buffer being filled are only
+	// touched with m_bReading set, everything else under the mutex.
+	void prefetch()
+	{
+		const size_t rowCount = m_inputCount + m_outputCount;
+		std::unique_lock< std::mutex > lock( m_mutex );
+		for( ;; )
+		{
+			while( !m_bStopping && ( m_buffers[ m_fillIndex ].bFull || m_readSampleCount == m_sampleCount || m_bFailed ) )
+			{
+				m_condition.wait( lock );
+			}
+			if( m_bStopping )
+			{
+				return;
+			}
+
+			Buffer& buffer = m_buffers[ m_fillIndex ];
+			const size_t remainingCount = m_sampleCount - m_readSampleCount;
+			const size_t sampleCount = remainingCount < m_chunkSampleCount ? remainingCount : m_chunkSampleCount;
+			m_bReading = true;
+			lock.unlock();
+
+			const bool bRead = fread( &m_rows[ 0 ], rowCount * sizeof( float ), sampleCount, m_pFile ) == sampleCount;
+			for( size_t s = 0; bRead && s < sampleCount; ++s )
+			{
+				const float* pRow = &m_rows[ s * rowCount ];
+				std::copy( pRow, pRow + m_inputCount, &buffer.inputs[ s * m_inputCount ] );
+				std::copy( pRow + m_inputCount, pRow + rowCount, &buffer.outputs[ s * m_outputCount ] );
+			}
+
+			lock.lock();
+			m_bReading = false;
+			m_bFailed = !bRead;
+			buffer.sampleCount = sampleCount;
+			buffer.bFull = bRead;
+			m_readSampleCount += sampleCount;
+			m_fillIndex ^= 1;
+			m_condition.notify_all();
+		}
+	}
+	//------------------------------------------------------------------------
+
+	FILE*	m_pFile;
+	size_t	m_inputCount;
+	size_t	m_outputCount;
+	size_t	m_chunkSampleCount;
+	size_t	m_sampleCount;
+	// Rows as stored in the file, split into a buffer after each read
+	std::vector< float > m_rows;
+	Buffer	m_buffers[ 2 ];
+
+	std::thread				m_prefetchThread;
+	mutable std::mutex		m_mutex;
+	std::condition_variable	m_condition;
+	size_t	m_readSampleCount;
+	size_t	m_fillIndex;
+	size_t	m_consumeIndex;
+	bool	m_bHoldingChunk;
+	bool	m_bPassStarted;
+	bool	m_bReading;
+	bool	m_bFailed;
+	bool	m_bStopping;
+};
@@ -0,0 +1,372 @@
+/*=============================================================================
+
+MIT License
+
+Copyright (c) 2018 Ville Ruusutie
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+
+=============================================================================*/
+
+#pragma once
+
+#include "neuralnet.h"
+#include "threading.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <future>
+#include <mutex>
+#include <stdint.h>
+#include <thread>
+#include <vector>
+//----------------------------------------------------------------------------
+
+struct InferenceParams
+{
+	InferenceParams()
+		: workerCount( 1 )
+		, maxBatchSize( 32 )
+		, maxLatencyMicroseconds( 200 )
+		, queueCapacity( 4096 )
+	{
+	}
+
+	size_t	workerCount;
+	// Upper bound of requests evaluated together
+	size_t	maxBatchSize;
+	// How long a worker may hold the oldest request back waiting for a fuller batch
+	size_t	maxLatencyMicroseconds;
+	size_t	queueCapacity;
+};
+//----------------------------------------------------------------------------
+
+// Counters since the server started or resetStats was last called. Latencies run from
+// submit to the future becoming ready and are accurate to about 3%.
+struct InferenceStats
+{
+	uint64_t	requestCount;
+	uint64_t	batchCount;
+	double		fSeconds;
+	double		fRequestsPerSecond;
+	double		fMeanBatchSize;
+	double		fP50Microseconds;
+	double		fP99Microseconds;
+};
+//----------------------------------------------------------------------------
+
+// Log-linear histogram of nanosecond durations: 16 buckets for every power of two, so
+// a bucket is at most 1/16 of its value wide. Safe to record from many threads.
+struct LatencyHistogram
+{
+	LatencyHistogram()
+	{
+		reset();
+	}
+	//------------------------------------------------------------------------
+
+	void record( uint64_t nanoseconds )
+	{
+		m_counts[ getBucket( nanoseconds ) ].fetch_add( 1, std::memory_order_relaxed );
+	}
+	//------------------------------------------------------------------------
+
+	void reset()
+	{
+		for( size_t b = 0; b < s_bucketCount; ++b )
+		{
+			m_counts[ b ].store( 0, std::memory_order_relaxed );
+		}
+	}
+	//------------------------------------------------------------------------
+
+	// Midpoint of the bucket holding the given fraction of all recorded values
+	double getPercentile( double fFraction ) const
+	{
+		uint64_t totalCount = 0;
+		for( size_t b = 0; b < s_bucketCount; ++b )
+		{
+			totalCount += m_counts[ b ].load( std::memory_order_relaxed );
+		}
+		if( totalCount == 0 )
+		{
+			return 0.0;
+		}
+
+		const uint64_t rank = uint64_t( fFraction * double( totalCount - 1 ) ) + 1;
+		uint64_t count = 0;
+		for( size_t b = 0; b < s_bucketCount; ++b )
+		{
+			count += m_counts[ b ].load( std::memory_order_relaxed );
+			if( count >= rank )
+			{
+				return 0.5 * double( getBucketStart( b ) + getBucketStart( b + 1 ) );
+			}
+		}
+		return double( getBucketStart( s_bucketCount ) );
+	}
+	//------------------------------------------------------------------------
+
+private:
+	static const size_t s_subBucketBits = 4;
+	static const size_t s_subBucketCount = size_t( 1 ) << s_subBucketBits;
+	static const size_t s_bucketCount = ( 64 - s_subBucketBits + 1 ) * s_subBucketCount;
+
+	// Values below s_subBucketCount map to themselves, above that the top
+	// s_subBucketBits + 1 bits select the bucket
+	static size_t getBucket( uint64_t value )
+	{
+		if( value < s_subBucketCount )
+		{
+			return size_t( value );
+		}
+		size_t exponent = s_subBucketBits;
+		while( ( value >> ( exponent + 1 ) ) != 0 )
+		{
+			++exponent;
+		}
+		const size_t subBucket = size_t( value >> ( exponent - s_subBucketBits ) ) & ( s_subBucketCount - 1 );
+		return ( exponent - s_subBucketBits + 1 ) * s_subBucketCount + subBucket;
+	}
+
+	static uint64_t getBucketStart( size_t bucket )
+	{
+		if( bucket < s_subBucketCount )
+		{
+			return bucket;
+		}
+		const size_t exponent = bucket / s_subBucketCount + s_subBucketBits - 1;
+		const uint64_t subBucket = bucket & ( s_subBucketCount - 1 );
+		return ( s_subBucketCount + subBucket ) << ( exponent - s_subBucketBits );
+	}
+
+	std::atomic< uint64_t > m_counts[ s_bucketCount ];
+};
+//----------------------------------------------------------------------------
+
+// Serves evaluate() to many producer threads. Requests go through a lock-free queue to a
+// pool of workers; a worker takes the oldest request, keeps collecting until it has
+// maxBatchSize of them or that request has waited maxLatencyMicroseconds, and runs
+// them as one batched forward pass. The net must not be trained while it is served.
+template< typename Net >
+struct InferenceServer
+{
+	InferenceServer( const Net& net, const InferenceParams& params = InferenceParams() )
+		: m_net( net )
+		, m_params( params )
+		, m_queue( params.queueCapacity )
+		, m_pendingCount( 0 )
+		, m_sleepingCount( 0 )
+		, m_bStopping( false )
+	{
+		assert( params.workerCount > 0 && params.maxBatchSize > 0 );
+		resetStats();
+		for( size_t w = 0; w < params.workerCount; ++w )
+		{
+			m_workers.push_back( std::thread( &InferenceServer::work, this ) );
+		}
+	}
+	//------------------------------------------------------------------------
+
+	// Finishes every request already submitted before returning
+	~InferenceServer()
+	{
+		{
+			std::lock_guard< std::mutex > lock( m_mutex );
+			m_bStopping.store( true );
+		}
+		m_condition.notify_all();
+		for( size_t w = 0; w < m_workers.size(); ++w )
+		{
+			m_workers[ w ].join();
+		}
+	}
+	//------------------------------------------------------------------------
+
+	// Queues one sample. pInputs and pOutputs must stay valid until the future is ready.
+	// Blocks only while the queue is full.
+	std::future< void > submit( const float* pInputs, float* pOutputs )
+	{
+		Request request;
+		request.pInputs = pInputs;
+		request.pOutputs = pOutputs;
+		request.submitTime = Clock::now();
+		std::future< void > future = request.promise.get_future();
+
+		// Counted before the push so a worker going to sleep cannot miss it
+		m_pendingCount.fetch_add( 1 );
+		while( !m_queue.tryPush( request ) )
+		{
+			std::this_thread::yield();
+		}
+		if( m_sleepingCount.load() > 0 )
+		{
+			std::lock_guard< std::mutex > lock( m_mutex );
+			m_condition.notify_one();
+		}
+		return future;
+	}
+	//------------------------------------------------------------------------
+
+	InferenceStats getStats() const
+	{
+		InferenceStats stats;
+		stats.requestCount = m_requestCount.load( std::memory_order_relaxed );
+		stats.batchCount = m_batchCount.load( std::memory_order_relaxed );
+		stats.fSeconds = std::chrono::duration< double >( Clock::now() - m_statsStartTime ).count();
+		stats.fRequestsPerSecond = stats.fSeconds > 0.0 ? double( stats.requestCount ) / stats.fSeconds : 0.0;
+		stats.fMeanBatchSize = stats.batchCount > 0 ? double( stats.requestCount ) / double( stats.batchCount ) : 0.0;
+		stats.fP50Microseconds = m_latencies.getPercentile( 0.50 ) * 1e-3;
+		stats.fP99Microseconds = m_latencies.getPercentile( 0.99 ) * 1e-3;
+		return stats;
+	}
+	//------------------------------------------------------------------------
+
+	// Not synchronised with getStats, call it while the server is idle
+	void resetStats()
+	{
+		m_requestCount.store( 0, std::memory_order_relaxed );
+		m_batchCount.store( 0, std::memory_order_relaxed );
+		m_latencies.reset();
+		m_statsStartTime = Clock::now();
+	}
+	//------------------------------------------------------------------------
+
+private:
+	InferenceServer( const InferenceServer& ) = delete;
+	InferenceServer& operator=( const InferenceServer& ) = delete;
+
+	typedef std::chrono::steady_clock Clock;
+
+	struct Request
+	{
+		const float*		pInputs;
+		float*				pOutputs;
+		Clock::time_point	submitTime;
+		std::promise< void > promise;
+	};
+	//------------------------------------------------------------------------
+
+	bool tryPop( Request& request )
+	{
+		if( !m_queue.tryPop( request ) )
+		{
+			return false;
+		}
+		m_pendingCount.fetch_sub( 1 );
+		return true;
+	}
+	//------------------------------------------------------------------------
+
+	void waitForWork()
+	{
+		std::unique_lock< std::mutex > lock( m_mutex );
+		m_sleepingCount.fetch_add( 1 );
+		if( m_pendingCount.load() == 0 && !m_bStopping.load() )
+		{
+			// The timeout is only a safety net, submit wakes a sleeping worker
+			m_condition.wait_for( lock, std::chrono::milliseconds( 10 ) );
+		}
+		m_sleepingCount.fetch_sub( 1 );
+	}
+	//------------------------------------------------------------------------
+
+	void work()
+	{
+		const size_t inputCount = m_net.getInputCount();
+		const size_t outputCount = m_net.getOutputCount();
+		const size_t maxBatchSize = m_params.maxBatchSize;
+		const Clock::duration maxLatency = std::chrono::microseconds( m_params.maxLatencyMicroseconds );
+
+		Workspace workspace( m_net, maxBatchSize );
+		std::vector< float > inputs( maxBatchSize * inputCount );
+		std::vector< float > outputs( maxBatchSize * outputCount );
+		std::vector< Request > batch( maxBatchSize );
+
+		for( ;; )
+		{
+			if( !tryPop( batch[ 0 ] ) )
+			{
+				if( m_bStopping.load() && m_pendingCount.load() == 0 )
+				{
+					return;
+				}
+				waitForWork();
+				continue;
+			}
+
+			size_t batchCount = 1;
+			const Clock::time_point deadline = batch[ 0 ].submitTime + maxLatency;
+			while( batchCount < maxBatchSize )
+			{
+				if( tryPop( batch[ batchCount ] ) )
+				{
+					++batchCount;
+				}
+				else if( m_bStopping.load() || Clock::now() >= deadline )
+				{
+					break;
+				}
+				else
+				{
+					std::this_thread::yield();
+				}
+			}
+
+			for( size_t b = 0; b < batchCount; ++b )
+			{
+				const float* pInputs = batch[ b ].pInputs;
+				std::copy( pInputs, pInputs + inputCount, &inputs[ b * inputCount ] );
+			}
+			m_net.evaluate( &inputs[ 0 ], &outputs[ 0 ], workspace, batchCount );
+
+			const Clock::time_point completeTime = Clock::now();
+			for( size_t b = 0; b < batchCount; ++b )
+			{
+				std::copy( &outputs[ b * outputCount ], &outputs[ ( b + 1 ) * outputCount ], batch[ b ].pOutputs );
+				m_latencies.record( uint64_t( std::chrono::duration_cast< std::chrono::nanoseconds >( completeTime - batch[ b ].submitTime ).count() ) );
+				batch[ b ].promise.set_value();
+			}
+			m_requestCount.fetch_add( batchCount, std::memory_order_relaxed );
+			m_batchCount.fetch_add( 1, std::memory_order_relaxed );
+		}
+	}
+	//------------------------------------------------------------------------
+
+	const Net&					m_net;
+	const InferenceParams		m_params;
+	MpmcQueue< Request >		m_queue;
+	std::vector< std::thread >	m_workers;
+
+	// Requests submitted but not yet popped, and workers blocked in waitForWork. Both
+	// sequentially consistent so that either submit sees the sleeper or the sleeper
+	// sees the request.
+	std::atomic< size_t >		m_pendingCount;
+	std::atomic< size_t >		m_sleepingCount;
+	std::atomic< bool >			m_bStopping;
+	std::mutex					m_mutex;
+	std::condition_variable		m_condition;
+
+	std::atomic< uint64_t >		m_requestCount;
+	std::atomic< uint64_t >		m_batchCount;
+	LatencyHistogram			m_latencies;
+	Clock::time_point			m_statsStartTime;
+};
@@ -0,0 +1,367 @@
+/*=============================================================================
+
+MIT License
+
+Copyright (c) 2018 Ville Ruusutie
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+
+=============================================================================*/
+
+// Per layer counters for the training kernels. Define NEURALNET_INSTRUMENT to time every
+// Layer pass in cycles and, on Linux where perf_event_open is permitted, to count the
+// instructions and cache misses it retires in user space. Only the layers of a net
+// inside NeuralNet::train are counted, and train prints their totals per layer and
+// sample when it returns; evaluate, including the validation error, and temporary
+// layers are left out. Without the define the NN_INSTRUMENT macros expand to nothing
+// and none of this is compiled.
+//
+// Counters are read with a system call on entry and exit of every pass, which costs
+// about a microsecond each way. The cycles exclude it, but small batches still run
+// slower and with colder caches than in an uninstrumented build.
+
+#pragma once
+
+#if defined( NEURALNET_INSTRUMENT )
+
+#include <chrono>
+#include <map>
+#include <mutex>
+#include <stdint.h>
+#include <string.h>
+
+#if defined( __x86_64__ ) || defined( __i386__ ) || defined( _M_X64 ) || defined( _M_IX86 )
+	#define NN_INSTRUMENT_TSC 1
+	#if defined( _MSC_VER )
+		#include <intrin.h>
+	#else
+		#include <x86intrin.h>
+	#endif
+#else
+	#define NN_INSTRUMENT_TSC 0
+#endif
+
+#if defined( __linux__ )
+	#include <linux/perf_event.h>
+	#include <sys/syscall.h>
+	#include <unistd.h>
+#endif
+//----------------------------------------------------------------------------
+
+// The Layer functions that are counted
+enum LayerPass
+{
+	LayerPass_Propagate,
+	LayerPass_ComputeOutputDeltas,
+	LayerPass_ComputeDeltas,
+	LayerPass_UpdateWeights,
+	LayerPass_TrainFused,
+	LayerPass_Count
+};
+
+inline const char* getLayerPassName( LayerPass pass )
+{
+	const char* strNames[] = { "propagate", "computeOutputDeltas", "computeDeltas", "updateWeights", "trainFused" };
+	return strNames[ pass ];
+}
+//----------------------------------------------------------------------------
+
+// Time stamp counter cycles on x86, nanoseconds elsewhere
+inline uint64_t readCycles()
+{
+#if NN_INSTRUMENT_TSC
+	return __rdtsc();
+#else
+	return uint64_t( std::chrono::duration_cast< std::chrono::nanoseconds >( std::chrono::steady_clock::now().time_since_epoch() ).count() );
+#endif
+}
+//----------------------------------------------------------------------------
+
+// Instructions and cache misses of the calling thread, one perf event group per thread
+// opened on first use. Not available outside Linux, or when perf_event_paranoid or a
+// container forbids it.
+struct HardwareCounters
+{
+	enum Counter
+	{
+		Counter_Instructions,
+		Counter_CacheMisses,
+		Counter_Count
+	};
+
+	HardwareCounters()
+		: m_groupFd( -1 )
+		, m_cacheMissFd( -1 )
+	{
+#if defined( __linux__ )
+		m_groupFd = open( PERF_COUNT_HW_INSTRUCTIONS, -1 );
+		if( m_groupFd >= 0 )
+		{
+			m_cacheMissFd = open( PERF_COUNT_HW_CACHE_MISSES, m_groupFd );
+			if( m_cacheMissFd < 0 )
+			{
+				close( m_groupFd );
+				m_groupFd = -1;
+			}
+		}
+#endif
+	}
+
+	~HardwareCounters()
+	{
+#if defined( __linux__ )
+		if( m_groupFd >= 0 )
+		{
+			close( m_cacheMissFd );
+			close( m_groupFd );
+		}
+#endif
+	}
+	//------------------------------------------------------------------------
+
+	static HardwareCounters& getThreadCounters()
+	{
+		static thread_local HardwareCounters counters;
+		return counters;
+	}
+	//------------------------------------------------------------------------
+
+	bool isAvailable() const	{ return m_groupFd >= 0; }
+
+	// Returns false and leaves values alone when the counters are not available
+	bool read( uint64_t values[ Counter_Count ] ) const
+	{
+#if defined( __linux__ )
+		if( m_groupFd >= 0 )
+		{
+			// PERF_FORMAT_GROUP: the number of events, then each value in opening order
+			uint64_t buffer[ 1 + Counter_Count ];
+			if( ::read( m_groupFd, buffer, sizeof( buffer ) ) == ssize_t( sizeof( buffer ) ) )
+			{
+				memcpy( values, &buffer[ 1 ], sizeof( uint64_t ) * Counter_Count );
+				return true;
+			}
+		}
+#else
+		( void )values;
+#endif
+		return false;
+	}
+	//------------------------------------------------------------------------
+
+private:
+	HardwareCounters( const HardwareCounters& ) = delete;
+	HardwareCounters& operator=( const HardwareCounters& ) = delete;
+
+#if defined( __linux__ )
+	static int open( uint64_t config, int groupFd )
+	{
+		perf_event_attr attr;
+		memset( &attr, 0, sizeof( attr ) );
+		attr.size = sizeof( attr );
+		attr.type = PERF_TYPE_HARDWARE;
+		attr.config = config;
+		attr.read_format = PERF_FORMAT_GROUP;
+		attr.exclude_kernel = 1;
+		attr.exclude_hv = 1;
+		return int( syscall( __NR_perf_event_open, &attr, 0, -1, groupFd, 0 ) );
+	}
+#endif
+
+	int		m_groupFd;
+	int		m_cacheMissFd;
+};
+//----------------------------------------------------------------------------
+
+// What one pass of one layer added up to
+struct PassTotals
+{
+	PassTotals()
+		: callCount( 0 )
+		, sampleCount( 0 )
+		, cycles( 0 )
+		, countedSampleCount( 0 )
+	{
+		memset( counters, 0, sizeof( counters ) );
+	}
+
+	uint64_t callCount;
+	uint64_t sampleCount;
+	uint64_t cycles;
+	// Samples of the calls that got hardware counts
+	uint64_t countedSampleCount;
+	uint64_t counters[ HardwareCounters::Counter_Count ];
+};
+
+struct LayerTotals
+{
+	PassTotals passes[ LayerPass_Count ];
+};
+//----------------------------------------------------------------------------
+
+// Totals of the layers being counted, keyed by the address of the Layer object. A layer
+// is counted from arm until take, passes of any other layer are ignored. Shared by all
+// threads; the lock is taken before and after a pass, never during it.
+struct InstrumentRegistry
+{
+	static InstrumentRegistry& get()
+	{
+		static InstrumentRegistry registry;
+		return registry;
+	}
+	//------------------------------------------------------------------------
+
+	// Starts counting a layer from zero
+	void arm( const void* pLayer )
+	{
+		std::lock_guard< std::mutex > lock( m_mutex );
+		m_layers[ pLayer ] = LayerTotals();
+	}
+
+	bool isArmed( const void* pLayer ) const
+	{
+		std::lock_guard< std::mutex > lock( m_mutex );
+		return m_layers.find( pLayer ) != m_layers.end();
+	}
+	//------------------------------------------------------------------------
+
+	void add( const void* pLayer, LayerPass pass, size_t sampleCount, uint64_t cycles, const uint64_t* pCounters )
+	{
+		std::lock_guard< std::mutex > lock( m_mutex );
+		std::map< const void*, LayerTotals >::iterator it = m_layers.find( pLayer );
+		if( it == m_layers.end() )
+		{
+			return;
+		}
+		PassTotals& totals = it->second.passes[ pass ];
+		++totals.callCount;
+		totals.sampleCount += sampleCount;
+		totals.cycles += cycles;
+		if( pCounters != nullptr )
+		{
+			totals.countedSampleCount += sampleCount;
+			for( int c = 0; c < HardwareCounters::Counter_Count; ++c )
+			{
+				totals.counters[ c ] += pCounters[ c ];
+			}
+		}
+	}
+	//------------------------------------------------------------------------
+
+	// Moves the totals of a layer out and stops counting it, returns false when it was
+	// not armed
+	bool take( const void* pLayer, LayerTotals& totals )
+	{
+		std::lock_guard< std::mutex > lock( m_mutex );
+		std::map< const void*, LayerTotals >::iterator it = m_layers.find( pLayer );
+		if( it == m_layers.end() )
+		{
+			return false;
+		}
+		totals = it->second;
+		m_layers.erase( it );
+		return true;
+	}
+	//------------------------------------------------------------------------
+
+private:
+	mutable std::mutex m_mutex;
+	std::map< const void*, LayerTotals > m_layers;
+};
+//----------------------------------------------------------------------------
+
+// Passes run on this thread inside the scope are not counted, for example evaluate
+// called by train for the validation error
+struct ScopedInstrumentPause
+{
+	ScopedInstrumentPause()		{ ++getDepth(); }
+	~ScopedInstrumentPause()	{ --getDepth(); }
+
+	static bool isPaused()		{ return getDepth() > 0; }
+
+private:
+	ScopedInstrumentPause( const ScopedInstrumentPause& ) = delete;
+	ScopedInstrumentPause& operator=( const ScopedInstrumentPause& ) = delete;
+
+	static int& getDepth()
+	{
+		static thread_local int depth = 0;
+		return depth;
+	}
+};
+//----------------------------------------------------------------------------
+
+// Measures from construction to destruction when the layer is armed. Hardware counters
+// are read outside the cycle count so the system calls do not show up in it.
+struct ScopedPassTimer
+{
+	ScopedPassTimer( const void* pLayer, LayerPass pass, size_t sampleCount )
+		: m_pLayer( pLayer )
+		, m_pass( pass )
+		, m_sampleCount( sampleCount )
+		, m_bActive( !ScopedInstrumentPause::isPaused() && InstrumentRegistry::get().isArmed( pLayer ) )
+		, m_bCounted( m_bActive && HardwareCounters::getThreadCounters().read( m_counters ) )
+		, m_startCycles( m_bActive ? readCycles() : 0 )
+	{
+	}
+
+	~ScopedPassTimer()
+	{
+		if( !m_bActive )
+		{
+			return;
+		}
+		const uint64_t cycles = readCycles() - m_startCycles;
+		uint64_t counters[ HardwareCounters::Counter_Count ];
+		const bool bCounted = m_bCounted && HardwareCounters::getThreadCounters().read( counters );
+		if( bCounted )
+		{
+			for( int c = 0; c < HardwareCounters::Counter_Count; ++c )
+			{
+				counters[ c ] -= m_counters[ c ];
+			}
+		}
+		InstrumentRegistry::get().add( m_pLayer, m_pass, m_sampleCount, cycles, bCounted ? counters : nullptr );
+	}
+
+private:
+	ScopedPassTimer( const ScopedPassTimer& ) = delete;
+	ScopedPassTimer& operator=( const ScopedPassTimer& ) = delete;
+
+	const void*	m_pLayer;
+	LayerPass	m_pass;
+	size_t		m_sampleCount;
+	uint64_t	m_counters[ HardwareCounters::Counter_Count ];
+	bool		m_bActive;
+	bool		m_bCounted;
+	uint64_t	m_startCycles;
+};
+//----------------------------------------------------------------------------
+
+// Counts the rest of the enclosing scope of a Layer member function towards pass
+#define NN_INSTRUMENT_PASS( pass, sampleCount ) const ScopedPassTimer instrumentTimer( this, pass, sampleCount )
+// Leaves the rest of the enclosing scope uncounted on this thread
+#define NN_INSTRUMENT_PAUSE() const ScopedInstrumentPause instrumentPause
+
+#else
+
+#define NN_INSTRUMENT_PASS( pass, sampleCount )
+#define NN_INSTRUMENT_PAUSE()
+
+#endif
@@ -0,0 +1,137 @@
+/*=============================================================================
+
+MIT License
+
+Copyright (c) 2018 Ville Ruusutie
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+
+=============================================================================*/
+
+#pragma once
+
+#include <stddef.h>
+#if defined(WIN32) || defined(__WIN32) || defined(__WIN32__) || defined(WIN64)
+    #define WIN32_LEAN_AND_MEAN
+    #define NOMINMAX
+    #include <windows.h>
+#else
+    #include <fcntl.h>
+    #include <sys/mman.h>
+    #include <sys/stat.h>
+    #include <unistd.h>
+#endif
+//----------------------------------------------------------------------------
+
+// Read-only, shared memory mapping of a whole file. Pages come from the page cache,
+// so every process mapping the same file shares one physical copy.
+struct MappedFile
+{
+	MappedFile()
+		: m_pData( nullptr )
+		, m_size( 0 )
+	{
+	}
+	//------------------------------------------------------------------------
+
+	~MappedFile()
+	{
+		close();
+	}
+	//------------------------------------------------------------------------
+
+	// Fails for missing and empty files
+	bool open( const char* strPath )
+	{
+		close();
+#if defined(WIN32) || defined(__WIN32) || defined(__WIN32__) || defined(WIN64)
+		HANDLE file = CreateFileA( strPath, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr );
+		if( file == INVALID_HANDLE_VALUE )
+		{
+			return false;
+		}
+		LARGE_INTEGER fileSize;
+		HANDLE mapping = nullptr;
+		if( GetFileSizeEx( file, &fileSize ) && fileSize.QuadPart > 0 )
+		{
+			mapping = CreateFileMappingA( file, nullptr, PAGE_READONLY, 0, 0, nullptr );
+		}
+		CloseHandle( file );
+		if( mapping == nullptr )
+		{
+			return false;
+		}
+		// The view keeps the mapping object alive
+		m_pData = MapViewOfFile( mapping, FILE_MAP_READ, 0, 0, 0 );
+		CloseHandle( mapping );
+		m_size = m_pData != nullptr ? size_t( fileSize.QuadPart ) : 0;
+		return m_pData != nullptr;
+#else
+		const int file = ::open( strPath, O_RDONLY );
+		if( file < 0 )
+		{
+			return false;
+		}
+		struct stat fileStat;
+		void* pData = MAP_FAILED;
+		if( fstat( file, &fileStat ) == 0 && fileStat.st_size > 0 )
+		{
+			pData = mmap( nullptr, size_t( fileStat.st_size ), PROT_READ, MAP_SHARED, file, 0 );
+		}
+		// The mapping stays valid after the descriptor is closed
+		::close( file );
+		if( pData == MAP_FAILED )
+		{
+			return false;
+		}
+		m_pData = pData;
+		m_size = size_t( fileStat.st_size );
+		return true;
+#endif
+	}
+	//------------------------------------------------------------------------
+
+	void close()
+	{
+		if( m_pData != nullptr )
+		{
+#if defined(WIN32) || defined(__WIN32) || defined(__WIN32__) || defined(WIN64)
+			UnmapViewOfFile( m_pData );
+#else
+			munmap( m_pData, m_size );
+#endif
+		}
+		m_pData = nullptr;
+		m_size = 0;
+	}
+	//------------------------------------------------------------------------
+
+	bool isOpen() const				{ return m_pData != nullptr; }
+	// Starts on a page boundary
+	const void* getData() const		{ return m_pData; }
+	size_t getSize() const			{ return m_size; }
+	//------------------------------------------------------------------------
+
+private:
+	MappedFile( const MappedFile& ) = delete;
+	MappedFile& operator=( const MappedFile& ) = delete;
+
+	void*	m_pData;
+	size_t	m_size;
+};
@@ -0,0 +1,1943 @@
+/*=============================================================================
+
+MIT License
+
+Copyright (c) 2018 Ville Ruusutie
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+
+=============================================================================*/
+
+#pragma once
+
+#include "dataset.h"
+#include "instrument.h"
+#include "random.h"
+#include "simd.h"
+#include "telemetry.h"
+#include "threading.h"
+#include "transfer.h"
+
+#include <algorithm>
+#include <assert.h>
+#include <chrono>
+#include <initializer_list>
+#include <limits>
+#include <math.h>
+#include <memory>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+#if defined(WIN32) || defined(__WIN32) || defined(__WIN32__) || defined(WIN64)
+    #include <malloc.h>
+#endif
+//----------------------------------------------------------------------------
+
+constexpr size_t s_cacheLineSize = 64;
+
+inline void* alignedAlloc( size_t size, size_t alignment = s_cacheLineSize )
+{
+#if defined(WIN32) || defined(__WIN32) || defined(__WIN32__) || defined(WIN64)
+	return _aligned_malloc( size, alignment );
+#else
+	void* pMemory = nullptr;
+	return posix_memalign( &pMemory, alignment, size ) == 0 ? pMemory : nullptr;
+#endif
+}
+//----------------------------------------------------------------------------
+
+inline void alignedFree( void* pMemory )
+{
+#if defined(WIN32) || defined(__WIN32) || defined(__WIN32__) || defined(WIN64)
+	_aligned_free( pMemory );
+#else
+	free( pMemory );
+#endif
+}
+//----------------------------------------------------------------------------
+
+// Rounds a float count up to a whole number of cache lines
+inline size_t alignedCount( size_t count )
+{
+	const size_t lineCount = s_cacheLineSize / sizeof( float );
+	return ( count + lineCount - 1 ) / lineCount * lineCount;
+}
+//----------------------------------------------------------------------------
+
+// Float count of the parameter slab NeuralNet allocates for a topology, see
+// NeuralNet::getParameters. Every weight matrix and bias vector starts on a cache line.
+inline size_t computeParameterCount( const size_t* pLayerSizes, size_t sizeCount )
+{
+	size_t parameterCount = 0;
+	for( size_t l = 0; l + 1 < sizeCount; ++l )
+	{
+		parameterCount += alignedCount( pLayerSizes[ l ] * pLayerSizes[ l + 1 ] ) + alignedCount( pLayerSizes[ l + 1 ] );
+	}
+	return parameterCount;
+}
+//----------------------------------------------------------------------------
+
+// Rows first to first + count of an epoch visiting samples in pOrder. Points straight
+// into pRows when pOrder is null, otherwise the rows are copied to pScratch.
+inline const float* gatherRows( const float* pRows, size_t rowSize, const size_t* pOrder, size_t first, size_t count, float* pScratch )
+{
+	if( pOrder == nullptr )
+	{
+		return &pRows[ first * rowSize ];
+	}
+	for( size_t r = 0; r < count; ++r )
+	{
+		const float* pRow = &pRows[ pOrder[ first + r ] * rowSize ];
+		std::copy( pRow, pRow + rowSize, &pScratch[ r * rowSize ] );
+	}
+	return pScratch;
+}
+//----------------------------------------------------------------------------
+
+// How NeuralNet sets its initial weights
+enum InitScheme
+{
+	// What the activation policy prefers, see s_initScheme
+	InitScheme_Default,
+	// Weights and biases uniform in [ 0.5, 0.9 ), the original behaviour
+	InitScheme_Uniform,
+	// Glorot and Bengio: weights uniform in +-sqrt( 6 / ( fanIn + fanOut ) ), zero biases.
+	// Keeps activation variance steady through sigmoid layers.
+	InitScheme_Xavier,
+	// He et al.: weights uniform in +-sqrt( 6 / fanIn ), zero biases. Makes up for
+	// rectifiers zeroing half of their inputs.
+	InitScheme_He
+};
+//----------------------------------------------------------------------------
+
+struct InitParams
+{
+	InitParams()
+		: scheme( InitScheme_Default )
+		, seed( 1 )
+		, threadCount( 0 )
+	{
+	}
+
+	InitScheme scheme;
+	// Equal seeds give bit-identical weights on every machine, instruction set and
+	// thread count
+	uint64_t seed;
+	// 0 uses every hardware thread for nets of a million parameters or more
+	size_t	threadCount;
+};
+//----------------------------------------------------------------------------
+
+// How NeuralNet stores the weights propagate reads, see NeuralNet::setWeightStorage
+enum WeightStorage
+{
+	WeightStorage_Float32,
+	// A bfloat16 copy of the float weights halves the bytes every forward pass streams.
+	// Dot products still sum in float and training updates the float master weights.
+	WeightStorage_BFloat16
+};
+//----------------------------------------------------------------------------
+
+// Activation policies. A layer takes one as a template parameter, so the transfer
+// function is fixed at compile time and each layer can use a different one. The id is
+// what checkpoints store, never change an existing one.
+struct Sigmoid
+{
+	static const uint32_t s_id = 1;
+	static const InitScheme s_initScheme = InitScheme_Xavier;
+
+	static float transfer( float fValue )	{ return sigmoid( fValue ); }
+	static float derivative( float fValue )	{ return sigmoidDerivative( fValue ); }
+
+	static void transfer( const Kernels& kernels, float* pValues, size_t count )
+	{
+		kernels.sigmoid( pValues, count );
+	}
+
+	static void multiplyDerivative( const Kernels& kernels, const float* pValues, float* pDeltas, size_t count )
+	{
+		kernels.sigmoidDerivative( pValues, pDeltas, count );
+	}
+};
+//----------------------------------------------------------------------------
+
+struct Relu
+{
+	static const uint32_t s_id = 2;
+	static const InitScheme s_initScheme = InitScheme_He;
+
+	static float transfer( float fValue )	{ return relu( fValue ); }
+	static float derivative( float fValue )	{ return reluDerivative( fValue ); }
+
+	static void transfer( const Kernels& kernels, float* pValues, size_t count )
+	{
+		kernels.relu( pValues, count );
+	}
+
+	static void multiplyDerivative( const Kernels& kernels, const float* pValues, float* pDeltas, size_t count )
+	{
+		kernels.reluDerivative( pValues, pDeltas, count );
+	}
+};
+//----------------------------------------------------------------------------
+
+struct Softplus
+{
+	static const uint32_t s_id = 3;
+	static const InitScheme s_initScheme = InitScheme_He;
+
+	static float transfer( float fValue )	{ return softplus( fValue ); }
+	static float derivative( float fValue )	{ return softplusDerivative( fValue ); }
+
+	static void transfer( const Kernels& kernels, float* pValues, size_t count )
+	{
+		kernels.softplus( pValues, count );
+	}
+
+	static void multiplyDerivative( const Kernels& kernels, const float* pValues, float* pDeltas, size_t count )
+	{
+		kernels.softplusDerivative( pValues, pDeltas, count );
+	}
+};
+//----------------------------------------------------------------------------
+
+struct Elu
+{
+	static const uint32_t s_id = 4;
+	static const InitScheme s_initScheme = InitScheme_He;
+
+	static float transfer( float fValue )	{ return elu( fValue ); }
+	static float derivative( float fValue )	{ return eluDerivative( fValue ); }
+
+	static void transfer( const Kernels& kernels, float* pValues, size_t count )
+	{
+		kernels.elu( pValues, count );
+	}
+
+	static void multiplyDerivative( const Kernels& kernels, const float* pValues, float* pDeltas, size_t count )
+	{
+		kernels.eluDerivative( pValues, pDeltas, count );
+	}
+};
+//----------------------------------------------------------------------------
+
+// Fills with reproducible values in [ 0.5, 0.9 ), the range every parameter used to
+// start from. Different seeds give independent sequences.
+inline void randomize( float* pValues, size_t count, uint64_t seed = 1 )
+{
+	getKernels().uniform( seed, 0, 0, pValues, count, 0.2f );
+	for( size_t i = 0; i < count; ++i )
+	{
+		pValues[ i ] += 0.7f;
+	}
+}
+//----------------------------------------------------------------------------
+
+inline void print( const char* strName, const float* pValues, size_t count )
+{
+	for( size_t i = 0; i < count; ++i )
+	{
+		printf( "%s[%d] %.5f\n", strName, ( int )i, pValues[ i ] );
+	}
+}
+//----------------------------------------------------------------------------
+
+template< typename Activation >
+struct Layer
+{
+	Layer()
+		: m_inputCount( 0 )
+		, m_outputCount( 0 )
+		, m_pWeights( nullptr )
+		, m_pBiases( nullptr )
+		, m_pWeightsBf16( nullptr )
+		, m_pKernels( &::getKernels() )
+	{
+	}
+
+	// Layers are views, the weights and biases are owned by the network
+	Layer( size_t inputCount, size_t outputCount, float* pWeights, float* pBiases )
+		: m_inputCount( inputCount )
+		, m_outputCount( outputCount )
+		, m_pWeights( pWeights )
+		, m_pBiases( pBiases )
+		, m_pWeightsBf16( nullptr )
+		, m_pKernels( &::getKernels() )
+	{
+	}
+	//------------------------------------------------------------------------
+
+	// With a bfloat16 copy of the weights propagate reads that instead, and updateWeights
+	// refreshes each row it changes. Null goes back to float weights.
+	void setWeightsBf16( uint16_t* pWeightsBf16 )
+	{
+		m_pWeightsBf16 = pWeightsBf16;
+	}
+	//------------------------------------------------------------------------
+
+	// Inputs and outputs are row-major blocks of batchCount samples. Each weight row is
+	// loaded once and reused for every sample in the batch while it is still in cache.
+	void propagate( const float* pInputs, float* pOutputs, size_t batchCount = 1 ) const
+	{
+		NN_INSTRUMENT_PASS( LayerPass_Propagate, batchCount );
+		if( m_pWeightsBf16 != nullptr )
+		{
+			for( size_t o = 0; o < m_outputCount; ++o )
+			{
+				const uint16_t* pWeights = &m_pWeightsBf16[ m_inputCount * o ];
+				for( size_t b = 0; b < batchCount; ++b )
+				{
+					pOutputs[ m_outputCount * b + o ] = m_pBiases[ o ] + m_pKernels->dotBf16( pWeights, &pInputs[ m_inputCount * b ], m_inputCount );
+				}
+			}
+		}
+		else
+		{
+			for( size_t o = 0; o < m_outputCount; ++o )
+			{
+				const float* pWeights = &m_pWeights[ m_inputCount * o ];
+				for( size_t b = 0; b < batchCount; ++b )
+				{
+					pOutputs[ m_outputCount * b + o ] = m_pBiases[ o ] + m_pKernels->dot( pWeights, &pInputs[ m_inputCount * b ], m_inputCount );
+				}
+			}
+		}
+		Activation::transfer( *m_pKernels, pOutputs, m_outputCount * batchCount );
+	}
+	//------------------------------------------------------------------------
+
+	// Applies the summed change of all samples in the batch, caller scales the learning rate.
+	void updateWeights( const float* pInputs, const float* pDeltas, float fLearningRate, size_t batchCount = 1 )
+	{
+		NN_INSTRUMENT_PASS( LayerPass_UpdateWeights, batchCount );
+		for( size_t o = 0; o < m_outputCount; ++o )
+		{
+			float* pWeights = &m_pWeights[ m_inputCount * o ];
+			for( size_t b = 0; b < batchCount; ++b )
+			{
+				const float fChange = pDeltas[ m_outputCount * b + o ] * fLearningRate;
+				m_pKernels->axpy( fChange, &pInputs[ m_inputCount * b ], pWeights, m_inputCount );
+				m_pBiases[ o ] += fChange;
+			}
+			if( m_pWeightsBf16 != nullptr )
+			{
+				m_pKernels->toBf16( pWeights, &m_pWeightsBf16[ m_inputCount * o ], m_inputCount );
+			}
+		}
+	}
+	//------------------------------------------------------------------------
+
+	// Sums the changes updateWeights would make at learning rate 1 into buffers laid out
+	// like the layer's own weights and biases.
+	void accumulateGradients( const float* pInputs, const float* pDeltas, float* pWeightGradients, float* pBiasGradients, size_t batchCount = 1 ) const
+	{
+		for( size_t o = 0; o < m_outputCount; ++o )
+		{
+			float* pGradients = &pWeightGradients[ m_inputCount * o ];
+			for( size_t b = 0; b < batchCount; ++b )
+			{
+				const float fDelta = pDeltas[ m_outputCount * b + o ];
+				m_pKernels->axpy( fDelta, &pInputs[ m_inputCount * b ], pGradients, m_inputCount );
+				pBiasGradients[ o ] += fDelta;
+			}
+		}
+	}
+	//------------------------------------------------------------------------
+	
+	float computeOutputDeltas( const float* pOutputValues, const float* pExpectedValues, float* pDeltas, size_t batchCount = 1 ) const
+	{
+		NN_INSTRUMENT_PASS( LayerPass_ComputeOutputDeltas, batchCount );
+		float fTotalQuadraticError = 0.0f;
+		for( size_t o = 0; o < m_outputCount * batchCount; ++o )
+		{
+			const float fError = pExpectedValues[ o ] - pOutputValues[ o ];
+			pDeltas[ o ] = fError;
+			fTotalQuadraticError += fError * fError;
+		}
+		Activation::multiplyDerivative( *m_pKernels, pOutputValues, pDeltas, m_outputCount * batchCount );
+		return fTotalQuadraticError;
+	}
+	//------------------------------------------------------------------------
+
+	// Errors are accumulated by scattering whole rows of the next layer's weights, so every
+	// weight access is contiguous instead of walking down a column of the matrix.
+	template< typename NextActivation >
+	void computeDeltas( const Layer< NextActivation >* pNextLayer, const float* pNextDeltas, const float* pValues, float* pDeltas, size_t batchCount = 1 ) const
+	{
+		NN_INSTRUMENT_PASS( LayerPass_ComputeDeltas, batchCount );
+		const size_t nextOutputCount = pNextLayer->getOutputCount();
+		for( size_t o = 0; o < m_outputCount * batchCount; ++o )
+		{
+			pDeltas[ o ] = 0.0f;
+		}
+
+		for( size_t i = 0; i < nextOutputCount; ++i )
+		{
+			const float* pNextWeights = &pNextLayer->getWeights()[ m_outputCount * i ];
+			for( size_t b = 0; b < batchCount; ++b )
+			{
+				m_pKernels->axpy( pNextDeltas[ nextOutputCount * b + i ], pNextWeights, &pDeltas[ m_outputCount * b ], m_outputCount );
+			}
+		}
+
+		Activation::multiplyDerivative( *m_pKernels, pValues, pDeltas, m_outputCount * batchCount );
+	}
+	//------------------------------------------------------------------------
+
+	// The last step of computeDeltas, for deltas trainFused scattered
+	void applyDerivative( const float* pValues, float* pDeltas, size_t batchCount = 1 ) const
+	{
+		Activation::multiplyDerivative( *m_pKernels, pValues, pDeltas, m_outputCount * batchCount );
+	}
+	//------------------------------------------------------------------------
+
+	// propagate, computeOutputDeltas and updateWeights of an output layer fused into one
+	// pass over the weights, together with the scatter half of the previous layer's
+	// computeDeltas into pInputDeltas (null without a previous layer, applyDerivative
+	// finishes it). Rows are taken in tiles small enough to stay in cache, so each weight
+	// is fetched from memory once instead of three times. A sample's outputs of one tile
+	// are contiguous, which keeps the transfer kernels on whole vectors. Every element goes
+	// through the same kernels in the same order as in the separate passes and a row feeds
+	// the previous deltas before it changes, so the results match them bit for bit.
+	// Returns the summed quadratic error.
+	float trainFused( const float* pInputs, const float* pExpectedValues, float* pOutputs, float* pDeltas, float* pInputDeltas, float fLearningRate, size_t batchCount = 1 )
+	{
+		NN_INSTRUMENT_PASS( LayerPass_TrainFused, batchCount );
+		if( pInputDeltas != nullptr )
+		{
+			for( size_t i = 0; i < m_inputCount * batchCount; ++i )
+			{
+				pInputDeltas[ i ] = 0.0f;
+			}
+		}
+
+		const size_t tileBytes = 64 * 1024;
+		const size_t rowBytes = m_inputCount * sizeof( float );
+		const size_t tileRowCount = rowBytes < tileBytes ? tileBytes / rowBytes : 1;
+		for( size_t tileBegin = 0; tileBegin < m_outputCount; tileBegin += tileRowCount )
+		{
+			const size_t tileEnd = tileBegin + tileRowCount < m_outputCount ? tileBegin + tileRowCount : m_outputCount;
+			for( size_t o = tileBegin; o < tileEnd; ++o )
+			{
+				for( size_t b = 0; b < batchCount; ++b )
+				{
+					const float* pSampleInputs = &pInputs[ m_inputCount * b ];
+					pOutputs[ m_outputCount * b + o ] = m_pBiases[ o ] + ( m_pWeightsBf16 != nullptr
+						? m_pKernels->dotBf16( &m_pWeightsBf16[ m_inputCount * o ], pSampleInputs, m_inputCount )
+						: m_pKernels->dot( &m_pWeights[ m_inputCount * o ], pSampleInputs, m_inputCount ) );
+				}
+			}
+			for( size_t b = 0; b < batchCount; ++b )
+			{
+				float* pTileOutputs = &pOutputs[ m_outputCount * b + tileBegin ];
+				float* pTileDeltas = &pDeltas[ m_outputCount * b + tileBegin ];
+				const float* pTileExpected = &pExpectedValues[ m_outputCount * b + tileBegin ];
+				Activation::transfer( *m_pKernels, pTileOutputs, tileEnd - tileBegin );
+				for( size_t o = 0; o < tileEnd - tileBegin; ++o )
+				{
+					pTileDeltas[ o ] = pTileExpected[ o ] - pTileOutputs[ o ];
+				}
+				Activation::multiplyDerivative( *m_pKernels, pTileOutputs, pTileDeltas, tileEnd - tileBegin );
+			}
+
+			// The whole tile feeds the previous deltas before any of it changes
+			if( pInputDeltas != nullptr )
+			{
+				for( size_t o = tileBegin; o < tileEnd; ++o )
+				{
+					for( size_t b = 0; b < batchCount; ++b )
+					{
+						m_pKernels->axpy( pDeltas[ m_outputCount * b + o ], &m_pWeights[ m_inputCount * o ], &pInputDeltas[ m_inputCount * b ], m_inputCount );
+					}
+				}
+			}
+			for( size_t o = tileBegin; o < tileEnd; ++o )
+			{
+				float* pWeights = &m_pWeights[ m_inputCount * o ];
+				for( size_t b = 0; b < batchCount; ++b )
+				{
+					const float fChange = pDeltas[ m_outputCount * b + o ] * fLearningRate;
+					m_pKernels->axpy( fChange, &pInputs[ m_inputCount * b ], pWeights, m_inputCount );
+					m_pBiases[ o ] += fChange;
+				}
+				if( m_pWeightsBf16 != nullptr )
+				{
+					m_pKernels->toBf16( pWeights, &m_pWeightsBf16[ m_inputCount * o ], m_inputCount );
+				}
+			}
+		}
+
+		// Summed in the order computeOutputDeltas uses
+		float fTotalQuadraticError = 0.0f;
+		for( size_t o = 0; o < m_outputCount * batchCount; ++o )
+		{
+			const float fError = pExpectedValues[ o ] - pOutputs[ o ];
+			fTotalQuadraticError += fError * fError;
+		}
+		return fTotalQuadraticError;
+	}
+	//------------------------------------------------------------------------
+
+	size_t getInputCount() const	{ return m_inputCount; }
+	size_t getOutputCount() const	{ return m_outputCount; }
+	const float* getWeights() const	{ return m_pWeights; }
+	const float* getBiases() const	{ return m_pBiases; }
+	const uint16_t* getWeightsBf16() const	{ return m_pWeightsBf16; }
+	const Kernels& getKernels() const	{ return *m_pKernels; }
+	//------------------------------------------------------------------------
+
+private:
+	size_t	m_inputCount;
+	size_t	m_outputCount;
+	float*	m_pWeights;
+	float*	m_pBiases;
+	uint16_t* m_pWeightsBf16;
+	const Kernels* m_pKernels;
+};
+//----------------------------------------------------------------------------
+
+// Scratch memory for NeuralNet::evaluate and train, sized once from the topology and
+// a batch size. Reusing one across calls means inference does no allocation. A workspace
+// is not shared, every thread needs its own.
+struct Workspace
+{
+	Workspace()
+		: m_pMemory( nullptr )
+		, m_hiddenValueCount( 0 )
+		, m_outputCount( 0 )
+		, m_batchSize( 0 )
+	{
+	}
+
+	template< typename Net >
+	explicit Workspace( const Net& net, size_t batchSize = 1 )
+		: m_pMemory( nullptr )
+		, m_hiddenValueCount( 0 )
+		, m_outputCount( 0 )
+		, m_batchSize( 0 )
+	{
+		resize( net.getHiddenValueCount(), net.getOutputCount(), batchSize );
+	}
+	//------------------------------------------------------------------------
+
+	~Workspace()
+	{
+		alignedFree( m_pMemory );
+	}
+	//------------------------------------------------------------------------
+
+	// hiddenValueCount is the summed width of all hidden layers
+	void resize( size_t hiddenValueCount, size_t outputCount, size_t batchSize )
+	{
+		alignedFree( m_pMemory );
+		m_hiddenValueCount = hiddenValueCount;
+		m_outputCount = outputCount;
+		m_batchSize = batchSize;
+
+		const size_t hiddenCount = alignedCount( hiddenValueCount * batchSize );
+		const size_t outputBlockCount = alignedCount( outputCount * batchSize );
+		m_pMemory = ( float* )alignedAlloc( ( 2 * hiddenCount + 2 * outputBlockCount ) * sizeof( float ) );
+		m_pHiddenValues = m_pMemory;
+		m_pHiddenDeltas = m_pHiddenValues + hiddenCount;
+		m_pOutputValues = m_pHiddenDeltas + hiddenCount;
+		m_pOutputDeltas = m_pOutputValues + outputBlockCount;
+	}
+	//------------------------------------------------------------------------
+
+	// True when the workspace can hold batchCount samples of the given topology
+	bool fits( size_t hiddenValueCount, size_t outputCount, size_t batchCount ) const
+	{
+		return hiddenValueCount * batchCount <= m_hiddenValueCount * m_batchSize
+			&& outputCount * batchCount <= m_outputCount * m_batchSize;
+	}
+	//------------------------------------------------------------------------
+
+	float* getHiddenValues() const	{ return m_pHiddenValues; }
+	float* getHiddenDeltas() const	{ return m_pHiddenDeltas; }
+	float* getOutputValues() const	{ return m_pOutputValues; }
+	float* getOutputDeltas() const	{ return m_pOutputDeltas; }
+	size_t getBatchSize() const		{ return m_batchSize; }
+	//------------------------------------------------------------------------
+
+private:
+	Workspace( const Workspace& ) = delete;
+	Workspace& operator=( const Workspace& ) = delete;
+
+	float*	m_pMemory;
+	float*	m_pHiddenValues;
+	float*	m_pHiddenDeltas;
+	float*	m_pOutputValues;
+	float*	m_pOutputDeltas;
+	size_t	m_hiddenValueCount;
+	size_t	m_outputCount;
+	size_t	m_batchSize;
+};
+//----------------------------------------------------------------------------
+
+// How training threads share the weights when TrainingParams::threadCount is above 1
+enum ParallelMode
+{
+	// Gradients of every batch are reduced before a single update, see NeuralNet::trainDataParallel
+	ParallelMode_Synchronous,
+	// Threads update the shared weights without locks, see NeuralNet::trainHogwild
+	ParallelMode_Hogwild
+};
+//----------------------------------------------------------------------------
+
+// Order samples are visited in during an epoch
+enum ShuffleMode
+{
+	// Stored order every epoch
+	ShuffleMode_None,
+	// New blockedPermutation every epoch: blocks of contiguous samples in random order,
+	// shuffled within the block
+	ShuffleMode_Blocked,
+	// New full random permutation every epoch, no locality at all
+	ShuffleMode_Full
+};
+//----------------------------------------------------------------------------
+
+// How the summed gradients of a batch become a weight update. Everything but plain
+// descent keeps state laid out like the parameter slab, see NeuralNet::resetOptimizer.
+enum Optimizer
+{
+	// Learning rate times the mean gradient of the batch
+	Optimizer_Sgd,
+	// Heavy ball momentum, steps along a decayed sum of past gradients
+	Optimizer_Momentum,
+	// Nesterov momentum, steps along the gradient and the velocity it leads to
+	Optimizer_Nesterov,
+	// Steps scaled per parameter by a running average of squared gradients
+	Optimizer_RMSProp,
+	// Kingma and Ba: momentum with RMSProp scaling, both averages bias corrected
+	Optimizer_Adam
+};
+//----------------------------------------------------------------------------
+
+// How the learning rate changes from epoch to epoch, after any warmup epochs
+enum Schedule
+{
+	// fLearningRate throughout
+	Schedule_Constant,
+	// Multiplied by fStepFactor every stepEpochs epochs
+	Schedule_Step,
+	// Half a cosine wave from fLearningRate at the first epoch after warmup down to
+	// fMinLearningRate at the last
+	Schedule_Cosine
+};
+//----------------------------------------------------------------------------
+
+struct TrainingParams
+{
+	TrainingParams()
+		: epochCount( 50 )
+		, fLearningRate( 0.2f )
+		, batchSize( 1 )
+		, threadCount( 1 )
+		, parallelMode( ParallelMode_Synchronous )
+		, shuffleMode( ShuffleMode_None )
+		, shuffleBlockSize( 1024 )
+		, shuffleSeed( 1 )
+		, optimizer( Optimizer_Sgd )
+		, fMomentum( 0.9f )
+		, fDecay( 0.999f )
+		, fEpsilon( 1e-8f )
+		, schedule( Schedule_Constant )
+		, stepEpochs( 10 )
+		, fStepFactor( 0.5f )
+		, fMinLearningRate( 0.0f )
+		, warmupEpochs( 0 )
+		, patience( 0 )
+		, fMinImprovement( 1e-3f )
+		, pValidationInputs( nullptr )
+		, pValidationOutputs( nullptr )
+		, validationCount( 0 )
+		, pMetricsSink( nullptr )
+		, bFuseOutputLayer( true )
+		, bPrintProgress( true )
+	{
+	}
+
+	size_t	epochCount;
+	float	fLearningRate;
+	// Samples per weight update. The mean change of a batch is applied, so batchSize 1
+	// is plain per-sample stochastic descent.
+	size_t	batchSize;
+	// Training threads. ParallelMode_Synchronous splits every batch between them, so it
+	// uses at most batchSize threads and scales best when a batch holds many samples
+	// per thread.
+	size_t	threadCount;
+	ParallelMode parallelMode;
+	ShuffleMode shuffleMode;
+	// Samples per block for ShuffleMode_Blocked, pick it so a block of inputs fits in L2
+	size_t	shuffleBlockSize;
+	uint64_t shuffleSeed;
+	Optimizer optimizer;
+	// Velocity decay of momentum and Nesterov, first moment decay of Adam
+	float	fMomentum;
+	// Squared gradient decay of RMSProp and Adam
+	float	fDecay;
+	// Keeps RMSProp and Adam steps finite where gradients have been zero
+	float	fEpsilon;
+	// Learning rate of each epoch, see scheduledLearningRate
+	Schedule schedule;
+	size_t	stepEpochs;
+	float	fStepFactor;
+	float	fMinLearningRate;
+	// Epochs ramping the rate linearly up to fLearningRate before the schedule starts
+	size_t	warmupEpochs;
+	// Early stopping: training ends once the watched error has not improved for this
+	// many epochs, 0 runs every epoch. Without validation samples the training error
+	// of the epoch is watched, otherwise the error of the net on the validation set.
+	size_t	patience;
+	// Relative drop from the best error so far that counts as an improvement
+	float	fMinImprovement;
+	const float* pValidationInputs;
+	const float* pValidationOutputs;
+	size_t	validationCount;
+	// Receives EpochMetrics after every epoch, see telemetry.h. Null costs nothing.
+	// With a sink every phase of every batch is timed, and the gradient norm costs a
+	// dot product over the parameters per batch when an optimizer or data-parallel
+	// training forms the gradient. Plain SGD otherwise measures one batch in
+	// s_gradientNormInterval, at about a backward pass each; the validation error, when
+	// there are validation samples, costs a forward pass over them per epoch.
+	MetricsSink* pMetricsSink;
+	// Train the output layer with Layer::trainFused, one pass over its weights instead
+	// of three. Same results bit for bit; define NEURALNET_VERIFY_FUSION to check that
+	// every batch of single-threaded training against the separate passes. Only plain
+	// descent fuses, the other optimizers need the whole gradient first.
+	bool	bFuseOutputLayer;
+	// Print the error after every epoch
+	bool	bPrintProgress;
+};
+//----------------------------------------------------------------------------
+
+// Learning rate for an epoch counted from 0. Warmup epochs climb linearly towards
+// fLearningRate, the schedule then runs over the remaining epochs.
+inline float scheduledLearningRate( const TrainingParams& params, size_t epoch )
+{
+	if( epoch < params.warmupEpochs )
+	{
+		return params.fLearningRate * float( epoch + 1 ) / float( params.warmupEpochs + 1 );
+	}
+
+	const size_t scheduleEpoch = epoch - params.warmupEpochs;
+	switch( params.schedule )
+	{
+	case Schedule_Step:
+		return params.fLearningRate * powf( params.fStepFactor, float( scheduleEpoch / ( params.stepEpochs > 0 ? params.stepEpochs : 1 ) ) );
+	case Schedule_Cosine:
+	{
+		const size_t scheduleEpochCount = params.epochCount > params.warmupEpochs ? params.epochCount - params.warmupEpochs : 1;
+		// The last epoch runs at fMinLearningRate
+		const float fProgress = scheduleEpochCount > 1 ? float( scheduleEpoch ) / float( scheduleEpochCount - 1 ) : 0.0f;
+		return params.fMinLearningRate + 0.5f * ( params.fLearningRate - params.fMinLearningRate ) * ( 1.0f + cosf( 3.14159265f * fProgress ) );
+	}
+	default:
+		return params.fLearningRate;
+	}
+}
+//----------------------------------------------------------------------------
+
+// Tells train() when the watched error stops improving, see TrainingParams::patience
+struct EarlyStopping
+{
+	explicit EarlyStopping( const TrainingParams& params )
+		: m_patience( params.patience )
+		, m_fMinImprovement( params.fMinImprovement )
+		, m_fBestError( std::numeric_limits< float >::infinity() )
+		, m_staleEpochCount( 0 )
+	{
+	}
+	//------------------------------------------------------------------------
+
+	// Returns true when training should end after an epoch with this error. NaN never
+	// counts as an improvement.
+	bool update( float fError )
+	{
+		if( m_patience == 0 )
+		{
+			return false;
+		}
+		if( fError < m_fBestError * ( 1.0f - m_fMinImprovement ) )
+		{
+			m_fBestError = fError;
+			m_staleEpochCount = 0;
+			return false;
+		}
+		return ++m_staleEpochCount >= m_patience;
+	}
+	//------------------------------------------------------------------------
+
+private:
+	size_t	m_patience;
+	float	m_fMinImprovement;
+	float	m_fBestError;
+	size_t	m_staleEpochCount;
+};
+//----------------------------------------------------------------------------
+
+// Fully connected network of any depth. Every hidden layer uses HiddenActivation
+// and the last layer uses OutputActivation. Weights and biases of all layers live in
+// one cache line aligned slab in forward order, so the passes walk memory sequentially.
+template< typename HiddenActivation, typename OutputActivation = HiddenActivation >
+struct NeuralNet
+{
+	// pLayerSizes lists the input count, the width of every hidden layer and the output count
+	NeuralNet( const size_t* pLayerSizes, size_t sizeCount, const InitParams& initParams = InitParams() )
+	{
+		init( pLayerSizes, sizeCount );
+		initialize( initParams );
+	}
+
+	NeuralNet( std::initializer_list< size_t > layerSizes, const InitParams& initParams = InitParams() )
+	{
+		init( layerSizes.begin(), layerSizes.size() );
+		initialize( initParams );
+	}
+
+	// Read-only view of parameters laid out as getParameters() describes, for example
+	// a memory-mapped checkpoint. The memory must outlive the net. initialize() and train()
+	// refuse to run on it, see isReadOnly().
+	NeuralNet( const size_t* pLayerSizes, size_t sizeCount, const float* pParameters )
+	{
+		init( pLayerSizes, sizeCount, pParameters );
+	}
+	//------------------------------------------------------------------------
+
+	~NeuralNet()
+	{
+		if( m_bOwnsParameters )
+		{
+			alignedFree( m_pParameters );
+		}
+		alignedFree( m_pParametersBf16 );
+		alignedFree( m_pOptimizerState );
+	}
+	//------------------------------------------------------------------------
+
+	// Inputs and outputs are row-major blocks of batchCount samples
+	void evaluate( const float* pInputs, float* pOutputs, Workspace& workspace, size_t batchCount = 1 ) const
+	{
+		NN_INSTRUMENT_PAUSE();
+		assert( workspace.fits( m_hiddenValueCount, getOutputCount(), batchCount ) );
+
+		const float* pLayerInputs = pInputs;
+		for( size_t l = 0; l < m_hiddenLayers.size(); ++l )
+		{
+			float* pValues = &workspace.getHiddenValues()[ m_hiddenOffsets[ l ] * batchCount ];
+			m_hiddenLayers[ l ].propagate( pLayerInputs, pValues, batchCount );
+			pLayerInputs = pValues;
+		}
+		m_outputLayer.propagate( pLayerInputs, pOutputs, batchCount );
+	}
+	//------------------------------------------------------------------------
+
+	// Sets every weight and bias from the given scheme and seed. Each weight matrix and
+	// bias vector is its own Philox stream and threads fill slices of every stream,
+	// so the result does not depend on the thread count. Returns false and changes nothing
+	// on a read-only view.
+	bool initialize( const InitParams& params )
+	{
+		if( isReadOnly() )
+		{
+			return false;
+		}
+
+		struct Region
+		{
+			float*	pValues;
+			size_t	count;
+			float	fScale;
+			float	fOffset;
+		};
+		std::vector< Region > regions;
+		for( size_t l = 0; l <= m_hiddenLayers.size(); ++l )
+		{
+			const bool bOutput = ( l == m_hiddenLayers.size() );
+			const size_t inputCount = bOutput ? m_outputLayer.getInputCount() : m_hiddenLayers[ l ].getInputCount();
+			const size_t outputCount = bOutput ? m_outputLayer.getOutputCount() : m_hiddenLayers[ l ].getOutputCount();
+			InitScheme scheme = params.scheme;
+			if( scheme == InitScheme_Default )
+			{
+				scheme = bOutput ? OutputActivation::s_initScheme : HiddenActivation::s_initScheme;
+			}
+
+			// Layers hand out const views, the slab is found by offset
+			const float* pWeights = bOutput ? m_outputLayer.getWeights() : m_hiddenLayers[ l ].getWeights();
+			const float* pBiases = bOutput ? m_outputLayer.getBiases() : m_hiddenLayers[ l ].getBiases();
+			Region weights = { &m_pParameters[ pWeights - m_pParameters ], inputCount * outputCount, 0.2f, 0.7f };
+			Region biases = { &m_pParameters[ pBiases - m_pParameters ], outputCount, 0.2f, 0.7f };
+			if( scheme != InitScheme_Uniform )
+			{
+				const float fFanSum = float( scheme == InitScheme_Xavier ? inputCount + outputCount : inputCount );
+				weights.fScale = sqrtf( 6.0f / fFanSum );
+				weights.fOffset = 0.0f;
+				biases.fScale = 0.0f;
+				biases.fOffset = 0.0f;
+			}
+			regions.push_back( weights );
+			regions.push_back( biases );
+		}
+
+		size_t threadCount = params.threadCount;
+		if( threadCount == 0 )
+		{
+			const size_t hardwareCount = std::thread::hardware_concurrency();
+			threadCount = m_parameterCount >= ( 1 << 20 ) && hardwareCount > 0 ? hardwareCount : 1;
+		}
+
+		const Kernels& kernels = m_outputLayer.getKernels();
+		auto worker = [ & ]( size_t t )
+		{
+			for( size_t r = 0; r < regions.size(); ++r )
+			{
+				const Region& region = regions[ r ];
+				const size_t begin = region.count * t / threadCount;
+				const size_t end = region.count * ( t + 1 ) / threadCount;
+				float* pValues = region.pValues + begin;
+				kernels.uniform( params.seed, r, begin, pValues, end - begin, region.fScale );
+				for( size_t i = 0; i < end - begin; ++i )
+				{
+					pValues[ i ] += region.fOffset;
+				}
+				// The padding up to the next cache line stays zero for the kernels
+				if( t == threadCount - 1 )
+				{
+					for( size_t i = region.count; i < alignedCount( region.count ); ++i )
+					{
+						region.pValues[ i ] = 0.0f;
+					}
+				}
+			}
+		};
+		runThreads( threadCount, worker );
+		if( m_pParametersBf16 != nullptr )
+		{
+			kernels.toBf16( m_pParameters, m_pParametersBf16, m_parameterCount );
+		}
+		return true;
+	}
+	//------------------------------------------------------------------------
+
+	// Switches what propagate reads, for evaluate and the forward pass of training. The
+	// bfloat16 copy mirrors the parameter slab and every update keeps it in sync; biases,
+	// activations, deltas and the backward pass stay float. Works on read-only views too.
+	void setWeightStorage( WeightStorage storage )
+	{
+		alignedFree( m_pParametersBf16 );
+		m_pParametersBf16 = nullptr;
+		if( storage == WeightStorage_BFloat16 )
+		{
+			m_pParametersBf16 = ( uint16_t* )alignedAlloc( m_parameterCount * sizeof( uint16_t ) );
+			m_outputLayer.getKernels().toBf16( m_pParameters, m_pParametersBf16, m_parameterCount );
+		}
+
+		for( size_t l = 0; l < m_hiddenLayers.size(); ++l )
+		{
+			m_hiddenLayers[ l ].setWeightsBf16( getWeightsBf16( m_hiddenLayers[ l ] ) );
+		}
+		m_outputLayer.setWeightsBf16( getWeightsBf16( m_outputLayer ) );
+	}
+
+	WeightStorage getWeightStorage() const	{ return m_pParametersBf16 != nullptr ? WeightStorage_BFloat16 : WeightStorage_Float32; }
+	//------------------------------------------------------------------------
+
+	// Forgets the velocities and averages of the optimizer, the next train() starts it
+	// afresh. Training with a different optimizer than the last one does this itself.
+	void resetOptimizer( Optimizer optimizer = Optimizer_Sgd )
+	{
+		alignedFree( m_pOptimizerState );
+		m_pOptimizerState = nullptr;
+		m_optimizer = optimizer;
+		m_optimizerStep = 0;
+		if( optimizer != Optimizer_Sgd )
+		{
+			// Two slabs shaped like the parameters, the second one only used by Adam
+			m_pOptimizerState = ( float* )alignedAlloc( 2 * m_parameterCount * sizeof( float ) );
+			std::fill( m_pOptimizerState, m_pOptimizerState + 2 * m_parameterCount, 0.0f );
+		}
+	}
+	//------------------------------------------------------------------------
+
+	// Returns the summed quadratic error of the last epoch, NaN without training on a
+	// read-only view
+	float train( const float* pAllInputs, const float* pAllExpectedOutputs, size_t testCount, const TrainingParams& params )
+	{
+		if( isReadOnly() )
+		{
+			return std::numeric_limits< float >::quiet_NaN();
+		}
+#if defined( NEURALNET_INSTRUMENT )
+		const InstrumentReport report( *this );
+#endif
+		if( params.optimizer != m_optimizer )
+		{
+			resetOptimizer( params.optimizer );
+		}
+		TrainingScratch scratch( *this, params );
+		const bool bEpochwise = params.shuffleMode != ShuffleMode_None || params.schedule != Schedule_Constant
+			|| params.warmupEpochs > 0 || params.patience > 0 || params.pMetricsSink != nullptr;
+		if( !bEpochwise )
+		{
+			return trainEpochs( pAllInputs, pAllExpectedOutputs, nullptr, testCount, params, scratch, nullptr );
+		}
+
+		// One epoch at a time, each in a fresh order, at its own learning rate and
+		// reported on its own
+		std::vector< size_t > order;
+		Pcg32 random( params.shuffleSeed );
+		TrainingParams epochParams = params;
+		epochParams.epochCount = 1;
+		epochParams.bPrintProgress = false;
+		EarlyStopping earlyStopping( params );
+
+		float fTotalQuadraticError = 0.0f;
+		for( size_t epoch = 0; epoch < params.epochCount; ++epoch )
+		{
+			EpochCounters counters;
+			const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+			epochParams.fLearningRate = scheduledLearningRate( params, epoch );
+			fTotalQuadraticError = trainEpoch( pAllInputs, pAllExpectedOutputs, testCount, epochParams, random, order, scratch, params.pMetricsSink != nullptr ? &counters : nullptr );
+			const double fSeconds = std::chrono::duration< double >( std::chrono::steady_clock::now() - start ).count();
+			if( finishEpoch( params, epoch, testCount, epochParams.fLearningRate, fTotalQuadraticError, fSeconds, counters, earlyStopping ) )
+			{
+				break;
+			}
+		}
+		return fTotalQuadraticError;
+	}
+	//------------------------------------------------------------------------
+
+	// Trains on a dataset streamed in chunks, see StreamingDataset. Each chunk goes
+	// through the in-memory path above, so a batch never spans two chunks; keep the
+	// chunk size a multiple of the batch size to get the same updates as in memory.
+	// Returns the summed quadratic error of the last epoch. Returns NaN on a read-only
+	// view, and when the dataset fails to read, see hasFailed, without finishing the
+	// epoch it failed in.
+	template< typename Dataset >
+	float train( Dataset& dataset, const TrainingParams& params )
+	{
+		if( isReadOnly() )
+		{
+			return std::numeric_limits< float >::quiet_NaN();
+		}
+#if defined( NEURALNET_INSTRUMENT )
+		const InstrumentReport report( *this );
+#endif
+		assert( dataset.getInputCount() == getInputCount() && dataset.getOutputCount() == getOutputCount() );
+		if( params.optimizer != m_optimizer )
+		{
+			resetOptimizer( params.optimizer );
+		}
+
+		TrainingParams chunkParams = params;
+		chunkParams.epochCount = 1;
+		chunkParams.bPrintProgress = false;
+		TrainingScratch scratch( *this, params );
+		std::vector< size_t > order;
+		EarlyStopping earlyStopping( params );
+
+		float fTotalQuadraticError = 0.0f;
+		for( size_t epoch = 0; epoch < params.epochCount; ++epoch )
+		{
+			EpochCounters counters;
+			const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+			fTotalQuadraticError = 0.0f;
+			chunkParams.fLearningRate = scheduledLearningRate( params, epoch );
+			size_t sampleCount = 0;
+			dataset.rewind();
+			DataChunk chunk;
+			for( size_t c = 0; dataset.next( chunk ); ++c )
+			{
+				// Chunks arrive in file order, shuffling happens within each chunk with
+				// its own order every epoch
+				uint64_t seedState = params.shuffleSeed ^ ( uint64_t( epoch ) << 32 ) ^ uint64_t( c );
+				Pcg32 random( splitMix64( seedState ) );
+				fTotalQuadraticError += trainEpoch( chunk.pInputs, chunk.pOutputs, chunk.sampleCount, chunkParams, random, order, scratch, params.pMetricsSink != nullptr ? &counters : nullptr );
+				sampleCount += chunk.sampleCount;
+			}
+			if( dataset.hasFailed() )
+			{
+				if( params.bPrintProgress )
+				{
+					printf( "epoch: %d  reading the dataset failed\n", ( int )epoch );
+				}
+				return std::numeric_limits< float >::quiet_NaN();
+			}
+			const double fSeconds = std::chrono::duration< double >( std::chrono::steady_clock::now() - start ).count();
+			if( finishEpoch( params, epoch, sampleCount, chunkParams.fLearningRate, fTotalQuadraticError, fSeconds, counters, earlyStopping ) )
+			{
+				break;
+			}
+		}
+		return fTotalQuadraticError;
+	}
+	//------------------------------------------------------------------------
+
+	// Summed quadratic error of the net over count samples, evaluated batchSize at a time
+	float computeQuadraticError( const float* pInputs, const float* pExpectedOutputs, size_t count, size_t batchSize = 64 ) const
+	{
+		const size_t inputCount = getInputCount();
+		const size_t outputCount = getOutputCount();
+		Workspace workspace( *this, batchSize );
+		std::vector< float > outputs( batchSize * outputCount );
+
+		float fTotalQuadraticError = 0.0f;
+		for( size_t sample = 0; sample < count; sample += batchSize )
+		{
+			const size_t batchCount = ( count - sample ) < batchSize ? ( count - sample ) : batchSize;
+			evaluate( &pInputs[ sample * inputCount ], outputs.data(), workspace, batchCount );
+			const float* pExpected = &pExpectedOutputs[ sample * outputCount ];
+			for( size_t o = 0; o < batchCount * outputCount; ++o )
+			{
+				const float fError = pExpected[ o ] - outputs[ o ];
+				fTotalQuadraticError += fError * fError;
+			}
+		}
+		return fTotalQuadraticError;
+	}
+	//------------------------------------------------------------------------
+
+	size_t getInputCount() const									{ return m_hiddenLayers.empty() ? m_outputLayer.getInputCount() : m_hiddenLayers[ 0 ].getInputCount(); }
+	size_t getOutputCount() const									{ return m_outputLayer.getOutputCount(); }
+	size_t getHiddenLayerCount() const								{ return m_hiddenLayers.size(); }
+	size_t getHiddenValueCount() const								{ return m_hiddenValueCount; }
+	const Layer< HiddenActivation >& getHiddenLayer( size_t l ) const	{ return m_hiddenLayers[ l ]; }
+	const Layer< OutputActivation >& getOutputLayer() const			{ return m_outputLayer; }
+
+	// All weights and biases in forward order W0 b0 W1 b1 ..., each region padded to
+	// whole cache lines with zeros
+	const float* getParameters() const								{ return m_pParameters; }
+	size_t getParameterCount() const								{ return m_parameterCount; }
+
+	// Views made over const parameters can only be evaluated
+	bool isReadOnly() const											{ return !m_bOwnsParameters; }
+	//------------------------------------------------------------------------
+
+private:
+	NeuralNet( const NeuralNet& ) = delete;
+	NeuralNet& operator=( const NeuralNet& ) = delete;
+
+	// What one training thread reuses from batch to batch: the workspace, rows gathered
+	// for a shuffled batch and a gradient slab shaped like the parameters
+	struct ThreadScratch
+	{
+		ThreadScratch( const NeuralNet& net, size_t rowCount, bool bGradients )
+			: workspace( net, rowCount )
+			, inputs( rowCount * net.getInputCount() )
+			, outputs( rowCount * net.getOutputCount() )
+			, pGradients( bGradients ? ( float* )alignedAlloc( net.m_parameterCount * sizeof( float ) ) : nullptr )
+		{
+		}
+
+		~ThreadScratch()
+		{
+			alignedFree( pGradients );
+		}
+
+		Workspace				workspace;
+		std::vector< float >	inputs;
+		std::vector< float >	outputs;
+		float*					pGradients;
+
+	private:
+		ThreadScratch( const ThreadScratch& ) = delete;
+		ThreadScratch& operator=( const ThreadScratch& ) = delete;
+	};
+
+	// The training threads with their scratch, made once per train() call so epochs and
+	// chunks neither start threads nor allocate. Data-parallel threads hold one shard of
+	// a batch each and always need a gradient slab, the other modes only with an optimizer.
+	struct TrainingScratch
+	{
+		TrainingScratch( const NeuralNet& net, const TrainingParams& params )
+			: m_team( getTrainingThreadCount( params ) )
+		{
+			const size_t threadCount = m_team.getThreadCount();
+			const bool bDataParallel = threadCount > 1 && params.parallelMode == ParallelMode_Synchronous;
+			const size_t rowCount = bDataParallel ? ( params.batchSize + threadCount - 1 ) / threadCount : params.batchSize;
+			const bool bGradients = bDataParallel || params.optimizer != Optimizer_Sgd;
+			for( size_t t = 0; t < threadCount; ++t )
+			{
+				m_threads.push_back( std::unique_ptr< ThreadScratch >( new ThreadScratch( net, rowCount, bGradients ) ) );
+			}
+		}
+
+		// Synchronous threads split each batch, beyond one sample per thread the rest
+		// would only wait at the barriers
+		static size_t getTrainingThreadCount( const TrainingParams& params )
+		{
+			size_t threadCount = params.threadCount > 1 ? params.threadCount : 1;
+			if( params.parallelMode == ParallelMode_Synchronous && threadCount > params.batchSize )
+			{
+				threadCount = params.batchSize > 1 ? params.batchSize : 1;
+			}
+			return threadCount;
+		}
+
+		template< typename Worker >
+		void run( Worker& worker )				{ m_team.run( worker ); }
+
+		size_t getThreadCount() const			{ return m_team.getThreadCount(); }
+		ThreadScratch& getThread( size_t t )	{ return *m_threads[ t ]; }
+
+	private:
+		TrainingScratch( const TrainingScratch& ) = delete;
+		TrainingScratch& operator=( const TrainingScratch& ) = delete;
+
+		ThreadTeam m_team;
+		std::vector< std::unique_ptr< ThreadScratch > > m_threads;
+	};
+	//------------------------------------------------------------------------
+
+	// One epoch over testCount samples, in a fresh order from random unless shuffling
+	// is off. order is scratch kept between epochs.
+	float trainEpoch( const float* pAllInputs, const float* pAllExpectedOutputs, size_t testCount, const TrainingParams& epochParams, Pcg32& random, std::vector< size_t >& order, TrainingScratch& scratch, EpochCounters* pCounters )
+	{
+		const size_t* pOrder = nullptr;
+		if( epochParams.shuffleMode != ShuffleMode_None )
+		{
+			order.resize( testCount );
+			const size_t blockSize = epochParams.shuffleMode == ShuffleMode_Blocked ? epochParams.shuffleBlockSize : testCount;
+			blockedPermutation( order.data(), testCount, blockSize, random );
+			pOrder = order.data();
+		}
+		return trainEpochs( pAllInputs, pAllExpectedOutputs, pOrder, testCount, epochParams, scratch, pCounters );
+	}
+	//------------------------------------------------------------------------
+
+	// Prints and reports an epoch trained one at a time and checks early stopping.
+	// Returns true when training should end.
+	bool finishEpoch( const TrainingParams& params, size_t epoch, size_t sampleCount, float fLearningRate, float fError, double fSeconds, const EpochCounters& counters, EarlyStopping& earlyStopping ) const
+	{
+		if( params.bPrintProgress )
+		{
+			printf( "epoch: %d  error: %.3f\n", ( int )epoch, fError );
+		}
+
+		const bool bValidate = params.validationCount > 0 && ( params.patience > 0 || params.pMetricsSink != nullptr );
+		const float fValidationError = bValidate ? computeQuadraticError( params.pValidationInputs, params.pValidationOutputs, params.validationCount ) : std::numeric_limits< float >::quiet_NaN();
+		if( params.pMetricsSink != nullptr )
+		{
+			EpochMetrics metrics;
+			metrics.epoch = epoch;
+			metrics.sampleCount = sampleCount;
+			metrics.fLearningRate = fLearningRate;
+			metrics.fError = fError;
+			metrics.fValidationError = fValidationError;
+			metrics.fGradientNorm = counters.normBatchCount > 0 ? float( sqrt( counters.fGradientNormSquaredSum / double( counters.normBatchCount ) ) ) : 0.0f;
+			metrics.fSeconds = fSeconds;
+			metrics.fSamplesPerSecond = fSeconds > 0.0 ? double( sampleCount ) / fSeconds : 0.0;
+			for( int phase = 0; phase < Phase_Count; ++phase )
+			{
+				metrics.fPhaseSeconds[ phase ] = counters.fPhaseSeconds[ phase ];
+			}
+			params.pMetricsSink->record( metrics );
+		}
+
+		if( params.patience > 0 && earlyStopping.update( params.validationCount > 0 ? fValidationError : fError ) )
+		{
+			if( params.bPrintProgress )
+			{
+				printf( "stopped after epoch %d, no improvement in %d epochs\n", ( int )epoch, ( int )params.patience );
+			}
+			return true;
+		}
+		return false;
+	}
+	//------------------------------------------------------------------------
+
+	// Squared norm of the mean gradient of a batch whose deltas are in the workspace.
+	// A layer's weight gradient is a sum of outer products delta_b input_b, so its squared
+	// norm is the sum over sample pairs of ( delta_b . delta_c ) * ( input_b . input_c ),
+	// plus one in the second factor for the biases; the gradient itself is never formed.
+	float computeGradientNormSquared( const float* pInputs, size_t batchCount, const Workspace& workspace ) const
+	{
+		float fNormSquared = 0.0f;
+		const float* pLayerInputs = pInputs;
+		for( size_t l = 0; l < m_hiddenLayers.size(); ++l )
+		{
+			fNormSquared += computeGradientNormSquared( m_hiddenLayers[ l ], pLayerInputs, getHiddenDeltas( workspace, l ), batchCount );
+			pLayerInputs = getHiddenValues( workspace, l );
+		}
+		fNormSquared += computeGradientNormSquared( m_outputLayer, pLayerInputs, workspace.getOutputDeltas(), batchCount );
+		return fNormSquared / float( batchCount * batchCount );
+	}
+
+	template< typename Activation >
+	static float computeGradientNormSquared( const Layer< Activation >& layer, const float* pInputs, const float* pDeltas, size_t batchCount )
+	{
+		const Kernels& kernels = layer.getKernels();
+		const size_t inputCount = layer.getInputCount();
+		const size_t outputCount = layer.getOutputCount();
+		float fNormSquared = 0.0f;
+		for( size_t b = 0; b < batchCount; ++b )
+		{
+			for( size_t c = 0; c <= b; ++c )
+			{
+				const float fDeltaDot = kernels.dot( &pDeltas[ outputCount * b ], &pDeltas[ outputCount * c ], outputCount );
+				const float fInputDot = kernels.dot( &pInputs[ inputCount * b ], &pInputs[ inputCount * c ], inputCount );
+				fNormSquared += ( c == b ? 1.0f : 2.0f ) * fDeltaDot * ( fInputDot + 1.0f );
+			}
+		}
+		return fNormSquared;
+	}
+	//------------------------------------------------------------------------
+
+	float* getHiddenValues( const Workspace& workspace, size_t l ) const	{ return &workspace.getHiddenValues()[ m_hiddenOffsets[ l ] * workspace.getBatchSize() ]; }
+	float* getHiddenDeltas( const Workspace& workspace, size_t l ) const	{ return &workspace.getHiddenDeltas()[ m_hiddenOffsets[ l ] * workspace.getBatchSize() ]; }
+	//------------------------------------------------------------------------
+
+	// Forward and backward pass of one batch. Leaves the values and deltas of every layer
+	// in the workspace and returns the summed quadratic error.
+	float backpropagate( const float* pInputs, const float* pExpectedOutputs, size_t batchCount, Workspace& workspace, PhaseClock& clock ) const
+	{
+		const float* pLayerInputs = propagateHidden( pInputs, batchCount, workspace );
+		m_outputLayer.propagate( pLayerInputs, workspace.getOutputValues(), batchCount );
+		clock.lap( Phase_Forward );
+
+		// Backpropagate errors to deltas
+		const float fQuadraticError = m_outputLayer.computeOutputDeltas( workspace.getOutputValues(), pExpectedOutputs, workspace.getOutputDeltas(), batchCount );
+		if( !m_hiddenLayers.empty() )
+		{
+			const size_t last = m_hiddenLayers.size() - 1;
+			m_hiddenLayers[ last ].computeDeltas( &m_outputLayer, workspace.getOutputDeltas(), getHiddenValues( workspace, last ), getHiddenDeltas( workspace, last ), batchCount );
+			backpropagateHidden( batchCount, workspace );
+		}
+		clock.lap( Phase_Backward );
+		return fQuadraticError;
+	}
+	//------------------------------------------------------------------------
+
+	// Forward pass through the hidden layers, returns the output layer's inputs
+	const float* propagateHidden( const float* pInputs, size_t batchCount, Workspace& workspace ) const
+	{
+		const float* pLayerInputs = pInputs;
+		for( size_t l = 0; l < m_hiddenLayers.size(); ++l )
+		{
+			m_hiddenLayers[ l ].propagate( pLayerInputs, getHiddenValues( workspace, l ), batchCount );
+			pLayerInputs = getHiddenValues( workspace, l );
+		}
+		return pLayerInputs;
+	}
+	//------------------------------------------------------------------------
+
+	// Deltas of the hidden layers below the last one, whose deltas are already in place
+	void backpropagateHidden( size_t batchCount, Workspace& workspace ) const
+	{
+		for( size_t l = m_hiddenLayers.size() - 1; l-- > 0; )
+		{
+			m_hiddenLayers[ l ].computeDeltas( &m_hiddenLayers[ l + 1 ], getHiddenDeltas( workspace, l + 1 ), getHiddenValues( workspace, l ), getHiddenDeltas( workspace, l ), batchCount );
+		}
+	}
+	//------------------------------------------------------------------------
+
+	// Samples are visited in pOrder, or in stored order when it is null. Phase times and
+	// gradient norms are added to pCounters unless it is null.
+	float trainEpochs( const float* pAllInputs, const float* pAllExpectedOutputs, const size_t* pOrder, size_t testCount, const TrainingParams& params, TrainingScratch& scratch, EpochCounters* pCounters )
+	{
+		if( scratch.getThreadCount() > 1 )
+		{
+			if( params.parallelMode == ParallelMode_Hogwild )
+			{
+				return trainHogwild( pAllInputs, pAllExpectedOutputs, pOrder, testCount, params, scratch, pCounters );
+			}
+			return trainDataParallel( pAllInputs, pAllExpectedOutputs, pOrder, testCount, params, scratch, pCounters );
+		}
+
+		float fTotalQuadraticError = 0.0f;
+		for( size_t epoch = 0; epoch < params.epochCount; ++epoch )
+		{
+			fTotalQuadraticError = trainSamples( pAllInputs, pAllExpectedOutputs, pOrder, 0, testCount, params, scratch.getThread( 0 ), pCounters );
+			if( params.bPrintProgress )
+			{
+				printf( "epoch: %d  error: %.3f\n", ( int )epoch, fTotalQuadraticError );
+			}
+		}
+		return fTotalQuadraticError;
+	}
+	//------------------------------------------------------------------------
+
+	// One pass over samples [ begin, end ) in minibatches, updating the weights after each
+	float trainSamples( const float* pAllInputs, const float* pAllExpectedOutputs, const size_t* pOrder, size_t begin, size_t end, const TrainingParams& params, ThreadScratch& thread, EpochCounters* pCounters )
+	{
+		const size_t inputCount = getInputCount();
+		const size_t outputCount = getOutputCount();
+		const size_t batchSize = params.batchSize;
+		Workspace& workspace = thread.workspace;
+		float* pGradients = params.optimizer != Optimizer_Sgd ? thread.pGradients : nullptr;
+		PhaseClock clock( pCounters );
+
+		float fTotalQuadraticError = 0.0f;
+		for( size_t test = begin; test < end; test += batchSize )
+		{
+			const size_t batchCount = ( end - test ) < batchSize ? ( end - test ) : batchSize;
+			const float* pInputs = gatherRows( pAllInputs, inputCount, pOrder, test, batchCount, thread.inputs.data() );
+			const float* pExpectedOutputs = gatherRows( pAllExpectedOutputs, outputCount, pOrder, test, batchCount, thread.outputs.data() );
+			const float fBatchLearningRate = params.fLearningRate / float( batchCount );
+			clock.start();
+
+			if( pGradients != nullptr )
+			{
+				// Hogwild threads share the step count like the weights, only it stays exact
+				const uint64_t step = m_optimizerStep.fetch_add( 1, std::memory_order_relaxed ) + 1;
+				fTotalQuadraticError += trainBatchOptimized( pInputs, pExpectedOutputs, batchCount, params, step, pGradients, workspace, clock );
+			}
+			else if( params.bFuseOutputLayer )
+			{
+				fTotalQuadraticError += trainBatchFused( pInputs, pExpectedOutputs, batchCount, fBatchLearningRate, params.threadCount <= 1, workspace, clock );
+			}
+			else
+			{
+				fTotalQuadraticError += backpropagate( pInputs, pExpectedOutputs, batchCount, workspace, clock );
+
+				// Update weights and biases with deltas
+				const float* pLayerInputs = pInputs;
+				for( size_t l = 0; l < m_hiddenLayers.size(); ++l )
+				{
+					m_hiddenLayers[ l ].updateWeights( pLayerInputs, getHiddenDeltas( workspace, l ), fBatchLearningRate, batchCount );
+					pLayerInputs = getHiddenValues( workspace, l );
+				}
+				m_outputLayer.updateWeights( pLayerInputs, workspace.getOutputDeltas(), fBatchLearningRate, batchCount );
+				clock.lap( Phase_Update );
+			}
+
+			if( pCounters != nullptr )
+			{
+				// The optimizer path has the whole gradient at hand and counted it already,
+				// without it only a sample of the batches is worth the cost
+				if( pGradients == nullptr && pCounters->batchCount % s_gradientNormInterval == 0 )
+				{
+					pCounters->fGradientNormSquaredSum += computeGradientNormSquared( pInputs, batchCount, workspace );
+					++pCounters->normBatchCount;
+				}
+				++pCounters->batchCount;
+			}
+		}
+		return fTotalQuadraticError;
+	}
+	//------------------------------------------------------------------------
+
+	// One batch with an optimizer other than plain descent. The gradients of all layers
+	// are summed into pGradients, a slab shaped like the parameters, and applyUpdate then
+	// goes over the parameters and the optimizer state in a single pass.
+	float trainBatchOptimized( const float* pInputs, const float* pExpectedOutputs, size_t batchCount, const TrainingParams& params, uint64_t step, float* pGradients, Workspace& workspace, PhaseClock& clock )
+	{
+		const float fQuadraticError = backpropagate( pInputs, pExpectedOutputs, batchCount, workspace, clock );
+
+		std::fill( pGradients, pGradients + m_parameterCount, 0.0f );
+		const float* pLayerInputs = pInputs;
+		for( size_t l = 0; l < m_hiddenLayers.size(); ++l )
+		{
+			accumulateGradients( m_hiddenLayers[ l ], pLayerInputs, getHiddenDeltas( workspace, l ), pGradients, batchCount );
+			pLayerInputs = getHiddenValues( workspace, l );
+		}
+		accumulateGradients( m_outputLayer, pLayerInputs, workspace.getOutputDeltas(), pGradients, batchCount );
+		clock.lap( Phase_Backward );
+		applyUpdate( params, pGradients, 0, m_parameterCount, batchCount, step );
+		clock.lap( Phase_Update );
+
+		if( clock.getCounters() != nullptr )
+		{
+			const float fNormSquared = m_outputLayer.getKernels().dot( pGradients, pGradients, m_parameterCount );
+			clock.getCounters()->fGradientNormSquaredSum += fNormSquared / float( batchCount * batchCount );
+			++clock.getCounters()->normBatchCount;
+		}
+		return fQuadraticError;
+	}
+	//------------------------------------------------------------------------
+
+	// Updates parameters [ begin, end ) from gradients summed over batchCount samples,
+	// pGradients shares the parameter layout. step counts the updates since the
+	// optimizer was reset, starting from 1.
+	void applyUpdate( const TrainingParams& params, const float* pGradients, size_t begin, size_t end, size_t batchCount, uint64_t step )
+	{
+		const Kernels& kernels = m_outputLayer.getKernels();
+		if( params.optimizer == Optimizer_Sgd )
+		{
+			kernels.axpy( params.fLearningRate / float( batchCount ), &pGradients[ begin ], &m_pParameters[ begin ], end - begin );
+		}
+		else
+		{
+			OptimizerStep optimizerStep;
+			optimizerStep.fLearningRate = params.fLearningRate;
+			optimizerStep.fGradientScale = 1.0f / float( batchCount );
+			optimizerStep.fMomentum = params.fMomentum;
+			optimizerStep.fDecay = params.fDecay;
+			optimizerStep.fEpsilon = params.fEpsilon;
+			optimizerStep.fCorrection1 = float( 1.0 / ( 1.0 - pow( double( params.fMomentum ), double( step ) ) ) );
+			optimizerStep.fCorrection2 = float( 1.0 / ( 1.0 - pow( double( params.fDecay ), double( step ) ) ) );
+			optimizerStep.bNesterov = ( params.optimizer == Optimizer_Nesterov );
+
+			float* pState0 = &m_pOptimizerState[ begin ];
+			float* pState1 = &m_pOptimizerState[ m_parameterCount + begin ];
+			switch( params.optimizer )
+			{
+			case Optimizer_Momentum:
+			case Optimizer_Nesterov:
+				kernels.momentum( optimizerStep, &m_pParameters[ begin ], &pGradients[ begin ], pState0, pState1, end - begin );
+				break;
+			case Optimizer_RMSProp:
+				kernels.rmsprop( optimizerStep, &m_pParameters[ begin ], &pGradients[ begin ], pState0, pState1, end - begin );
+				break;
+			default:
+				kernels.adam( optimizerStep, &m_pParameters[ begin ], &pGradients[ begin ], pState0, pState1, end - begin );
+				break;
+			}
+		}
+		if( m_pParametersBf16 != nullptr )
+		{
+			kernels.toBf16( &m_pParameters[ begin ], &m_pParametersBf16[ begin ], end - begin );
+		}
+	}
+	//------------------------------------------------------------------------
+
+	// One batch with the output layer trained by Layer::trainFused. The hidden layers are
+	// updated after the output layer, which changes nothing as their updates only read
+	// deltas and values.
+	float trainBatchFused( const float* pInputs, const float* pExpectedOutputs, size_t batchCount, float fLearningRate, bool bSingleThreaded, Workspace& workspace, PhaseClock& clock )
+	{
+		const float* pOutputInputs = propagateHidden( pInputs, batchCount, workspace );
+		clock.lap( Phase_Forward );
+		float* pLastDeltas = m_hiddenLayers.empty() ? nullptr : getHiddenDeltas( workspace, m_hiddenLayers.size() - 1 );
+
+#if defined( NEURALNET_VERIFY_FUSION )
+		// Hogwild threads change the weights under the copy, only single threads compare
+		FusionCheck check;
+		if( bSingleThreaded )
+		{
+			check.runUnfused( *this, pOutputInputs, pExpectedOutputs, fLearningRate, batchCount, workspace );
+		}
+#else
+		( void )bSingleThreaded;
+#endif
+
+		const float fQuadraticError = m_outputLayer.trainFused( pOutputInputs, pExpectedOutputs, workspace.getOutputValues(), workspace.getOutputDeltas(), pLastDeltas, fLearningRate, batchCount );
+		if( pLastDeltas != nullptr )
+		{
+			m_hiddenLayers.back().applyDerivative( getHiddenValues( workspace, m_hiddenLayers.size() - 1 ), pLastDeltas, batchCount );
+		}
+		clock.lap( Phase_Update );
+
+#if defined( NEURALNET_VERIFY_FUSION )
+		if( bSingleThreaded )
+		{
+			check.compare( *this, fQuadraticError, batchCount, workspace );
+		}
+#endif
+
+		if( pLastDeltas != nullptr )
+		{
+			backpropagateHidden( batchCount, workspace );
+		}
+		clock.lap( Phase_Backward );
+		const float* pLayerInputs = pInputs;
+		for( size_t l = 0; l < m_hiddenLayers.size(); ++l )
+		{
+			m_hiddenLayers[ l ].updateWeights( pLayerInputs, getHiddenDeltas( workspace, l ), fLearningRate, batchCount );
+			pLayerInputs = getHiddenValues( workspace, l );
+		}
+		clock.lap( Phase_Update );
+		return fQuadraticError;
+	}
+	//------------------------------------------------------------------------
+
+#if defined( NEURALNET_VERIFY_FUSION )
+	// Runs the separate passes on a copy of the output layer and aborts unless the fused
+	// pass gives identical outputs, deltas, error and updated parameters
+	struct FusionCheck
+	{
+		void runUnfused( const NeuralNet& net, const float* pInputs, const float* pExpectedOutputs, float fLearningRate, size_t batchCount, const Workspace& workspace )
+		{
+			const Layer< OutputActivation >& layer = net.getOutputLayer();
+			const size_t inputCount = layer.getInputCount();
+			const size_t outputCount = layer.getOutputCount();
+			weights.assign( layer.getWeights(), layer.getWeights() + inputCount * outputCount );
+			biases.assign( layer.getBiases(), layer.getBiases() + outputCount );
+			Layer< OutputActivation > copy( inputCount, outputCount, weights.data(), biases.data() );
+			if( layer.getWeightsBf16() != nullptr )
+			{
+				weightsBf16.assign( layer.getWeightsBf16(), layer.getWeightsBf16() + inputCount * outputCount );
+				copy.setWeightsBf16( weightsBf16.data() );
+			}
+
+			outputs.resize( outputCount * batchCount );
+			deltas.resize( outputCount * batchCount );
+			copy.propagate( pInputs, outputs.data(), batchCount );
+			fQuadraticError = copy.computeOutputDeltas( outputs.data(), pExpectedOutputs, deltas.data(), batchCount );
+			if( !net.m_hiddenLayers.empty() )
+			{
+				const size_t last = net.m_hiddenLayers.size() - 1;
+				hiddenDeltas.resize( net.m_hiddenLayers[ last ].getOutputCount() * batchCount );
+				net.m_hiddenLayers[ last ].computeDeltas( &copy, deltas.data(), net.getHiddenValues( workspace, last ), hiddenDeltas.data(), batchCount );
+			}
+			copy.updateWeights( pInputs, deltas.data(), fLearningRate, batchCount );
+		}
+
+		void compare( const NeuralNet& net, float fFusedError, size_t batchCount, const Workspace& workspace ) const
+		{
+			const Layer< OutputActivation >& layer = net.getOutputLayer();
+			bool bSame = memcmp( &fFusedError, &fQuadraticError, sizeof( float ) ) == 0
+				&& memcmp( workspace.getOutputValues(), outputs.data(), outputs.size() * sizeof( float ) ) == 0
+				&& memcmp( workspace.getOutputDeltas(), deltas.data(), deltas.size() * sizeof( float ) ) == 0
+				&& memcmp( layer.getWeights(), weights.data(), weights.size() * sizeof( float ) ) == 0
+				&& memcmp( layer.getBiases(), biases.data(), biases.size() * sizeof( float ) ) == 0;
+			if( !net.m_hiddenLayers.empty() )
+			{
+				bSame = bSame && memcmp( net.getHiddenDeltas( workspace, net.m_hiddenLayers.size() - 1 ), hiddenDeltas.data(), hiddenDeltas.size() * sizeof( float ) ) == 0;
+			}
+			if( !bSame )
+			{
+				fprintf( stderr, "fused output layer differs from the separate passes, batch of %d\n", ( int )batchCount );
+				abort();
+			}
+		}
+
+		std::vector< float > weights;
+		std::vector< float > biases;
+		std::vector< uint16_t > weightsBf16;
+		std::vector< float > outputs;
+		std::vector< float > deltas;
+		std::vector< float > hiddenDeltas;
+		float fQuadraticError;
+	};
+#endif
+	//------------------------------------------------------------------------
+
+#if defined( NEURALNET_INSTRUMENT )
+	// Counts the passes of the net's layers while it is alive and prints them at the
+	// end, see instrument.h
+	struct InstrumentReport
+	{
+		explicit InstrumentReport( const NeuralNet& net )
+			: m_net( net )
+		{
+			for( size_t l = 0; l < m_net.m_hiddenLayers.size(); ++l )
+			{
+				InstrumentRegistry::get().arm( &m_net.m_hiddenLayers[ l ] );
+			}
+			InstrumentRegistry::get().arm( &m_net.m_outputLayer );
+		}
+
+		~InstrumentReport()
+		{
+			printf( "layer passes, cycles, instructions and cache misses per sample\n" );
+			printf( "%-16s %-20s %9s %10s %12s %12s %12s\n", "layer", "pass", "calls", "samples", "cycles", "instructions", "cache misses" );
+			for( size_t l = 0; l < m_net.m_hiddenLayers.size(); ++l )
+			{
+				printLayer( "hidden", l, m_net.m_hiddenLayers[ l ] );
+			}
+			printLayer( "output", m_net.m_hiddenLayers.size(), m_net.m_outputLayer );
+		}
+
+	private:
+		template< typename Activation >
+		static void printLayer( const char* strKind, size_t index, const Layer< Activation >& layer )
+		{
+			LayerTotals totals;
+			if( !InstrumentRegistry::get().take( &layer, totals ) )
+			{
+				return;
+			}
+			char strLayer[ 64 ];
+			snprintf( strLayer, sizeof( strLayer ), "%s %d %dx%d", strKind, ( int )index, ( int )layer.getInputCount(), ( int )layer.getOutputCount() );
+			for( int pass = 0; pass < LayerPass_Count; ++pass )
+			{
+				const PassTotals& passTotals = totals.passes[ pass ];
+				if( passTotals.callCount == 0 )
+				{
+					continue;
+				}
+				// Per sample, hardware counts over the samples that got them
+				printf( "%-16s %-20s %9llu %10llu %12.1f", strLayer, getLayerPassName( LayerPass( pass ) ),
+					( unsigned long long )passTotals.callCount, ( unsigned long long )passTotals.sampleCount,
+					double( passTotals.cycles ) / double( passTotals.sampleCount ) );
+				if( passTotals.countedSampleCount > 0 )
+				{
+					printf( " %12.1f %12.3f\n",
+						double( passTotals.counters[ HardwareCounters::Counter_Instructions ] ) / double( passTotals.countedSampleCount ),
+						double( passTotals.counters[ HardwareCounters::Counter_CacheMisses ] ) / double( passTotals.countedSampleCount ) );
+				}
+				else
+				{
+					printf( " %12s %12s\n", "n/a", "n/a" );
+				}
+			}
+		}
+
+		const NeuralNet& m_net;
+	};
+#endif
+	//------------------------------------------------------------------------
+
+	// Hogwild: every thread runs the plain training loop on its own contiguous range of
+	// samples and writes the shared weights without any locking, so an update may be lost
+	// or read half applied. That costs little convergence when updates rarely collide and
+	// removes all synchronisation except one barrier per epoch. The concurrent float writes
+	// are a data race by the letter of the C++ memory model and thread sanitizers report
+	// them, but aligned float stores do not tear on the supported platforms. Optimizer
+	// state is shared the same way.
+	float trainHogwild( const float* pAllInputs, const float* pAllExpectedOutputs, const size_t* pOrder, size_t testCount, const TrainingParams& params, TrainingScratch& scratch, EpochCounters* pCounters )
+	{
+		const size_t threadCount = scratch.getThreadCount();
+		std::vector< float > errors( threadCount );
+		std::vector< EpochCounters > threadCounters( pCounters != nullptr ? threadCount : 0 );
+		float fLastEpochError = 0.0f;
+		Barrier barrier( threadCount );
+
+		auto worker = [ & ]( size_t t )
+		{
+			const size_t begin = testCount * t / threadCount;
+			const size_t end = testCount * ( t + 1 ) / threadCount;
+
+			for( size_t epoch = 0; epoch < params.epochCount; ++epoch )
+			{
+				errors[ t ] = trainSamples( pAllInputs, pAllExpectedOutputs, pOrder, begin, end, params, scratch.getThread( t ), pCounters != nullptr ? &threadCounters[ t ] : nullptr );
+				barrier.wait();
+				if( t == 0 )
+				{
+					fLastEpochError = reportEpoch( params, epoch, errors );
+				}
+				barrier.wait();
+			}
+		};
+
+		scratch.run( worker );
+		for( size_t t = 0; t < threadCounters.size(); ++t )
+		{
+			pCounters->add( threadCounters[ t ] );
+		}
+		return fLastEpochError;
+	}
+	//------------------------------------------------------------------------
+
+	// Every batch is split into one contiguous shard per thread. Each thread sums the
+	// gradients of its shard into a private slab with the same layout as the parameters.
+	// The slabs are then reduced in parallel: thread t owns one cache line aligned slice
+	// of the parameters, sums that slice over all slabs in thread order, applies it and
+	// clears it in every slab for the next batch, so no thread ever touches a whole
+	// slab. The summation order only depends on threadCount, so results are deterministic.
+	float trainDataParallel( const float* pAllInputs, const float* pAllExpectedOutputs, const size_t* pOrder, size_t testCount, const TrainingParams& params, TrainingScratch& scratch, EpochCounters* pCounters )
+	{
+		const size_t inputCount = getInputCount();
+		const size_t outputCount = getOutputCount();
+		const size_t batchSize = params.batchSize;
+		const size_t threadCount = scratch.getThreadCount();
+		const size_t shardSize = ( batchSize + threadCount - 1 ) / threadCount;
+		const size_t sliceSize = alignedCount( ( m_parameterCount + threadCount - 1 ) / threadCount );
+		const Kernels& kernels = m_outputLayer.getKernels();
+
+		std::vector< float* > gradients( threadCount );
+		for( size_t t = 0; t < threadCount; ++t )
+		{
+			gradients[ t ] = scratch.getThread( t ).pGradients;
+		}
+		std::vector< float > errors( threadCount );
+		std::vector< EpochCounters > threadCounters( pCounters != nullptr ? threadCount : 0 );
+		float fLastEpochError = 0.0f;
+		Barrier barrier( threadCount );
+		const uint64_t firstStep = m_optimizerStep;
+		const uint64_t batchesPerEpoch = ( testCount + batchSize - 1 ) / batchSize;
+
+		auto worker = [ & ]( size_t t )
+		{
+			ThreadScratch& thread = scratch.getThread( t );
+			Workspace& workspace = thread.workspace;
+			uint64_t step = firstStep;
+			float* pGradients = thread.pGradients;
+			// Time spent waiting at the barriers is in no phase
+			PhaseClock clock( pCounters != nullptr ? &threadCounters[ t ] : nullptr );
+			const size_t sliceBegin = t * sliceSize < m_parameterCount ? t * sliceSize : m_parameterCount;
+			const size_t sliceEnd = sliceBegin + sliceSize < m_parameterCount ? sliceBegin + sliceSize : m_parameterCount;
+			for( size_t s = 0; s < threadCount; ++s )
+			{
+				std::fill( gradients[ s ] + sliceBegin, gradients[ s ] + sliceEnd, 0.0f );
+			}
+			barrier.wait();
+
+			for( size_t epoch = 0; epoch < params.epochCount; ++epoch )
+			{
+				float fTotalQuadraticError = 0.0f;
+
+				for( size_t test = 0; test < testCount; test += batchSize )
+				{
+					const size_t batchCount = ( testCount - test ) < batchSize ? ( testCount - test ) : batchSize;
+					const size_t shardBegin = t * shardSize < batchCount ? t * shardSize : batchCount;
+					const size_t shardCount = shardBegin + shardSize < batchCount ? shardSize : batchCount - shardBegin;
+					++step;
+					clock.start();
+
+					if( shardCount > 0 )
+					{
+						const float* pInputs = gatherRows( pAllInputs, inputCount, pOrder, test + shardBegin, shardCount, thread.inputs.data() );
+						const float* pExpectedOutputs = gatherRows( pAllExpectedOutputs, outputCount, pOrder, test + shardBegin, shardCount, thread.outputs.data() );
+						fTotalQuadraticError += backpropagate( pInputs, pExpectedOutputs, shardCount, workspace, clock );
+
+						const float* pLayerInputs = pInputs;
+						for( size_t l = 0; l < m_hiddenLayers.size(); ++l )
+						{
+							accumulateGradients( m_hiddenLayers[ l ], pLayerInputs, getHiddenDeltas( workspace, l ), pGradients, shardCount );
+							pLayerInputs = getHiddenValues( workspace, l );
+						}
+						accumulateGradients( m_outputLayer, pLayerInputs, workspace.getOutputDeltas(), pGradients, shardCount );
+						clock.lap( Phase_Backward );
+					}
+					barrier.wait();
+					clock.start();
+
+					// Reduce this thread's slice of every slab into the first one and apply it
+					if( sliceBegin < sliceEnd )
+					{
+						for( size_t s = 1; s < threadCount; ++s )
+						{
+							kernels.axpy( 1.0f, &gradients[ s ][ sliceBegin ], &gradients[ 0 ][ sliceBegin ], sliceEnd - sliceBegin );
+						}
+						applyUpdate( params, gradients[ 0 ], sliceBegin, sliceEnd, batchCount, step );
+						clock.lap( Phase_Update );
+						if( clock.getCounters() != nullptr )
+						{
+							const float fNormSquared = kernels.dot( &gradients[ 0 ][ sliceBegin ], &gradients[ 0 ][ sliceBegin ], sliceEnd - sliceBegin );
+							clock.getCounters()->fGradientNormSquaredSum += fNormSquared / float( batchCount * batchCount );
+						}
+						for( size_t s = 0; s < threadCount; ++s )
+						{
+							std::fill( gradients[ s ] + sliceBegin, gradients[ s ] + sliceEnd, 0.0f );
+						}
+					}
+					if( t == 0 && clock.getCounters() != nullptr )
+					{
+						++clock.getCounters()->normBatchCount;
+						++clock.getCounters()->batchCount;
+					}
+					barrier.wait();
+				}
+
+				errors[ t ] = fTotalQuadraticError;
+				barrier.wait();
+				if( t == 0 )
+				{
+					fLastEpochError = reportEpoch( params, epoch, errors );
+				}
+			}
+		};
+
+		scratch.run( worker );
+		m_optimizerStep = firstStep + batchesPerEpoch * params.epochCount;
+		for( size_t t = 0; t < threadCounters.size(); ++t )
+		{
+			pCounters->add( threadCounters[ t ] );
+		}
+		return fLastEpochError;
+	}
+	//------------------------------------------------------------------------
+
+	// Sums the per-thread errors in thread order and prints them
+	static float reportEpoch( const TrainingParams& params, size_t epoch, const std::vector< float >& errors )
+	{
+		float fTotalQuadraticError = 0.0f;
+		for( size_t t = 0; t < errors.size(); ++t )
+		{
+			fTotalQuadraticError += errors[ t ];
+		}
+		if( params.bPrintProgress )
+		{
+			printf( "epoch: %d  error: %.3f\n", ( int )epoch, fTotalQuadraticError );
+		}
+		return fTotalQuadraticError;
+	}
+	//------------------------------------------------------------------------
+
+	// Gradient slabs share the parameter layout, so a layer finds its part by offset
+	template< typename Activation >
+	void accumulateGradients( const Layer< Activation >& layer, const float* pInputs, const float* pDeltas, float* pGradients, size_t batchCount ) const
+	{
+		float* pWeightGradients = &pGradients[ layer.getWeights() - m_pParameters ];
+		float* pBiasGradients = &pGradients[ layer.getBiases() - m_pParameters ];
+		layer.accumulateGradients( pInputs, pDeltas, pWeightGradients, pBiasGradients, batchCount );
+	}
+	//------------------------------------------------------------------------
+
+	// The bfloat16 slab shares the parameter layout
+	template< typename Activation >
+	uint16_t* getWeightsBf16( const Layer< Activation >& layer ) const
+	{
+		return m_pParametersBf16 != nullptr ? &m_pParametersBf16[ layer.getWeights() - m_pParameters ] : nullptr;
+	}
+	//------------------------------------------------------------------------
+
+	// Allocates the parameters unless pParameters is given, initialize fills them
+	void init( const size_t* pLayerSizes, size_t sizeCount, const float* pParameters = nullptr )
+	{
+		m_parameterCount = computeParameterCount( pLayerSizes, sizeCount );
+		m_pParametersBf16 = nullptr;
+		m_pOptimizerState = nullptr;
+		m_optimizer = Optimizer_Sgd;
+		m_optimizerStep = 0;
+		m_bOwnsParameters = ( pParameters == nullptr );
+		if( m_bOwnsParameters )
+		{
+			m_pParameters = ( float* )alignedAlloc( m_parameterCount * sizeof( float ) );
+		}
+		else
+		{
+			// Layers take mutable pointers; initialize() and train() check isReadOnly() and
+			// nothing else writes the parameters
+			m_pParameters = const_cast< float* >( pParameters );
+		}
+
+		float* pLayerParameters = m_pParameters;
+		m_hiddenValueCount = 0;
+		for( size_t l = 0; l + 1 < sizeCount; ++l )
+		{
+			const size_t inputCount = pLayerSizes[ l ];
+			const size_t outputCount = pLayerSizes[ l + 1 ];
+			float* pWeights = pLayerParameters;
+			float* pBiases = pWeights + alignedCount( inputCount * outputCount );
+			pLayerParameters = pBiases + alignedCount( outputCount );
+
+			if( l + 2 < sizeCount )
+			{
+				m_hiddenLayers.push_back( Layer< HiddenActivation >( inputCount, outputCount, pWeights, pBiases ) );
+				m_hiddenOffsets.push_back( m_hiddenValueCount );
+				m_hiddenValueCount += outputCount;
+			}
+			else
+			{
+				m_outputLayer = Layer< OutputActivation >( inputCount, outputCount, pWeights, pBiases );
+			}
+		}
+	}
+	//------------------------------------------------------------------------
+
+	float*	m_pParameters;
+	uint16_t* m_pParametersBf16;
+	// Velocities or averages of the optimizer, see resetOptimizer
+	float*	m_pOptimizerState;
+	Optimizer m_optimizer;
+	std::atomic< uint64_t > m_optimizerStep;
+	size_t	m_parameterCount;
+	bool	m_bOwnsParameters;
+	std::vector< Layer< HiddenActivation > > m_hiddenLayers;
+	std::vector< size_t > m_hiddenOffsets;
+	Layer< OutputActivation > m_outputLayer;
+	size_t	m_hiddenValueCount;
+};
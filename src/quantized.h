@@ -0,0 +1,351 @@
+/*=============================================================================
+
+MIT License
+
+Copyright (c) 2018 Ville Ruusutie
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+
+=============================================================================*/
+
+#pragma once
+
+#include "neuralnet.h"
+
+#include <math.h>
+#include <stdint.h>
+#include <vector>
+//----------------------------------------------------------------------------
+
+// Post-training int8 quantization for inference. Every weight row gets its own scale so
+// that its largest magnitude maps to 127. Activations are quantized per sample at run
+// time onto 0..127 across their own range, 7 bits so Kernels::dotU8S8 cannot saturate
+// on any instruction set; negative inputs and Elu outputs go through the offset.
+constexpr float s_activationLevels = 127.0f;
+
+// Rounds a byte count up to whole cache lines
+inline size_t alignedByteCount( size_t byteCount )
+{
+	return ( byteCount + s_cacheLineSize - 1 ) / s_cacheLineSize * s_cacheLineSize;
+}
+//----------------------------------------------------------------------------
+
+// value ~ fOffset + fScale * pQuantized[ i ]
+inline void quantizeActivations( const float* pValues, size_t count, uint8_t* pQuantized, float* pScale, float* pOffset )
+{
+	float fMin = count > 0 ? pValues[ 0 ] : 0.0f;
+	float fMax = fMin;
+	for( size_t i = 1; i < count; ++i )
+	{
+		fMin = pValues[ i ] < fMin ? pValues[ i ] : fMin;
+		fMax = pValues[ i ] > fMax ? pValues[ i ] : fMax;
+	}
+
+	const float fScale = fMax > fMin ? ( fMax - fMin ) / s_activationLevels : 1.0f;
+	const float fInverseScale = 1.0f / fScale;
+	for( size_t i = 0; i < count; ++i )
+	{
+		const float fLevel = ( pValues[ i ] - fMin ) * fInverseScale + 0.5f;
+		pQuantized[ i ] = uint8_t( fLevel < s_activationLevels ? fLevel : s_activationLevels );
+	}
+	*pScale = fScale;
+	*pOffset = fMin;
+}
+//----------------------------------------------------------------------------
+
+// View into a QuantizedNet, the counterpart of Layer for inference
+template< typename Activation >
+struct QuantizedLayer
+{
+	QuantizedLayer()
+		: m_inputCount( 0 )
+		, m_outputCount( 0 )
+		, m_pWeights( nullptr )
+		, m_pScales( nullptr )
+		, m_pRowSums( nullptr )
+		, m_pBiases( nullptr )
+		, m_pKernels( &::getKernels() )
+	{
+	}
+
+	QuantizedLayer( size_t inputCount, size_t outputCount, int8_t* pWeights, float* pScales, int32_t* pRowSums, float* pBiases )
+		: m_inputCount( inputCount )
+		, m_outputCount( outputCount )
+		, m_pWeights( pWeights )
+		, m_pScales( pScales )
+		, m_pRowSums( pRowSums )
+		, m_pBiases( pBiases )
+		, m_pKernels( &::getKernels() )
+	{
+	}
+	//------------------------------------------------------------------------
+
+	// Rounds the float weights of a layer with the same shape, biases stay float
+	void quantize( const float* pWeights, const float* pBiases )
+	{
+		for( size_t o = 0; o < m_outputCount; ++o )
+		{
+			const float* pRow = &pWeights[ m_inputCount * o ];
+			float fMaxMagnitude = 0.0f;
+			for( size_t i = 0; i < m_inputCount; ++i )
+			{
+				fMaxMagnitude = fabsf( pRow[ i ] ) > fMaxMagnitude ? fabsf( pRow[ i ] ) : fMaxMagnitude;
+			}
+
+			const float fScale = fMaxMagnitude > 0.0f ? fMaxMagnitude / 127.0f : 1.0f;
+			int8_t* pQuantized = &m_pWeights[ m_inputCount * o ];
+			int32_t rowSum = 0;
+			for( size_t i = 0; i < m_inputCount; ++i )
+			{
+				pQuantized[ i ] = int8_t( lrintf( pRow[ i ] / fScale ) );
+				rowSum += pQuantized[ i ];
+			}
+			m_pScales[ o ] = fScale;
+			m_pRowSums[ o ] = rowSum;
+			m_pBiases[ o ] = pBiases[ o ];
+		}
+	}
+	//------------------------------------------------------------------------
+
+	// pInputs holds batchCount rows from quantizeActivations with their scales and
+	// offsets. With input x = offset + scale * q, sum( w * x ) = weightScale *
+	// ( scale * sum( wq * q ) + offset * sum( wq ) ), so the row sums take the offset.
+	void propagate( const uint8_t* pInputs, const float* pInputScales, const float* pInputOffsets, float* pOutputs, size_t batchCount = 1 ) const
+	{
+		for( size_t o = 0; o < m_outputCount; ++o )
+		{
+			const int8_t* pWeights = &m_pWeights[ m_inputCount * o ];
+			for( size_t b = 0; b < batchCount; ++b )
+			{
+				const int32_t dot = m_pKernels->dotU8S8( &pInputs[ m_inputCount * b ], pWeights, m_inputCount );
+				const float fSum = pInputScales[ b ] * float( dot ) + pInputOffsets[ b ] * float( m_pRowSums[ o ] );
+				pOutputs[ m_outputCount * b + o ] = m_pBiases[ o ] + m_pScales[ o ] * fSum;
+			}
+		}
+		Activation::transfer( *m_pKernels, pOutputs, m_outputCount * batchCount );
+	}
+	//------------------------------------------------------------------------
+
+	size_t getInputCount() const	{ return m_inputCount; }
+	size_t getOutputCount() const	{ return m_outputCount; }
+	//------------------------------------------------------------------------
+
+private:
+	size_t	m_inputCount;
+	size_t	m_outputCount;
+	int8_t*	m_pWeights;
+	float*	m_pScales;
+	int32_t* m_pRowSums;
+	float*	m_pBiases;
+	const Kernels* m_pKernels;
+};
+//----------------------------------------------------------------------------
+
+// int8 copy of a trained NeuralNet for evaluation only, a quarter of the weight bytes.
+// It is a drop-in Net for Workspace and InferenceServer. A Workspace sized from it also
+// holds the quantized activations, which is why getHiddenValueCount counts more than
+// the hidden layer widths.
+template< typename HiddenActivation, typename OutputActivation = HiddenActivation >
+struct QuantizedNet
+{
+	explicit QuantizedNet( const NeuralNet< HiddenActivation, OutputActivation >& net )
+		: m_pMemory( nullptr )
+		, m_byteCount( 0 )
+		, m_hiddenValueCount( 0 )
+		, m_maxInputCount( 0 )
+	{
+		std::vector< size_t > layerSizes( 1, net.getInputCount() );
+		for( size_t l = 0; l < net.getHiddenLayerCount(); ++l )
+		{
+			layerSizes.push_back( net.getHiddenLayer( l ).getOutputCount() );
+		}
+		layerSizes.push_back( net.getOutputCount() );
+
+		// Per layer: weight rows, then scales, row sums and biases, each on a cache line
+		for( size_t l = 0; l + 1 < layerSizes.size(); ++l )
+		{
+			m_byteCount += alignedByteCount( layerSizes[ l ] * layerSizes[ l + 1 ] );
+			m_byteCount += 3 * alignedCount( layerSizes[ l + 1 ] ) * sizeof( float );
+		}
+		m_pMemory = ( uint8_t* )alignedAlloc( m_byteCount );
+
+		uint8_t* pLayerMemory = m_pMemory;
+		for( size_t l = 0; l + 1 < layerSizes.size(); ++l )
+		{
+			const size_t inputCount = layerSizes[ l ];
+			const size_t outputCount = layerSizes[ l + 1 ];
+			int8_t* pWeights = ( int8_t* )pLayerMemory;
+			float* pScales = ( float* )( pLayerMemory + alignedByteCount( inputCount * outputCount ) );
+			int32_t* pRowSums = ( int32_t* )( pScales + alignedCount( outputCount ) );
+			float* pBiases = ( float* )( pRowSums + alignedCount( outputCount ) );
+			pLayerMemory = ( uint8_t* )( pBiases + alignedCount( outputCount ) );
+			m_maxInputCount = inputCount > m_maxInputCount ? inputCount : m_maxInputCount;
+
+			if( l + 2 < layerSizes.size() )
+			{
+				const Layer< HiddenActivation >& layer = net.getHiddenLayer( l );
+				m_hiddenLayers.push_back( QuantizedLayer< HiddenActivation >( inputCount, outputCount, pWeights, pScales, pRowSums, pBiases ) );
+				m_hiddenLayers.back().quantize( layer.getWeights(), layer.getBiases() );
+				m_hiddenOffsets.push_back( m_hiddenValueCount );
+				m_hiddenValueCount += outputCount;
+			}
+			else
+			{
+				const Layer< OutputActivation >& layer = net.getOutputLayer();
+				m_outputLayer = QuantizedLayer< OutputActivation >( inputCount, outputCount, pWeights, pScales, pRowSums, pBiases );
+				m_outputLayer.quantize( layer.getWeights(), layer.getBiases() );
+			}
+		}
+	}
+	//------------------------------------------------------------------------
+
+	~QuantizedNet()
+	{
+		alignedFree( m_pMemory );
+	}
+	//------------------------------------------------------------------------
+
+	// Same contract as NeuralNet::evaluate. The float outputs of each layer are
+	// quantized again before the next one.
+	void evaluate( const float* pInputs, float* pOutputs, Workspace& workspace, size_t batchCount = 1 ) const
+	{
+		assert( workspace.fits( getHiddenValueCount(), getOutputCount(), batchCount ) );
+
+		// Quantized rows, then their scales and offsets, after the hidden values
+		float* pScratch = &workspace.getHiddenValues()[ m_hiddenValueCount * batchCount ];
+		uint8_t* pQuantized = ( uint8_t* )pScratch;
+		float* pScales = pScratch + ( m_maxInputCount * batchCount + sizeof( float ) - 1 ) / sizeof( float );
+		float* pOffsets = pScales + batchCount;
+
+		const float* pLayerInputs = pInputs;
+		for( size_t l = 0; l <= m_hiddenLayers.size(); ++l )
+		{
+			const bool bOutput = ( l == m_hiddenLayers.size() );
+			const size_t inputCount = bOutput ? m_outputLayer.getInputCount() : m_hiddenLayers[ l ].getInputCount();
+			for( size_t b = 0; b < batchCount; ++b )
+			{
+				quantizeActivations( &pLayerInputs[ inputCount * b ], inputCount, &pQuantized[ inputCount * b ], &pScales[ b ], &pOffsets[ b ] );
+			}
+
+			if( bOutput )
+			{
+				m_outputLayer.propagate( pQuantized, pScales, pOffsets, pOutputs, batchCount );
+			}
+			else
+			{
+				float* pValues = &workspace.getHiddenValues()[ m_hiddenOffsets[ l ] * batchCount ];
+				m_hiddenLayers[ l ].propagate( pQuantized, pScales, pOffsets, pValues, batchCount );
+				pLayerInputs = pValues;
+			}
+		}
+	}
+	//------------------------------------------------------------------------
+
+	size_t getInputCount() const		{ return m_hiddenLayers.empty() ? m_outputLayer.getInputCount() : m_hiddenLayers[ 0 ].getInputCount(); }
+	size_t getOutputCount() const		{ return m_outputLayer.getOutputCount(); }
+	size_t getHiddenLayerCount() const	{ return m_hiddenLayers.size(); }
+	// Floats of workspace per sample: hidden values, a quantized row and its scale and offset
+	size_t getHiddenValueCount() const	{ return m_hiddenValueCount + ( m_maxInputCount + sizeof( float ) - 1 ) / sizeof( float ) + 2; }
+	// Bytes of weights, scales, row sums and biases
+	size_t getByteCount() const			{ return m_byteCount; }
+	//------------------------------------------------------------------------
+
+private:
+	QuantizedNet( const QuantizedNet& ) = delete;
+	QuantizedNet& operator=( const QuantizedNet& ) = delete;
+
+	uint8_t* m_pMemory;
+	size_t	m_byteCount;
+	std::vector< QuantizedLayer< HiddenActivation > > m_hiddenLayers;
+	std::vector< size_t > m_hiddenOffsets;
+	QuantizedLayer< OutputActivation > m_outputLayer;
+	size_t	m_hiddenValueCount;
+	size_t	m_maxInputCount;
+};
+//----------------------------------------------------------------------------
+
+// How far a quantized net strays from its float original on a calibration set
+struct QuantizationReport
+{
+	size_t	sampleCount;
+	float	fMaxAbsError;
+	float	fMeanAbsError;
+	float	fRmsError;
+	// Largest float output magnitude, to put the errors in scale
+	float	fMaxOutput;
+	// Share of samples whose largest output is the same one in both nets, for classifiers
+	float	fArgmaxAgreement;
+};
+//----------------------------------------------------------------------------
+
+template< typename HiddenActivation, typename OutputActivation >
+QuantizationReport compareQuantized( const NeuralNet< HiddenActivation, OutputActivation >& net, const QuantizedNet< HiddenActivation, OutputActivation >& quantizedNet,
+	const float* pInputs, size_t sampleCount, size_t batchSize = 64 )
+{
+	const size_t inputCount = net.getInputCount();
+	const size_t outputCount = net.getOutputCount();
+	Workspace workspace( net, batchSize );
+	Workspace quantizedWorkspace( quantizedNet, batchSize );
+	std::vector< float > outputs( batchSize * outputCount );
+	std::vector< float > quantizedOutputs( batchSize * outputCount );
+
+	QuantizationReport report = {};
+	report.sampleCount = sampleCount;
+	double fAbsErrorSum = 0.0;
+	double fSquaredErrorSum = 0.0;
+	size_t agreementCount = 0;
+	for( size_t sample = 0; sample < sampleCount; sample += batchSize )
+	{
+		const size_t batchCount = sampleCount - sample < batchSize ? sampleCount - sample : batchSize;
+		net.evaluate( &pInputs[ inputCount * sample ], &outputs[ 0 ], workspace, batchCount );
+		quantizedNet.evaluate( &pInputs[ inputCount * sample ], &quantizedOutputs[ 0 ], quantizedWorkspace, batchCount );
+
+		for( size_t b = 0; b < batchCount; ++b )
+		{
+			size_t argmax = 0;
+			size_t quantizedArgmax = 0;
+			for( size_t o = 0; o < outputCount; ++o )
+			{
+				const float fOutput = outputs[ outputCount * b + o ];
+				const float fQuantizedOutput = quantizedOutputs[ outputCount * b + o ];
+				const float fError = fabsf( fQuantizedOutput - fOutput );
+				report.fMaxAbsError = fError > report.fMaxAbsError ? fError : report.fMaxAbsError;
+				report.fMaxOutput = fabsf( fOutput ) > report.fMaxOutput ? fabsf( fOutput ) : report.fMaxOutput;
+				fAbsErrorSum += fError;
+				fSquaredErrorSum += double( fError ) * fError;
+				argmax = fOutput > outputs[ outputCount * b + argmax ] ? o : argmax;
+				quantizedArgmax = fQuantizedOutput > quantizedOutputs[ outputCount * b + quantizedArgmax ] ? o : quantizedArgmax;
+			}
+			agreementCount += ( argmax == quantizedArgmax ) ? 1 : 0;
+		}
+	}
+
+	const double fValueCount = double( sampleCount * outputCount );
+	report.fMeanAbsError = sampleCount > 0 ? float( fAbsErrorSum / fValueCount ) : 0.0f;
+	report.fRmsError = sampleCount > 0 ? float( sqrt( fSquaredErrorSum / fValueCount ) ) : 0.0f;
+	report.fArgmaxAgreement = sampleCount > 0 ? float( agreementCount ) / float( sampleCount ) : 0.0f;
+	return report;
+}
+//----------------------------------------------------------------------------
+
+inline void print( const QuantizationReport& report )
+{
+	printf( "quantization over %d samples: max error %.5f, mean %.5f, rms %.5f (largest output %.4f), argmax agreement %.2f%%\n",
+		( int )report.sampleCount, report.fMaxAbsError, report.fMeanAbsError, report.fRmsError, report.fMaxOutput, 100.0f * report.fArgmaxAgreement );
+}
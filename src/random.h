@@ -0,0 +1,230 @@
+/*=============================================================================
+
+MIT License
+
+Copyright (c) 2018 Ville Ruusutie
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+
+=============================================================================*/
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+//----------------------------------------------------------------------------
+
+// SplitMix64 step, turns any seed into well mixed 64-bit values
+inline uint64_t splitMix64( uint64_t& state )
+{
+	uint64_t value = ( state += 0x9e3779b97f4a7c15ull );
+	value = ( value ^ ( value >> 30 ) ) * 0xbf58476d1ce4e5b9ull;
+	value = ( value ^ ( value >> 27 ) ) * 0x94d049bb133111ebull;
+	return value ^ ( value >> 31 );
+}
+//----------------------------------------------------------------------------
+
+// PCG32 (XSH RR) by Melissa O'Neill: small state, fast, and good enough statistically
+// for shuffling. The same seed always gives the same sequence on every platform.
+struct Pcg32
+{
+	explicit Pcg32( uint64_t seed )
+		: m_state( 0 )
+	{
+		uint64_t seedState = seed;
+		m_increment = ( splitMix64( seedState ) << 1 ) | 1;
+		next();
+		m_state += splitMix64( seedState );
+		next();
+	}
+	//------------------------------------------------------------------------
+
+	uint32_t next()
+	{
+		const uint64_t state = m_state;
+		m_state = state * 6364136223846793005ull + m_increment;
+		const uint32_t xorShifted = uint32_t( ( ( state >> 18 ) ^ state ) >> 27 );
+		const uint32_t rotation = uint32_t( state >> 59 );
+		return ( xorShifted >> rotation ) | ( xorShifted << ( ( 32 - rotation ) & 31 ) );
+	}
+	//------------------------------------------------------------------------
+
+	// Uniform in [ 0, bound ), bound must not be 0. Rejects draws above the next
+	// power of two minus one, so there is no modulo bias.
+	size_t nextBelow( size_t bound )
+	{
+		uint64_t mask = uint64_t( bound ) - 1;
+		mask |= mask >> 1;
+		mask |= mask >> 2;
+		mask |= mask >> 4;
+		mask |= mask >> 8;
+		mask |= mask >> 16;
+		mask |= mask >> 32;
+		for( ;; )
+		{
+			uint64_t value = next();
+			if( mask > 0xffffffffull )
+			{
+				value |= uint64_t( next() ) << 32;
+			}
+			value &= mask;
+			if( value < bound )
+			{
+				return size_t( value );
+			}
+		}
+	}
+	//------------------------------------------------------------------------
+
+private:
+	uint64_t	m_state;
+	uint64_t	m_increment;
+};
+//----------------------------------------------------------------------------
+
+// Fills pOrder with a permutation of [ 0, count ) that visits blocks of blockSize
+// contiguous indices in random order and shuffles the indices within each block. A pass
+// in this order touches memory one block at a time, so with a block that fits in cache
+// the reads stay local while every block and every sample still moves each epoch.
+// blockSize of count or more gives a full Fisher-Yates shuffle.
+inline void blockedPermutation( size_t* pOrder, size_t count, size_t blockSize, Pcg32& random )
+{
+	if( count == 0 )
+	{
+		return;
+	}
+	blockSize = blockSize == 0 || blockSize > count ? count : blockSize;
+	const size_t blockCount = ( count + blockSize - 1 ) / blockSize;
+
+	// Shuffle the block starts in the front of pOrder, then expand them back to front so
+	// no start is overwritten before it is read
+	for( size_t b = 0; b < blockCount; ++b )
+	{
+		pOrder[ b ] = b;
+	}
+	for( size_t b = blockCount; b > 1; --b )
+	{
+		const size_t other = random.nextBelow( b );
+		const size_t block = pOrder[ b - 1 ];
+		pOrder[ b - 1 ] = pOrder[ other ];
+		pOrder[ other ] = block;
+	}
+
+	// A short last block lands wherever it was shuffled to, so positions come from a
+	// running offset rather than b * blockSize
+	size_t end = count;
+	for( size_t b = blockCount; b-- > 0; )
+	{
+		const size_t first = pOrder[ b ] * blockSize;
+		const size_t size = first + blockSize < count ? blockSize : count - first;
+		end -= size;
+		size_t* pBlock = &pOrder[ end ];
+		for( size_t i = 0; i < size; ++i )
+		{
+			pBlock[ i ] = first + i;
+		}
+		for( size_t i = size; i > 1; --i )
+		{
+			const size_t other = random.nextBelow( i );
+			const size_t index = pBlock[ i - 1 ];
+			pBlock[ i - 1 ] = pBlock[ other ];
+			pBlock[ other ] = index;
+		}
+	}
+}
+//----------------------------------------------------------------------------
+
+// Philox4x32-10 by Salmon et al., "Parallel random numbers: as easy as 1, 2, 3".
+// Counter based: the output is a pure function of a 128-bit counter and a 64-bit key,
+// so any element of a stream can be computed without generating the ones before it.
+constexpr uint32_t s_philoxM0 = 0xd2511f53;
+constexpr uint32_t s_philoxM1 = 0xcd9e8d57;
+constexpr uint32_t s_philoxW0 = 0x9e3779b9;
+constexpr uint32_t s_philoxW1 = 0xbb67ae85;
+
+inline void philox4x32( uint32_t* pCounter, uint32_t key0, uint32_t key1 )
+{
+	for( int round = 0; round < 10; ++round )
+	{
+		const uint64_t product0 = uint64_t( s_philoxM0 ) * pCounter[ 0 ];
+		const uint64_t product1 = uint64_t( s_philoxM1 ) * pCounter[ 2 ];
+		const uint32_t counter1 = pCounter[ 1 ];
+		const uint32_t counter3 = pCounter[ 3 ];
+		pCounter[ 0 ] = uint32_t( product1 >> 32 ) ^ counter1 ^ key0;
+		pCounter[ 1 ] = uint32_t( product1 );
+		pCounter[ 2 ] = uint32_t( product0 >> 32 ) ^ counter3 ^ key1;
+		pCounter[ 3 ] = uint32_t( product0 );
+		key0 += s_philoxW0;
+		key1 += s_philoxW1;
+	}
+}
+//----------------------------------------------------------------------------
+
+// Element order of a Philox stream. Elements come in groups of 16 blocks: element e
+// is word ( e % 64 ) / 16 of block ( e / 64 ) * 16 + e % 16. Vector kernels of any
+// width then load whole words of consecutive blocks with no transpose, and every
+// instruction set and thread split produces the same values.
+constexpr size_t s_philoxGroupBlockCount = 16;
+constexpr size_t s_philoxGroupSize = 4 * s_philoxGroupBlockCount;
+
+// Top 24 bits of a random word as a float in [ -1, 1 ) times fScale. The product is
+// the only rounding, so the vector kernels match bit for bit.
+inline float philoxToFloat( uint32_t word, float fScale )
+{
+	return float( int32_t( word >> 8 ) - 0x800000 ) * ( fScale * ( 1.0f / 8388608.0f ) );
+}
+
+inline float philoxUniformAt( uint64_t seed, uint64_t stream, uint64_t element, float fScale )
+{
+	const uint64_t group = element / s_philoxGroupSize;
+	const size_t offset = size_t( element % s_philoxGroupSize );
+	const uint64_t block = group * s_philoxGroupBlockCount + offset % s_philoxGroupBlockCount;
+	uint32_t counter[ 4 ] = { uint32_t( block ), uint32_t( block >> 32 ), uint32_t( stream ), uint32_t( stream >> 32 ) };
+	philox4x32( counter, uint32_t( seed ), uint32_t( seed >> 32 ) );
+	return philoxToFloat( counter[ offset / s_philoxGroupBlockCount ], fScale );
+}
+//----------------------------------------------------------------------------
+
+// Elements [ first, first + count ) of the stream ( seed, stream ) as uniform floats in
+// [ -fScale, fScale ). Reference for Kernels::uniform.
+inline void philoxUniform( uint64_t seed, uint64_t stream, uint64_t first, float* pValues, size_t count, float fScale )
+{
+	size_t i = 0;
+	for( ; i < count && ( first + i ) % s_philoxGroupSize != 0; ++i )
+	{
+		pValues[ i ] = philoxUniformAt( seed, stream, first + i, fScale );
+	}
+	for( ; i + s_philoxGroupSize <= count; i += s_philoxGroupSize )
+	{
+		const uint64_t block = ( first + i ) / 4;
+		for( size_t b = 0; b < s_philoxGroupBlockCount; ++b )
+		{
+			uint32_t counter[ 4 ] = { uint32_t( block + b ), uint32_t( ( block + b ) >> 32 ), uint32_t( stream ), uint32_t( stream >> 32 ) };
+			philox4x32( counter, uint32_t( seed ), uint32_t( seed >> 32 ) );
+			for( size_t word = 0; word < 4; ++word )
+			{
+				pValues[ i + word * s_philoxGroupBlockCount + b ] = philoxToFloat( counter[ word ], fScale );
+			}
+		}
+	}
+	for( ; i < count; ++i )
+	{
+		pValues[ i ] = philoxUniformAt( seed, stream, first + i, fScale );
+	}
+}
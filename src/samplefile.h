@@ -0,0 +1,419 @@
+/*=============================================================================
+
+MIT License
+
+Copyright (c) 2018 Ville Ruusutie
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+
+=============================================================================*/
+
+#pragma once
+
+#include "dataset.h"
+#include "mappedfile.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <vector>
+//----------------------------------------------------------------------------
+
+// IEEE half precision conversion, rounding to nearest even
+inline uint16_t floatToHalf( float fValue )
+{
+	uint32_t bits;
+	memcpy( &bits, &fValue, sizeof( bits ) );
+	const uint32_t sign = ( bits >> 16 ) & 0x8000;
+	const uint32_t absBits = bits & 0x7fffffff;
+
+	if( absBits >= 0x7f800000 )
+	{
+		// Infinity stays infinity, NaN stays a quiet NaN
+		return uint16_t( sign | 0x7c00 | ( absBits > 0x7f800000 ? 0x200 : 0 ) );
+	}
+	if( absBits >= 0x477ff000 )
+	{
+		// 65520 and above round past the largest half
+		return uint16_t( sign | 0x7c00 );
+	}
+	if( absBits >= 0x38800000 )
+	{
+		// Normal: rebias the exponent and round away the low 13 mantissa bits
+		return uint16_t( sign | ( ( absBits - 0x38000000 + 0xfff + ( ( absBits >> 13 ) & 1 ) ) >> 13 ) );
+	}
+	if( absBits < 0x33000000 )
+	{
+		// Up to half the smallest subnormal rounds to zero
+		return uint16_t( sign );
+	}
+
+	// Subnormal: the result counts units of 2^-24
+	const uint32_t mantissa = ( absBits & 0x7fffff ) | 0x800000;
+	const uint32_t shift = 126 - ( absBits >> 23 );
+	uint32_t halfBits = mantissa >> shift;
+	const uint32_t remainder = mantissa & ( ( 1u << shift ) - 1 );
+	const uint32_t halfway = 1u << ( shift - 1 );
+	if( remainder > halfway || ( remainder == halfway && ( halfBits & 1 ) != 0 ) )
+	{
+		++halfBits;
+	}
+	return uint16_t( sign | halfBits );
+}
+//----------------------------------------------------------------------------
+
+inline float halfToFloat( uint16_t value )
+{
+	const uint32_t sign = uint32_t( value & 0x8000 ) << 16;
+	const uint32_t exponent = ( value >> 10 ) & 0x1f;
+	const uint32_t mantissa = value & 0x3ff;
+
+	uint32_t bits;
+	if( exponent == 0x1f )
+	{
+		// NaNs come out quiet, like the hardware conversion
+		bits = sign | 0x7f800000 | ( mantissa << 13 ) | ( mantissa != 0 ? 0x400000 : 0 );
+	}
+	else if( exponent != 0 )
+	{
+		bits = sign | ( ( exponent + 112 ) << 23 ) | ( mantissa << 13 );
+	}
+	else
+	{
+		// Zero or subnormal, exact in float
+		const float fMagnitude = float( mantissa ) * ( 1.0f / 16777216.0f );
+		memcpy( &bits, &fMagnitude, sizeof( bits ) );
+		bits |= sign;
+	}
+
+	float fValue;
+	memcpy( &fValue, &bits, sizeof( fValue ) );
+	return fValue;
+}
+//----------------------------------------------------------------------------
+
+enum SampleStorage
+{
+	SampleStorage_Float32,
+	SampleStorage_Float16
+};
+//----------------------------------------------------------------------------
+
+// Sample file layout, all little-endian:
+//   SampleFileHeader
+//   inputs[ sampleCount ][ inputCount ] at inputsOffset
+//   outputs[ sampleCount ][ outputCount ] at outputsOffset
+// Both blocks start on a 64 byte boundary and hold tightly packed rows of float32 or
+// float16. With float32 storage the mapped blocks are exactly the row-major arrays
+// NeuralNet::train takes, so training indexes them with no parsing or copying.
+constexpr uint32_t s_sampleFileMagic = 0x44534e4e; // "NNSD"
+constexpr uint32_t s_sampleFileVersion = 1;
+constexpr size_t s_sampleFileAlignment = 64;
+
+struct SampleFileHeader
+{
+	uint32_t	magic;
+	uint32_t	version;
+	uint32_t	storage;
+	uint32_t	inputCount;
+	uint32_t	outputCount;
+	uint32_t	reserved;
+	uint64_t	sampleCount;
+	uint64_t	inputsOffset;
+	uint64_t	outputsOffset;
+};
+static_assert( sizeof( SampleFileHeader ) == 48, "sample file header must not contain padding" );
+//----------------------------------------------------------------------------
+
+inline size_t getSampleStorageSize( SampleStorage storage )
+{
+	return storage == SampleStorage_Float16 ? sizeof( uint16_t ) : sizeof( float );
+}
+//----------------------------------------------------------------------------
+
+inline uint64_t alignSampleFileOffset( uint64_t offset )
+{
+	return ( offset + s_sampleFileAlignment - 1 ) / s_sampleFileAlignment * s_sampleFileAlignment;
+}
+//----------------------------------------------------------------------------
+
+inline bool seekFile( FILE* pFile, uint64_t offset )
+{
+#if defined(WIN32) || defined(__WIN32) || defined(__WIN32__) || defined(WIN64)
+	return _fseeki64( pFile, int64_t( offset ), SEEK_SET ) == 0;
+#else
+	return fseeko( pFile, off_t( offset ), SEEK_SET ) == 0;
+#endif
+}
+//----------------------------------------------------------------------------
+
+// Writes a sample file one sample at a time. The sample count has to be known up
+// front; the inputs and the outputs blocks are each written sequentially through
+// their own handle.
+struct SampleFileWriter
+{
+	SampleFileWriter()
+		: m_pInputsFile( nullptr )
+		, m_pOutputsFile( nullptr )
+		, m_writtenCount( 0 )
+	{
+	}
+	//------------------------------------------------------------------------
+
+	~SampleFileWriter()
+	{
+		close();
+	}
+	//------------------------------------------------------------------------
+
+	bool open( const char* strPath, size_t inputCount, size_t outputCount, size_t sampleCount, SampleStorage storage )
+	{
+		close();
+		const uint64_t elementSize = getSampleStorageSize( storage );
+		m_header.magic = s_sampleFileMagic;
+		m_header.version = s_sampleFileVersion;
+		m_header.storage = uint32_t( storage );
+		m_header.inputCount = uint32_t( inputCount );
+		m_header.outputCount = uint32_t( outputCount );
+		m_header.reserved = 0;
+		m_header.sampleCount = sampleCount;
+		m_header.inputsOffset = alignSampleFileOffset( sizeof( SampleFileHeader ) );
+		m_header.outputsOffset = alignSampleFileOffset( m_header.inputsOffset + sampleCount * inputCount * elementSize );
+		m_writtenCount = 0;
+
+		const char padding[ s_sampleFileAlignment ] = {};
+		m_pInputsFile = fopen( strPath, "wb" );
+		if( m_pInputsFile == nullptr
+			|| fwrite( &m_header, sizeof( m_header ), 1, m_pInputsFile ) != 1
+			|| fwrite( padding, 1, size_t( m_header.inputsOffset ) - sizeof( m_header ), m_pInputsFile ) != size_t( m_header.inputsOffset ) - sizeof( m_header )
+			|| fflush( m_pInputsFile ) != 0 )
+		{
+			close();
+			return false;
+		}
+		m_pOutputsFile = fopen( strPath, "r+b" );
+		if( m_pOutputsFile == nullptr || !seekFile( m_pOutputsFile, m_header.outputsOffset ) )
+		{
+			close();
+			return false;
+		}
+		return true;
+	}
+	//------------------------------------------------------------------------
+
+	bool write( const float* pInputs, const float* pOutputs )
+	{
+		if( m_writtenCount == m_header.sampleCount )
+		{
+			return false;
+		}
+		++m_writtenCount;
+		return writeRow( m_pInputsFile, pInputs, m_header.inputCount ) && writeRow( m_pOutputsFile, pOutputs, m_header.outputCount );
+	}
+	//------------------------------------------------------------------------
+
+	// Fails unless every sample announced to open was written
+	bool close()
+	{
+		bool bSuccess = m_pInputsFile != nullptr && m_pOutputsFile != nullptr && m_writtenCount == m_header.sampleCount;
+		if( m_pInputsFile != nullptr )
+		{
+			bSuccess = ( fclose( m_pInputsFile ) == 0 ) && bSuccess;
+			m_pInputsFile = nullptr;
+		}
+		if( m_pOutputsFile != nullptr )
+		{
+			bSuccess = ( fclose( m_pOutputsFile ) == 0 ) && bSuccess;
+			m_pOutputsFile = nullptr;
+		}
+		return bSuccess;
+	}
+	//------------------------------------------------------------------------
+
+private:
+	SampleFileWriter( const SampleFileWriter& ) = delete;
+	SampleFileWriter& operator=( const SampleFileWriter& ) = delete;
+
+	bool writeRow( FILE* pFile, const float* pValues, size_t count )
+	{
+		if( m_header.storage == SampleStorage_Float32 )
+		{
+			return fwrite( pValues, sizeof( float ), count, pFile ) == count;
+		}
+		for( size_t i = 0; i < count; ++i )
+		{
+			const uint16_t value = floatToHalf( pValues[ i ] );
+			if( fwrite( &value, sizeof( value ), 1, pFile ) != 1 )
+			{
+				return false;
+			}
+		}
+		return true;
+	}
+	//------------------------------------------------------------------------
+
+	SampleFileHeader m_header;
+	FILE*	m_pInputsFile;
+	FILE*	m_pOutputsFile;
+	size_t	m_writtenCount;
+};
+//----------------------------------------------------------------------------
+
+// Memory-mapped sample file usable wherever a StreamingDataset is. Float32 files are
+// handed out as a single chunk pointing into the mapping, float16 files are widened
+// chunk by chunk into a buffer.
+struct MappedSampleFile
+{
+	MappedSampleFile()
+		: m_chunkSampleCount( 0 )
+		, m_nextSample( 0 )
+	{
+	}
+	//------------------------------------------------------------------------
+
+	bool open( const char* strPath, size_t chunkSampleCount = 65536 )
+	{
+		close();
+		if( chunkSampleCount == 0 )
+		{
+			return false;
+		}
+		if( !m_file.open( strPath ) || !validate() )
+		{
+			close();
+			return false;
+		}
+		m_chunkSampleCount = chunkSampleCount;
+		m_nextSample = 0;
+		if( getStorage() == SampleStorage_Float16 )
+		{
+			m_inputs.resize( chunkSampleCount * getInputCount() );
+			m_outputs.resize( chunkSampleCount * getOutputCount() );
+		}
+		return true;
+	}
+	//------------------------------------------------------------------------
+
+	void close()
+	{
+		m_file.close();
+		m_inputs.clear();
+		m_outputs.clear();
+	}
+	//------------------------------------------------------------------------
+
+	void rewind()
+	{
+		m_nextSample = 0;
+	}
+	//------------------------------------------------------------------------
+
+	bool next( DataChunk& chunk )
+	{
+		const size_t sampleCount = getSampleCount();
+		if( m_nextSample == sampleCount )
+		{
+			return false;
+		}
+
+		if( getStorage() == SampleStorage_Float32 )
+		{
+			chunk.pInputs = getInputs();
+			chunk.pOutputs = getOutputs();
+			chunk.sampleCount = sampleCount;
+			m_nextSample = sampleCount;
+			return true;
+		}
+
+		const size_t remainingCount = sampleCount - m_nextSample;
+		const size_t chunkCount = remainingCount < m_chunkSampleCount ? remainingCount : m_chunkSampleCount;
+		widen( m_nextSample * getInputCount(), chunkCount * getInputCount(), getHeader().inputsOffset, &m_inputs[ 0 ] );
+		widen( m_nextSample * getOutputCount(), chunkCount * getOutputCount(), getHeader().outputsOffset, &m_outputs[ 0 ] );
+		chunk.pInputs = &m_inputs[ 0 ];
+		chunk.pOutputs = &m_outputs[ 0 ];
+		chunk.sampleCount = chunkCount;
+		m_nextSample += chunkCount;
+		return true;
+	}
+	//------------------------------------------------------------------------
+
+	// Reads never fail once the file is mapped, unlike StreamingDataset
+	bool hasFailed() const					{ return false; }
+	//------------------------------------------------------------------------
+
+	const SampleFileHeader& getHeader() const	{ return *( const SampleFileHeader* )m_file.getData(); }
+	SampleStorage getStorage() const		{ return SampleStorage( getHeader().storage ); }
+	size_t getInputCount() const			{ return getHeader().inputCount; }
+	size_t getOutputCount() const			{ return getHeader().outputCount; }
+	size_t getSampleCount() const			{ return size_t( getHeader().sampleCount ); }
+	// Row-major blocks inside the mapping, only for float32 storage
+	const float* getInputs() const			{ return getStorage() == SampleStorage_Float32 ? ( const float* )getBlock( getHeader().inputsOffset ) : nullptr; }
+	const float* getOutputs() const			{ return getStorage() == SampleStorage_Float32 ? ( const float* )getBlock( getHeader().outputsOffset ) : nullptr; }
+	//------------------------------------------------------------------------
+
+private:
+	MappedSampleFile( const MappedSampleFile& ) = delete;
+	MappedSampleFile& operator=( const MappedSampleFile& ) = delete;
+
+	const char* getBlock( uint64_t offset ) const
+	{
+		return ( const char* )m_file.getData() + offset;
+	}
+	//------------------------------------------------------------------------
+
+	void widen( size_t first, size_t count, uint64_t blockOffset, float* pValues ) const
+	{
+		const uint16_t* pHalves = ( const uint16_t* )getBlock( blockOffset ) + first;
+		for( size_t i = 0; i < count; ++i )
+		{
+			pValues[ i ] = halfToFloat( pHalves[ i ] );
+		}
+	}
+	//------------------------------------------------------------------------
+
+	// Both blocks must lie inside the file, in order and aligned
+	bool validate() const
+	{
+		if( m_file.getSize() < sizeof( SampleFileHeader ) )
+		{
+			return false;
+		}
+		const SampleFileHeader& header = getHeader();
+		if( header.magic != s_sampleFileMagic || header.version != s_sampleFileVersion
+			|| header.storage > SampleStorage_Float16 || header.inputCount == 0 || header.outputCount == 0
+			|| header.inputsOffset % s_sampleFileAlignment != 0 || header.outputsOffset % s_sampleFileAlignment != 0
+			|| header.inputsOffset < sizeof( SampleFileHeader ) || header.outputsOffset < header.inputsOffset )
+		{
+			return false;
+		}
+		const uint64_t elementSize = getSampleStorageSize( SampleStorage( header.storage ) );
+		const uint64_t maxSampleCount = m_file.getSize() / ( elementSize * ( uint64_t( header.inputCount ) + header.outputCount ) );
+		return header.sampleCount <= maxSampleCount
+			&& header.inputsOffset + header.sampleCount * header.inputCount * elementSize <= header.outputsOffset
+			&& header.outputsOffset <= m_file.getSize()
+			&& header.sampleCount * header.outputCount * elementSize <= m_file.getSize() - header.outputsOffset;
+	}
+	//------------------------------------------------------------------------
+
+	MappedFile	m_file;
+	size_t	m_chunkSampleCount;
+	size_t	m_nextSample;
+	std::vector< float > m_inputs;
+	std::vector< float > m_outputs;
+};
@@ -0,0 +1,753 @@
+/*=============================================================================
+
+MIT License
+
+Copyright (c) 2018 Ville Ruusutie
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+
+=============================================================================*/
+
+#pragma once
+
+#include "random.h"
+#include "transfer.h"
+
+#include <limits>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#if defined( __x86_64__ ) || defined( __i386__ ) || defined( _M_X64 ) || defined( _M_IX86 )
+	#define NN_SIMD_X86 1
+	#include <immintrin.h>
+	#if defined( _MSC_VER )
+		#include <intrin.h>
+	#else
+		#include <cpuid.h>
+	#endif
+#else
+	#define NN_SIMD_X86 0
+#endif
+//----------------------------------------------------------------------------
+
+// Instruction set levels with their own kernel implementations, in ascending order
+enum SimdLevel
+{
+	SimdLevel_Scalar,
+	SimdLevel_SSE42,
+	SimdLevel_AVX2,
+	SimdLevel_AVX512,
+	SimdLevel_Count
+};
+//----------------------------------------------------------------------------
+
+// Coefficients of one optimizer update, see Kernels::momentum. Gradients point downhill
+// like the deltas do, so every update adds to the parameters.
+struct OptimizerStep
+{
+	float	fLearningRate;
+	// Gradients are multiplied by this first, 1 / batchCount for summed gradients
+	float	fGradientScale;
+	// Velocity decay of momentum, first moment decay of Adam
+	float	fMomentum;
+	// Squared gradient decay of RMSProp and Adam
+	float	fDecay;
+	float	fEpsilon;
+	// Adam bias corrections 1 / ( 1 - decay^step ) of the first and second moment
+	float	fCorrection1;
+	float	fCorrection2;
+	bool	bNesterov;
+};
+//----------------------------------------------------------------------------
+
+// Table of inner loop kernels for one instruction set level
+struct Kernels
+{
+	SimdLevel	level;
+	const char*	strName;
+
+	// Returns sum of pA[ i ] * pB[ i ]
+	float		( *dot )( const float* pA, const float* pB, size_t count );
+	// pY[ i ] += fScale * pX[ i ]
+	void		( *axpy )( float fScale, const float* pX, float* pY, size_t count );
+	// dot with pA in bfloat16, products and sums in float
+	float		( *dotBf16 )( const uint16_t* pA, const float* pB, size_t count );
+	// Rounds to bfloat16, nearest even, see floatToBf16
+	void		( *toBf16 )( const float* pValues, uint16_t* pBf16, size_t count );
+	// Returns sum of pA[ i ] * pB[ i ] for int8 inference. pA must stay below 128 so two
+	// products always fit the 16-bit pair sums of maddubs; the result is exact everywhere.
+	int32_t		( *dotU8S8 )( const uint8_t* pA, const int8_t* pB, size_t count );
+
+	// Transfer functions applied in place to a whole array. The derivative kernels
+	// multiply pDeltas[ i ] by the derivative evaluated at pValues[ i ]. Vector levels
+	// use the polynomial exp and log in simd_kernels.inl, the scalar level uses libm.
+	void		( *sigmoid )( float* pValues, size_t count );
+	void		( *sigmoidDerivative )( const float* pValues, float* pDeltas, size_t count );
+	void		( *relu )( float* pValues, size_t count );
+	void		( *reluDerivative )( const float* pValues, float* pDeltas, size_t count );
+	void		( *softplus )( float* pValues, size_t count );
+	void		( *softplusDerivative )( const float* pValues, float* pDeltas, size_t count );
+	void		( *elu )( float* pValues, size_t count );
+	void		( *eluDerivative )( const float* pValues, float* pDeltas, size_t count );
+	// exp and log in place, what the transfer functions are built on. exp clamps to
+	// [ -87.3, 88.3 ] on vector levels, log takes positive normal floats.
+	void		( *exp )( float* pValues, size_t count );
+	void		( *log )( float* pValues, size_t count );
+
+	// Philox stream elements [ first, first + count ) as floats in [ -fScale, fScale ),
+	// identical on every level, see philoxUniform
+	void		( *uniform )( uint64_t seed, uint64_t stream, uint64_t first, float* pValues, size_t count, float fScale );
+
+	// Optimizer updates in one pass over parameters, gradients and the optimizer state,
+	// all laid out alike. g is pGradients[ i ] * fGradientScale.
+	//   momentum  v = fMomentum * v + g, p += fLearningRate * v, or with bNesterov
+	//             p += fLearningRate * ( g + fMomentum * v ). pState1 is unused.
+	//   rmsprop   s = fDecay * s + ( 1 - fDecay ) * g^2, p += fLearningRate * g / ( sqrt( s ) + fEpsilon ).
+	//             pState1 is unused.
+	//   adam      m and v are decayed averages of g and g^2 in pState0 and pState1,
+	//             p += fLearningRate * m * fCorrection1 / ( sqrt( v * fCorrection2 ) + fEpsilon )
+	void		( *momentum )( const OptimizerStep& step, float* pParameters, const float* pGradients, float* pState0, float* pState1, size_t count );
+	void		( *rmsprop )( const OptimizerStep& step, float* pParameters, const float* pGradients, float* pState0, float* pState1, size_t count );
+	void		( *adam )( const OptimizerStep& step, float* pParameters, const float* pGradients, float* pState0, float* pState1, size_t count );
+};
+//----------------------------------------------------------------------------
+
+// bfloat16 is the upper half of a float: same exponent range, 8 bits of precision.
+// Converting up is a shift, so no instruction set needs native support for it.
+inline float bf16ToFloat( uint16_t value )
+{
+	const uint32_t bits = uint32_t( value ) << 16;
+	float fValue;
+	memcpy( &fValue, &bits, sizeof( fValue ) );
+	return fValue;
+}
+//----------------------------------------------------------------------------
+
+// Round to nearest even, overflowing to infinity. Every NaN becomes the quiet NaN 0x7fc0.
+inline uint16_t floatToBf16( float fValue )
+{
+	if( fValue != fValue )
+	{
+		return 0x7fc0;
+	}
+	uint32_t bits;
+	memcpy( &bits, &fValue, sizeof( bits ) );
+	bits += 0x7fff + ( ( bits >> 16 ) & 1 );
+	return uint16_t( bits >> 16 );
+}
+//----------------------------------------------------------------------------
+
+// Scalar fallback. Several independent accumulators let the compiler overlap the
+// multiply-adds without reassociating a single running sum.
+namespace simd_scalar
+{
+	inline float dot( const float* pA, const float* pB, size_t count )
+	{
+		float fSum0 = 0.0f;
+		float fSum1 = 0.0f;
+		float fSum2 = 0.0f;
+		float fSum3 = 0.0f;
+		size_t i = 0;
+		for( ; i + 4 <= count; i += 4 )
+		{
+			fSum0 += pA[ i + 0 ] * pB[ i + 0 ];
+			fSum1 += pA[ i + 1 ] * pB[ i + 1 ];
+			fSum2 += pA[ i + 2 ] * pB[ i + 2 ];
+			fSum3 += pA[ i + 3 ] * pB[ i + 3 ];
+		}
+		for( ; i < count; ++i )
+		{
+			fSum0 += pA[ i ] * pB[ i ];
+		}
+		return ( fSum0 + fSum1 ) + ( fSum2 + fSum3 );
+	}
+	//------------------------------------------------------------------------
+
+	inline void axpy( float fScale, const float* pX, float* pY, size_t count )
+	{
+		for( size_t i = 0; i < count; ++i )
+		{
+			pY[ i ] += fScale * pX[ i ];
+		}
+	}
+	//------------------------------------------------------------------------
+
+	inline float dotBf16( const uint16_t* pA, const float* pB, size_t count )
+	{
+		float fSum0 = 0.0f;
+		float fSum1 = 0.0f;
+		float fSum2 = 0.0f;
+		float fSum3 = 0.0f;
+		size_t i = 0;
+		for( ; i + 4 <= count; i += 4 )
+		{
+			fSum0 += bf16ToFloat( pA[ i + 0 ] ) * pB[ i + 0 ];
+			fSum1 += bf16ToFloat( pA[ i + 1 ] ) * pB[ i + 1 ];
+			fSum2 += bf16ToFloat( pA[ i + 2 ] ) * pB[ i + 2 ];
+			fSum3 += bf16ToFloat( pA[ i + 3 ] ) * pB[ i + 3 ];
+		}
+		for( ; i < count; ++i )
+		{
+			fSum0 += bf16ToFloat( pA[ i ] ) * pB[ i ];
+		}
+		return ( fSum0 + fSum1 ) + ( fSum2 + fSum3 );
+	}
+	//------------------------------------------------------------------------
+
+	inline void toBf16( const float* pValues, uint16_t* pBf16, size_t count )
+	{
+		for( size_t i = 0; i < count; ++i )
+		{
+			pBf16[ i ] = floatToBf16( pValues[ i ] );
+		}
+	}
+	//------------------------------------------------------------------------
+
+	inline int32_t dotU8S8( const uint8_t* pA, const int8_t* pB, size_t count )
+	{
+		int32_t sum = 0;
+		for( size_t i = 0; i < count; ++i )
+		{
+			sum += int32_t( pA[ i ] ) * int32_t( pB[ i ] );
+		}
+		return sum;
+	}
+	//------------------------------------------------------------------------
+
+	// Exact transfer functions using libm
+	template< float ( *Function )( float ) >
+	inline void transform( float* pValues, size_t count )
+	{
+		for( size_t i = 0; i < count; ++i )
+		{
+			pValues[ i ] = Function( pValues[ i ] );
+		}
+	}
+	//------------------------------------------------------------------------
+
+	template< float ( *Derivative )( float ) >
+	inline void multiplyDerivative( const float* pValues, float* pDeltas, size_t count )
+	{
+		for( size_t i = 0; i < count; ++i )
+		{
+			pDeltas[ i ] *= Derivative( pValues[ i ] );
+		}
+	}
+	//------------------------------------------------------------------------
+
+	inline void sigmoid( float* pValues, size_t count )											{ transform< ::sigmoid >( pValues, count ); }
+	inline void sigmoidDerivative( const float* pValues, float* pDeltas, size_t count )		{ multiplyDerivative< ::sigmoidDerivative >( pValues, pDeltas, count ); }
+	inline void relu( float* pValues, size_t count )											{ transform< ::relu >( pValues, count ); }
+	inline void reluDerivative( const float* pValues, float* pDeltas, size_t count )			{ multiplyDerivative< ::reluDerivative >( pValues, pDeltas, count ); }
+	inline void softplus( float* pValues, size_t count )										{ transform< ::softplus >( pValues, count ); }
+	inline void softplusDerivative( const float* pValues, float* pDeltas, size_t count )		{ multiplyDerivative< ::softplusDerivative >( pValues, pDeltas, count ); }
+	inline void elu( float* pValues, size_t count )												{ transform< ::elu >( pValues, count ); }
+	inline void eluDerivative( const float* pValues, float* pDeltas, size_t count )			{ multiplyDerivative< ::eluDerivative >( pValues, pDeltas, count ); }
+	inline void exp( float* pValues, size_t count )												{ transform< ::expf >( pValues, count ); }
+	inline void log( float* pValues, size_t count )												{ transform< ::logf >( pValues, count ); }
+	inline void uniform( uint64_t seed, uint64_t stream, uint64_t first, float* pValues, size_t count, float fScale )	{ philoxUniform( seed, stream, first, pValues, count, fScale ); }
+	//------------------------------------------------------------------------
+
+	// Optimizer references, the vector levels use them for their tails
+	inline void momentum( const OptimizerStep& step, float* pParameters, const float* pGradients, float* pVelocity, float*, size_t count )
+	{
+		for( size_t i = 0; i < count; ++i )
+		{
+			const float fGradient = pGradients[ i ] * step.fGradientScale;
+			pVelocity[ i ] = step.fMomentum * pVelocity[ i ] + fGradient;
+			pParameters[ i ] += step.fLearningRate * ( step.bNesterov ? fGradient + step.fMomentum * pVelocity[ i ] : pVelocity[ i ] );
+		}
+	}
+	//------------------------------------------------------------------------
+
+	inline void rmsprop( const OptimizerStep& step, float* pParameters, const float* pGradients, float* pSquares, float*, size_t count )
+	{
+		for( size_t i = 0; i < count; ++i )
+		{
+			const float fGradient = pGradients[ i ] * step.fGradientScale;
+			pSquares[ i ] = step.fDecay * pSquares[ i ] + ( 1.0f - step.fDecay ) * fGradient * fGradient;
+			pParameters[ i ] += step.fLearningRate * fGradient / ( sqrtf( pSquares[ i ] ) + step.fEpsilon );
+		}
+	}
+	//------------------------------------------------------------------------
+
+	inline void adam( const OptimizerStep& step, float* pParameters, const float* pGradients, float* pMeans, float* pSquares, size_t count )
+	{
+		for( size_t i = 0; i < count; ++i )
+		{
+			const float fGradient = pGradients[ i ] * step.fGradientScale;
+			pMeans[ i ] = step.fMomentum * pMeans[ i ] + ( 1.0f - step.fMomentum ) * fGradient;
+			pSquares[ i ] = step.fDecay * pSquares[ i ] + ( 1.0f - step.fDecay ) * fGradient * fGradient;
+			pParameters[ i ] += step.fLearningRate * step.fCorrection1 * pMeans[ i ] / ( sqrtf( pSquares[ i ] * step.fCorrection2 ) + step.fEpsilon );
+		}
+	}
+}
+//----------------------------------------------------------------------------
+
+// Vector kernels are written once in simd_kernels.inl against a small set of
+// wrappers and compiled for each instruction set with a function target region,
+// so the rest of the program does not need to be built with -mavx2 and friends.
+#if NN_SIMD_X86
+
+#if defined( __clang__ )
+	#pragma clang attribute push( __attribute__(( target( "sse4.2" ) )), apply_to = function )
+#elif defined( __GNUC__ )
+	#pragma GCC push_options
+	#pragma GCC target( "sse4.2" )
+#endif
+
+namespace simd_sse42
+{
+	typedef __m128 VFloat;
+	typedef __m128 VMask;
+	static const size_t s_width = 4;
+
+	inline VFloat vzero()									{ return _mm_setzero_ps(); }
+	inline VFloat vset1( float fValue )						{ return _mm_set1_ps( fValue ); }
+	inline VFloat vload( const float* pValues )				{ return _mm_loadu_ps( pValues ); }
+	inline void vstore( float* pValues, VFloat value )		{ _mm_storeu_ps( pValues, value ); }
+	inline VFloat vadd( VFloat a, VFloat b )				{ return _mm_add_ps( a, b ); }
+	inline VFloat vsub( VFloat a, VFloat b )				{ return _mm_sub_ps( a, b ); }
+	inline VFloat vmul( VFloat a, VFloat b )				{ return _mm_mul_ps( a, b ); }
+	inline VFloat vdiv( VFloat a, VFloat b )				{ return _mm_div_ps( a, b ); }
+	inline VFloat vsqrt( VFloat value )						{ return _mm_sqrt_ps( value ); }
+	inline VFloat vmin( VFloat a, VFloat b )				{ return _mm_min_ps( a, b ); }
+	inline VFloat vmax( VFloat a, VFloat b )				{ return _mm_max_ps( a, b ); }
+	inline VFloat vfmadd( VFloat a, VFloat b, VFloat c )	{ return _mm_add_ps( _mm_mul_ps( a, b ), c ); }
+	inline VFloat vround( VFloat value )					{ return _mm_round_ps( value, _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC ); }
+	inline VMask vless( VFloat a, VFloat b )				{ return _mm_cmplt_ps( a, b ); }
+	inline VFloat vselect( VMask mask, VFloat a, VFloat b )	{ return _mm_blendv_ps( b, a, mask ); }
+	inline float vhsum( VFloat value )
+	{
+		value = _mm_hadd_ps( value, value );
+		value = _mm_hadd_ps( value, value );
+		return _mm_cvtss_f32( value );
+	}
+	// 2^n for integral n in the normal exponent range
+	inline VFloat vpow2i( VFloat n )
+	{
+		return _mm_castsi128_ps( _mm_slli_epi32( _mm_add_epi32( _mm_cvtps_epi32( n ), _mm_set1_epi32( 127 ) ), 23 ) );
+	}
+	// Splits a positive normal value to mantissa in [0.5, 1) and exponent
+	inline VFloat vfrexp( VFloat value, VFloat* pExponent )
+	{
+		const __m128i bits = _mm_castps_si128( value );
+		*pExponent = _mm_cvtepi32_ps( _mm_sub_epi32( _mm_srli_epi32( bits, 23 ), _mm_set1_epi32( 126 ) ) );
+		return _mm_castsi128_ps( _mm_or_si128( _mm_and_si128( bits, _mm_set1_epi32( 0x007fffff ) ), _mm_set1_epi32( 0x3f000000 ) ) );
+	}
+
+	// 32-bit integer lanes for the Philox kernel
+	typedef __m128i VInt;
+	inline VInt viset1( uint32_t value )					{ return _mm_set1_epi32( int( value ) ); }
+	inline VInt viload( const uint32_t* pValues )			{ return _mm_loadu_si128( ( const __m128i* )pValues ); }
+	inline VInt viadd( VInt a, VInt b )						{ return _mm_add_epi32( a, b ); }
+	inline VInt vixor( VInt a, VInt b )						{ return _mm_xor_si128( a, b ); }
+	inline VInt vimullo( VInt a, VInt b )					{ return _mm_mullo_epi32( a, b ); }
+	// High halves of the unsigned 64-bit products, even and odd lanes multiplied separately
+	inline VInt vimulhi( VInt a, VInt b )
+	{
+		const __m128i even = _mm_mul_epu32( a, b );
+		const __m128i odd = _mm_mul_epu32( _mm_srli_epi64( a, 32 ), _mm_srli_epi64( b, 32 ) );
+		return _mm_blend_epi16( _mm_srli_epi64( even, 32 ), odd, 0xcc );
+	}
+	inline VFloat vitofloat( VInt value, int shift )		{ return _mm_cvtepi32_ps( _mm_srli_epi32( value, shift ) ); }
+
+	// bfloat16 conversion, s_width values at a time
+	inline VFloat vloadbf16( const uint16_t* pValues )		{ return _mm_castsi128_ps( _mm_slli_epi32( _mm_cvtepu16_epi32( _mm_loadl_epi64( ( const __m128i* )pValues ) ), 16 ) ); }
+	inline VInt vibits( VFloat value )						{ return _mm_castps_si128( value ); }
+	inline VInt visrl( VInt value, int shift )				{ return _mm_srli_epi32( value, shift ); }
+	inline VInt viand( VInt a, VInt b )						{ return _mm_and_si128( a, b ); }
+	inline VMask visnan( VFloat value )						{ return _mm_cmpunord_ps( value, value ); }
+	// Stores the low 16 bits of every lane, which must be the only bits set
+	inline void vistore16( uint16_t* pValues, VInt value )	{ _mm_storel_epi64( ( __m128i* )pValues, _mm_packus_epi32( value, value ) ); }
+
+	// acc + sums of four adjacent unsigned by signed byte products per lane
+	inline VInt vidpbusd( VInt acc, VInt a, VInt b )		{ return _mm_add_epi32( acc, _mm_madd_epi16( _mm_maddubs_epi16( a, b ), _mm_set1_epi16( 1 ) ) ); }
+	inline int32_t vihsum( VInt value )
+	{
+		value = _mm_add_epi32( value, _mm_shuffle_epi32( value, 0x4e ) );
+		value = _mm_add_epi32( value, _mm_shuffle_epi32( value, 0xb1 ) );
+		return _mm_cvtsi128_si32( value );
+	}
+
+	#include "simd_kernels.inl"
+}
+
+#if defined( __clang__ )
+	#pragma clang attribute pop
+	#pragma clang attribute push( __attribute__(( target( "avx2,fma" ) )), apply_to = function )
+#elif defined( __GNUC__ )
+	#pragma GCC pop_options
+	#pragma GCC push_options
+	#pragma GCC target( "avx2,fma" )
+#endif
+
+namespace simd_avx2
+{
+	typedef __m256 VFloat;
+	typedef __m256 VMask;
+	static const size_t s_width = 8;
+
+	inline VFloat vzero()									{ return _mm256_setzero_ps(); }
+	inline VFloat vset1( float fValue )						{ return _mm256_set1_ps( fValue ); }
+	inline VFloat vload( const float* pValues )				{ return _mm256_loadu_ps( pValues ); }
+	inline void vstore( float* pValues, VFloat value )		{ _mm256_storeu_ps( pValues, value ); }
+	inline VFloat vadd( VFloat a, VFloat b )				{ return _mm256_add_ps( a, b ); }
+	inline VFloat vsub( VFloat a, VFloat b )				{ return _mm256_sub_ps( a, b ); }
+	inline VFloat vmul( VFloat a, VFloat b )				{ return _mm256_mul_ps( a, b ); }
+	inline VFloat vdiv( VFloat a, VFloat b )				{ return _mm256_div_ps( a, b ); }
+	inline VFloat vsqrt( VFloat value )						{ return _mm256_sqrt_ps( value ); }
+	inline VFloat vmin( VFloat a, VFloat b )				{ return _mm256_min_ps( a, b ); }
+	inline VFloat vmax( VFloat a, VFloat b )				{ return _mm256_max_ps( a, b ); }
+	inline VFloat vfmadd( VFloat a, VFloat b, VFloat c )	{ return _mm256_fmadd_ps( a, b, c ); }
+	inline VFloat vround( VFloat value )					{ return _mm256_round_ps( value, _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC ); }
+	inline VMask vless( VFloat a, VFloat b )				{ return _mm256_cmp_ps( a, b, _CMP_LT_OQ ); }
+	inline VFloat vselect( VMask mask, VFloat a, VFloat b )	{ return _mm256_blendv_ps( b, a, mask ); }
+	inline float vhsum( VFloat value )
+	{
+		__m128 sum = _mm_add_ps( _mm256_castps256_ps128( value ), _mm256_extractf128_ps( value, 1 ) );
+		sum = _mm_hadd_ps( sum, sum );
+		sum = _mm_hadd_ps( sum, sum );
+		return _mm_cvtss_f32( sum );
+	}
+	inline VFloat vpow2i( VFloat n )
+	{
+		return _mm256_castsi256_ps( _mm256_slli_epi32( _mm256_add_epi32( _mm256_cvtps_epi32( n ), _mm256_set1_epi32( 127 ) ), 23 ) );
+	}
+	inline VFloat vfrexp( VFloat value, VFloat* pExponent )
+	{
+		const __m256i bits = _mm256_castps_si256( value );
+		*pExponent = _mm256_cvtepi32_ps( _mm256_sub_epi32( _mm256_srli_epi32( bits, 23 ), _mm256_set1_epi32( 126 ) ) );
+		return _mm256_castsi256_ps( _mm256_or_si256( _mm256_and_si256( bits, _mm256_set1_epi32( 0x007fffff ) ), _mm256_set1_epi32( 0x3f000000 ) ) );
+	}
+
+	typedef __m256i VInt;
+	inline VInt viset1( uint32_t value )					{ return _mm256_set1_epi32( int( value ) ); }
+	inline VInt viload( const uint32_t* pValues )			{ return _mm256_loadu_si256( ( const __m256i* )pValues ); }
+	inline VInt viadd( VInt a, VInt b )						{ return _mm256_add_epi32( a, b ); }
+	inline VInt vixor( VInt a, VInt b )						{ return _mm256_xor_si256( a, b ); }
+	inline VInt vimullo( VInt a, VInt b )					{ return _mm256_mullo_epi32( a, b ); }
+	inline VInt vimulhi( VInt a, VInt b )
+	{
+		const __m256i even = _mm256_mul_epu32( a, b );
+		const __m256i odd = _mm256_mul_epu32( _mm256_srli_epi64( a, 32 ), _mm256_srli_epi64( b, 32 ) );
+		return _mm256_blend_epi32( _mm256_srli_epi64( even, 32 ), odd, 0xaa );
+	}
+	inline VFloat vitofloat( VInt value, int shift )		{ return _mm256_cvtepi32_ps( _mm256_srli_epi32( value, shift ) ); }
+
+	inline VFloat vloadbf16( const uint16_t* pValues )		{ return _mm256_castsi256_ps( _mm256_slli_epi32( _mm256_cvtepu16_epi32( _mm_loadu_si128( ( const __m128i* )pValues ) ), 16 ) ); }
+	inline VInt vibits( VFloat value )						{ return _mm256_castps_si256( value ); }
+	inline VInt visrl( VInt value, int shift )				{ return _mm256_srli_epi32( value, shift ); }
+	inline VInt viand( VInt a, VInt b )						{ return _mm256_and_si256( a, b ); }
+	inline VMask visnan( VFloat value )						{ return _mm256_cmp_ps( value, value, _CMP_UNORD_Q ); }
+	// packus works within 128-bit halves, the permute gathers the two packed quarters
+	inline void vistore16( uint16_t* pValues, VInt value )
+	{
+		_mm_storeu_si128( ( __m128i* )pValues, _mm256_castsi256_si128( _mm256_permute4x64_epi64( _mm256_packus_epi32( value, value ), 0x08 ) ) );
+	}
+
+	inline VInt vidpbusd( VInt acc, VInt a, VInt b )		{ return _mm256_add_epi32( acc, _mm256_madd_epi16( _mm256_maddubs_epi16( a, b ), _mm256_set1_epi16( 1 ) ) ); }
+	inline int32_t vihsum( VInt value )
+	{
+		__m128i sum = _mm_add_epi32( _mm256_castsi256_si128( value ), _mm256_extracti128_si256( value, 1 ) );
+		sum = _mm_add_epi32( sum, _mm_shuffle_epi32( sum, 0x4e ) );
+		sum = _mm_add_epi32( sum, _mm_shuffle_epi32( sum, 0xb1 ) );
+		return _mm_cvtsi128_si32( sum );
+	}
+
+	#include "simd_kernels.inl"
+}
+
+// GCC 12 reports its own AVX-512 intrinsics as using uninitialized values
+#if defined( __clang__ )
+	#pragma clang attribute pop
+	#pragma clang attribute push( __attribute__(( target( "avx512f" ) )), apply_to = function )
+#elif defined( __GNUC__ )
+	#pragma GCC pop_options
+	#pragma GCC push_options
+	#pragma GCC target( "avx512f" )
+	#pragma GCC diagnostic push
+	#pragma GCC diagnostic ignored "-Wuninitialized"
+	#pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
+#endif
+
+namespace simd_avx512
+{
+	typedef __m512 VFloat;
+	typedef __mmask16 VMask;
+	static const size_t s_width = 16;
+
+	inline VFloat vzero()									{ return _mm512_setzero_ps(); }
+	inline VFloat vset1( float fValue )						{ return _mm512_set1_ps( fValue ); }
+	inline VFloat vload( const float* pValues )				{ return _mm512_loadu_ps( pValues ); }
+	inline void vstore( float* pValues, VFloat value )		{ _mm512_storeu_ps( pValues, value ); }
+	inline VFloat vadd( VFloat a, VFloat b )				{ return _mm512_add_ps( a, b ); }
+	inline VFloat vsub( VFloat a, VFloat b )				{ return _mm512_sub_ps( a, b ); }
+	inline VFloat vmul( VFloat a, VFloat b )				{ return _mm512_mul_ps( a, b ); }
+	inline VFloat vdiv( VFloat a, VFloat b )				{ return _mm512_div_ps( a, b ); }
+	inline VFloat vsqrt( VFloat value )						{ return _mm512_sqrt_ps( value ); }
+	inline VFloat vmin( VFloat a, VFloat b )				{ return _mm512_min_ps( a, b ); }
+	inline VFloat vmax( VFloat a, VFloat b )				{ return _mm512_max_ps( a, b ); }
+	inline VFloat vfmadd( VFloat a, VFloat b, VFloat c )	{ return _mm512_fmadd_ps( a, b, c ); }
+	inline VFloat vround( VFloat value )					{ return _mm512_roundscale_ps( value, _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC ); }
+	inline VMask vless( VFloat a, VFloat b )				{ return _mm512_cmp_ps_mask( a, b, _CMP_LT_OQ ); }
+	inline VFloat vselect( VMask mask, VFloat a, VFloat b )	{ return _mm512_mask_blend_ps( mask, b, a ); }
+	inline float vhsum( VFloat value )						{ return _mm512_reduce_add_ps( value ); }
+	inline VFloat vpow2i( VFloat n )
+	{
+		return _mm512_castsi512_ps( _mm512_slli_epi32( _mm512_add_epi32( _mm512_cvtps_epi32( n ), _mm512_set1_epi32( 127 ) ), 23 ) );
+	}
+	inline VFloat vfrexp( VFloat value, VFloat* pExponent )
+	{
+		const __m512i bits = _mm512_castps_si512( value );
+		*pExponent = _mm512_cvtepi32_ps( _mm512_sub_epi32( _mm512_srli_epi32( bits, 23 ), _mm512_set1_epi32( 126 ) ) );
+		return _mm512_castsi512_ps( _mm512_or_si512( _mm512_and_si512( bits, _mm512_set1_epi32( 0x007fffff ) ), _mm512_set1_epi32( 0x3f000000 ) ) );
+	}
+
+	typedef __m512i VInt;
+	inline VInt viset1( uint32_t value )					{ return _mm512_set1_epi32( int( value ) ); }
+	inline VInt viload( const uint32_t* pValues )			{ return _mm512_loadu_si512( pValues ); }
+	inline VInt viadd( VInt a, VInt b )						{ return _mm512_add_epi32( a, b ); }
+	inline VInt vixor( VInt a, VInt b )						{ return _mm512_xor_si512( a, b ); }
+	inline VInt vimullo( VInt a, VInt b )					{ return _mm512_mullo_epi32( a, b ); }
+	inline VInt vimulhi( VInt a, VInt b )
+	{
+		const __m512i even = _mm512_mul_epu32( a, b );
+		const __m512i odd = _mm512_mul_epu32( _mm512_srli_epi64( a, 32 ), _mm512_srli_epi64( b, 32 ) );
+		return _mm512_mask_blend_epi32( 0xaaaa, _mm512_srli_epi64( even, 32 ), odd );
+	}
+	inline VFloat vitofloat( VInt value, int shift )		{ return _mm512_cvtepi32_ps( _mm512_srli_epi32( value, shift ) ); }
+
+	inline VFloat vloadbf16( const uint16_t* pValues )		{ return _mm512_castsi512_ps( _mm512_slli_epi32( _mm512_cvtepu16_epi32( _mm256_loadu_si256( ( const __m256i* )pValues ) ), 16 ) ); }
+	inline VInt vibits( VFloat value )						{ return _mm512_castps_si512( value ); }
+	inline VInt visrl( VInt value, int shift )				{ return _mm512_srli_epi32( value, shift ); }
+	inline VInt viand( VInt a, VInt b )						{ return _mm512_and_si512( a, b ); }
+	inline VMask visnan( VFloat value )						{ return _mm512_cmp_ps_mask( value, value, _CMP_UNORD_Q ); }
+	inline void vistore16( uint16_t* pValues, VInt value )	{ _mm256_storeu_si256( ( __m256i* )pValues, _mm512_cvtepi32_epi16( value ) ); }
+
+	// AVX-512F has no 512-bit byte multiplies, each half goes through AVX2
+	inline VInt vidpbusd( VInt acc, VInt a, VInt b )
+	{
+		const __m256i ones = _mm256_set1_epi16( 1 );
+		const __m256i low = _mm256_madd_epi16( _mm256_maddubs_epi16( _mm512_castsi512_si256( a ), _mm512_castsi512_si256( b ) ), ones );
+		const __m256i high = _mm256_madd_epi16( _mm256_maddubs_epi16( _mm512_extracti64x4_epi64( a, 1 ), _mm512_extracti64x4_epi64( b, 1 ) ), ones );
+		return _mm512_add_epi32( acc, _mm512_inserti64x4( _mm512_castsi256_si512( low ), high, 1 ) );
+	}
+	inline int32_t vihsum( VInt value )						{ return _mm512_reduce_add_epi32( value ); }
+
+	#include "simd_kernels.inl"
+}
+
+// VNNI does the whole unsigned by signed byte dot product in one instruction. Only
+// dotU8S8 has a version of its own, getKernels swaps it into the AVX-512 table.
+#if defined( __clang__ )
+	#pragma clang attribute pop
+	#pragma clang attribute push( __attribute__(( target( "avx512f,avx512bw,avx512vnni" ) )), apply_to = function )
+#elif defined( __GNUC__ )
+	#pragma GCC pop_options
+	#pragma GCC push_options
+	#pragma GCC target( "avx512f,avx512bw,avx512vnni" )
+#endif
+
+namespace simd_avx512vnni
+{
+	inline int32_t dotU8S8( const uint8_t* pA, const int8_t* pB, size_t count )
+	{
+		__m512i sum0 = _mm512_setzero_si512();
+		__m512i sum1 = _mm512_setzero_si512();
+		size_t i = 0;
+		for( ; i + 128 <= count; i += 128 )
+		{
+			sum0 = _mm512_dpbusd_epi32( sum0, _mm512_loadu_si512( &pA[ i ] ), _mm512_loadu_si512( &pB[ i ] ) );
+			sum1 = _mm512_dpbusd_epi32( sum1, _mm512_loadu_si512( &pA[ i + 64 ] ), _mm512_loadu_si512( &pB[ i + 64 ] ) );
+		}
+		for( ; i + 64 <= count; i += 64 )
+		{
+			sum0 = _mm512_dpbusd_epi32( sum0, _mm512_loadu_si512( &pA[ i ] ), _mm512_loadu_si512( &pB[ i ] ) );
+		}
+
+		int32_t sum = _mm512_reduce_add_epi32( _mm512_add_epi32( sum0, sum1 ) );
+		for( ; i < count; ++i )
+		{
+			sum += int32_t( pA[ i ] ) * int32_t( pB[ i ] );
+		}
+		return sum;
+	}
+}
+
+#if defined( __clang__ )
+	#pragma clang attribute pop
+#elif defined( __GNUC__ )
+	#pragma GCC diagnostic pop
+	#pragma GCC pop_options
+#endif
+
+#endif // NN_SIMD_X86
+//----------------------------------------------------------------------------
+
+#if NN_SIMD_X86
+inline void readCpuid( int leaf, int subLeaf, unsigned int* pRegisters )
+{
+#if defined( _MSC_VER )
+	__cpuidex( ( int* )pRegisters, leaf, subLeaf );
+#else
+	__cpuid_count( leaf, subLeaf, pRegisters[ 0 ], pRegisters[ 1 ], pRegisters[ 2 ], pRegisters[ 3 ] );
+#endif
+}
+//----------------------------------------------------------------------------
+
+// Returns the register state the OS saves on context switch
+inline unsigned long long readXcr0()
+{
+#if defined( _MSC_VER )
+	return _xgetbv( 0 );
+#else
+	unsigned int eax, edx;
+	__asm__ __volatile__( "xgetbv" : "=a"( eax ), "=d"( edx ) : "c"( 0 ) );
+	return ( ( unsigned long long )edx << 32 ) | eax;
+#endif
+}
+#endif
+//----------------------------------------------------------------------------
+
+// Highest level supported by both the CPU and the OS
+inline SimdLevel detectSimdLevel()
+{
+#if NN_SIMD_X86
+	unsigned int registers[ 4 ];
+	readCpuid( 0, 0, registers );
+	const unsigned int maxLeaf = registers[ 0 ];
+	if( maxLeaf < 1 )
+	{
+		return SimdLevel_Scalar;
+	}
+
+	readCpuid( 1, 0, registers );
+	const bool bSSE42 = ( registers[ 2 ] & ( 1u << 20 ) ) != 0;
+	const bool bFMA = ( registers[ 2 ] & ( 1u << 12 ) ) != 0;
+	const bool bOSXSave = ( registers[ 2 ] & ( 1u << 27 ) ) != 0;
+	const bool bAVX = ( registers[ 2 ] & ( 1u << 28 ) ) != 0;
+	if( !bSSE42 )
+	{
+		return SimdLevel_Scalar;
+	}
+	if( !bOSXSave || !bAVX || maxLeaf < 7 )
+	{
+		return SimdLevel_SSE42;
+	}
+
+	const unsigned long long xcr0 = readXcr0();
+	const bool bYmmState = ( xcr0 & 0x6 ) == 0x6;
+	const bool bZmmState = ( xcr0 & 0xe6 ) == 0xe6;
+
+	readCpuid( 7, 0, registers );
+	const bool bAVX2 = ( registers[ 1 ] & ( 1u << 5 ) ) != 0;
+	const bool bAVX512F = ( registers[ 1 ] & ( 1u << 16 ) ) != 0;
+	if( bAVX512F && bZmmState )
+	{
+		return SimdLevel_AVX512;
+	}
+	if( bAVX2 && bFMA && bYmmState )
+	{
+		return SimdLevel_AVX2;
+	}
+	return SimdLevel_SSE42;
+#else
+	return SimdLevel_Scalar;
+#endif
+}
+//----------------------------------------------------------------------------
+
+// AVX-512 byte multiplies and VNNI, on top of the AVX-512 level
+inline bool detectAvx512Vnni()
+{
+#if NN_SIMD_X86
+	if( detectSimdLevel() < SimdLevel_AVX512 )
+	{
+		return false;
+	}
+	unsigned int registers[ 4 ];
+	readCpuid( 7, 0, registers );
+	const bool bAVX512BW = ( registers[ 1 ] & ( 1u << 30 ) ) != 0;
+	const bool bVNNI = ( registers[ 2 ] & ( 1u << 11 ) ) != 0;
+	return bAVX512BW && bVNNI;
+#else
+	return false;
+#endif
+}
+//----------------------------------------------------------------------------
+
+#define NN_KERNELS( level, strName, isa, transferIsa ) { level, strName, isa::dot, isa::axpy, isa::dotBf16, isa::toBf16, isa::dotU8S8, \
+	transferIsa::sigmoid, transferIsa::sigmoidDerivative, transferIsa::relu, transferIsa::reluDerivative, \
+	transferIsa::softplus, transferIsa::softplusDerivative, transferIsa::elu, transferIsa::eluDerivative, transferIsa::exp, transferIsa::log, isa::uniform, \
+	isa::momentum, isa::rmsprop, isa::adam }
+
+// Define NEURALNET_EXACT_MATH to validate against libm transfer functions on every level
+#if defined( NEURALNET_EXACT_MATH )
+	#define NN_TRANSFER_KERNELS( isa ) simd_scalar
+#else
+	#define NN_TRANSFER_KERNELS( isa ) isa
+#endif
+//----------------------------------------------------------------------------
+
+#if NN_SIMD_X86
+inline Kernels withVnni( Kernels kernels )
+{
+	kernels.strName = "avx512vnni";
+	kernels.dotU8S8 = simd_avx512vnni::dotU8S8;
+	return kernels;
+}
+#endif
+//----------------------------------------------------------------------------
+
+// Kernels for a specific level, clamped to what the machine supports
+inline const Kernels& getKernels( SimdLevel level )
+{
+	static const Kernels s_kernels[ SimdLevel_Count ] = {
+		NN_KERNELS( SimdLevel_Scalar, "scalar", simd_scalar, simd_scalar ),
+#if NN_SIMD_X86
+		NN_KERNELS( SimdLevel_SSE42, "sse4.2", simd_sse42, NN_TRANSFER_KERNELS( simd_sse42 ) ),
+		NN_KERNELS( SimdLevel_AVX2, "avx2", simd_avx2, NN_TRANSFER_KERNELS( simd_avx2 ) ),
+		NN_KERNELS( SimdLevel_AVX512, "avx512", simd_avx512, NN_TRANSFER_KERNELS( simd_avx512 ) ),
+#else
+		NN_KERNELS( SimdLevel_Scalar, "scalar", simd_scalar, simd_scalar ),
+		NN_KERNELS( SimdLevel_Scalar, "scalar", simd_scalar, simd_scalar ),
+		NN_KERNELS( SimdLevel_Scalar, "scalar", simd_scalar, simd_scalar ),
+#endif
+	};
+
+	static const SimdLevel s_supportedLevel = detectSimdLevel();
+#if NN_SIMD_X86
+	static const bool s_bVnni = detectAvx512Vnni();
+	static const Kernels s_vnniKernels = withVnni( s_kernels[ SimdLevel_AVX512 ] );
+	if( s_bVnni && level >= SimdLevel_AVX512 )
+	{
+		return s_vnniKernels;
+	}
+#endif
+	return s_kernels[ level < s_supportedLevel ? level : s_supportedLevel ];
+}
+//----------------------------------------------------------------------------
+
+// Best kernels for this machine, detected once
+inline const Kernels& getKernels()
+{
+	return getKernels( SimdLevel_AVX512 );
+}
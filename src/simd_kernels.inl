@@ -0,0 +1,423 @@
+/*=============================================================================
+
+MIT License
+
+Copyright (c) 2018 Ville Ruusutie
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+
+=============================================================================*/
+
+// Vector kernels shared by every instruction set in simd.h. Included inside an
+// instruction set namespace that provides VFloat, s_width and the v* wrappers.
+//----------------------------------------------------------------------------
+
+// Four independent accumulators hide the latency of the multiply-add chain
+inline float dot( const float* pA, const float* pB, size_t count )
+{
+	VFloat sum0 = vzero();
+	VFloat sum1 = vzero();
+	VFloat sum2 = vzero();
+	VFloat sum3 = vzero();
+	size_t i = 0;
+	for( ; i + 4 * s_width <= count; i += 4 * s_width )
+	{
+		sum0 = vfmadd( vload( &pA[ i + 0 * s_width ] ), vload( &pB[ i + 0 * s_width ] ), sum0 );
+		sum1 = vfmadd( vload( &pA[ i + 1 * s_width ] ), vload( &pB[ i + 1 * s_width ] ), sum1 );
+		sum2 = vfmadd( vload( &pA[ i + 2 * s_width ] ), vload( &pB[ i + 2 * s_width ] ), sum2 );
+		sum3 = vfmadd( vload( &pA[ i + 3 * s_width ] ), vload( &pB[ i + 3 * s_width ] ), sum3 );
+	}
+	for( ; i + s_width <= count; i += s_width )
+	{
+		sum0 = vfmadd( vload( &pA[ i ] ), vload( &pB[ i ] ), sum0 );
+	}
+
+	float fSum = vhsum( vadd( vadd( sum0, sum1 ), vadd( sum2, sum3 ) ) );
+	for( ; i < count; ++i )
+	{
+		fSum += pA[ i ] * pB[ i ];
+	}
+	return fSum;
+}
+//----------------------------------------------------------------------------
+
+inline void axpy( float fScale, const float* pX, float* pY, size_t count )
+{
+	const VFloat scale = vset1( fScale );
+	size_t i = 0;
+	for( ; i + 2 * s_width <= count; i += 2 * s_width )
+	{
+		vstore( &pY[ i ], vfmadd( scale, vload( &pX[ i ] ), vload( &pY[ i ] ) ) );
+		vstore( &pY[ i + s_width ], vfmadd( scale, vload( &pX[ i + s_width ] ), vload( &pY[ i + s_width ] ) ) );
+	}
+	for( ; i + s_width <= count; i += s_width )
+	{
+		vstore( &pY[ i ], vfmadd( scale, vload( &pX[ i ] ), vload( &pY[ i ] ) ) );
+	}
+	for( ; i < count; ++i )
+	{
+		pY[ i ] += fScale * pX[ i ];
+	}
+}
+//----------------------------------------------------------------------------
+
+inline float dotBf16( const uint16_t* pA, const float* pB, size_t count )
+{
+	VFloat sum0 = vzero();
+	VFloat sum1 = vzero();
+	VFloat sum2 = vzero();
+	VFloat sum3 = vzero();
+	size_t i = 0;
+	for( ; i + 4 * s_width <= count; i += 4 * s_width )
+	{
+		sum0 = vfmadd( vloadbf16( &pA[ i + 0 * s_width ] ), vload( &pB[ i + 0 * s_width ] ), sum0 );
+		sum1 = vfmadd( vloadbf16( &pA[ i + 1 * s_width ] ), vload( &pB[ i + 1 * s_width ] ), sum1 );
+		sum2 = vfmadd( vloadbf16( &pA[ i + 2 * s_width ] ), vload( &pB[ i + 2 * s_width ] ), sum2 );
+		sum3 = vfmadd( vloadbf16( &pA[ i + 3 * s_width ] ), vload( &pB[ i + 3 * s_width ] ), sum3 );
+	}
+	for( ; i + s_width <= count; i += s_width )
+	{
+		sum0 = vfmadd( vloadbf16( &pA[ i ] ), vload( &pB[ i ] ), sum0 );
+	}
+
+	float fSum = vhsum( vadd( vadd( sum0, sum1 ), vadd( sum2, sum3 ) ) );
+	for( ; i < count; ++i )
+	{
+		fSum += bf16ToFloat( pA[ i ] ) * pB[ i ];
+	}
+	return fSum;
+}
+//----------------------------------------------------------------------------
+
+// Integer rounding, identical to floatToBf16: adding 0x7fff plus the lowest kept bit
+// carries into the kept half exactly when the dropped half rounds up
+inline void toBf16( const float* pValues, uint16_t* pBf16, size_t count )
+{
+	const VFloat quietNan = vset1( std::numeric_limits< float >::quiet_NaN() );
+	const VInt bias = viset1( 0x7fff );
+	const VInt one = viset1( 1 );
+	size_t i = 0;
+	for( ; i + s_width <= count; i += s_width )
+	{
+		const VFloat value = vload( &pValues[ i ] );
+		const VInt bits = vibits( vselect( visnan( value ), quietNan, value ) );
+		const VInt rounded = viadd( bits, viadd( bias, viand( visrl( bits, 16 ), one ) ) );
+		vistore16( &pBf16[ i ], visrl( rounded, 16 ) );
+	}
+	for( ; i < count; ++i )
+	{
+		pBf16[ i ] = floatToBf16( pValues[ i ] );
+	}
+}
+//----------------------------------------------------------------------------
+
+// Each step covers 4 * s_width bytes, four per 32-bit lane
+inline int32_t dotU8S8( const uint8_t* pA, const int8_t* pB, size_t count )
+{
+	const size_t byteWidth = 4 * s_width;
+	VInt sum0 = viset1( 0 );
+	VInt sum1 = viset1( 0 );
+	size_t i = 0;
+	for( ; i + 2 * byteWidth <= count; i += 2 * byteWidth )
+	{
+		sum0 = vidpbusd( sum0, viload( ( const uint32_t* )&pA[ i ] ), viload( ( const uint32_t* )&pB[ i ] ) );
+		sum1 = vidpbusd( sum1, viload( ( const uint32_t* )&pA[ i + byteWidth ] ), viload( ( const uint32_t* )&pB[ i + byteWidth ] ) );
+	}
+	for( ; i + byteWidth <= count; i += byteWidth )
+	{
+		sum0 = vidpbusd( sum0, viload( ( const uint32_t* )&pA[ i ] ), viload( ( const uint32_t* )&pB[ i ] ) );
+	}
+
+	int32_t sum = vihsum( viadd( sum0, sum1 ) );
+	for( ; i < count; ++i )
+	{
+		sum += int32_t( pA[ i ] ) * int32_t( pB[ i ] );
+	}
+	return sum;
+}
+//----------------------------------------------------------------------------
+
+// exp( x ) with Cody-Waite range reduction and a degree 6 polynomial (Cephes expf).
+// Inputs are clamped to [-87.3, 88.3] so the result is always a normal float.
+// Measured max error against a double precision reference is 1.3 ULP in that range.
+inline VFloat vexp( VFloat x )
+{
+	x = vmin( vmax( x, vset1( -87.3f ) ), vset1( 88.3f ) );
+	const VFloat n = vround( vmul( x, vset1( 1.44269504088896341f ) ) );
+	VFloat r = vfmadd( n, vset1( -0.693359375f ), x );
+	r = vfmadd( n, vset1( 2.12194440e-4f ), r );
+
+	VFloat p = vset1( 1.9875691500e-4f );
+	p = vfmadd( p, r, vset1( 1.3981999507e-3f ) );
+	p = vfmadd( p, r, vset1( 8.3334519073e-3f ) );
+	p = vfmadd( p, r, vset1( 4.1665795894e-2f ) );
+	p = vfmadd( p, r, vset1( 1.6666665459e-1f ) );
+	p = vfmadd( p, r, vset1( 5.0000001201e-1f ) );
+	p = vfmadd( p, vmul( r, r ), vadd( r, vset1( 1.0f ) ) );
+	return vmul( p, vpow2i( n ) );
+}
+//----------------------------------------------------------------------------
+
+// log( x ) for positive normal inputs with a degree 8 polynomial (Cephes logf).
+// Measured max error against a double precision reference is 0.8 ULP.
+inline VFloat vlog( VFloat x )
+{
+	VFloat e;
+	VFloat m = vfrexp( x, &e );
+
+	// Shift the mantissa to [sqrt(0.5), sqrt(2)) - 1 so the polynomial is centered
+	const VMask small = vless( m, vset1( 0.707106781186547524f ) );
+	e = vsub( e, vselect( small, vset1( 1.0f ), vzero() ) );
+	m = vsub( vadd( m, vselect( small, m, vzero() ) ), vset1( 1.0f ) );
+
+	const VFloat z = vmul( m, m );
+	VFloat p = vset1( 7.0376836292e-2f );
+	p = vfmadd( p, m, vset1( -1.1514610310e-1f ) );
+	p = vfmadd( p, m, vset1( 1.1676998740e-1f ) );
+	p = vfmadd( p, m, vset1( -1.2420140846e-1f ) );
+	p = vfmadd( p, m, vset1( 1.4249322787e-1f ) );
+	p = vfmadd( p, m, vset1( -1.6668057665e-1f ) );
+	p = vfmadd( p, m, vset1( 2.0000714765e-1f ) );
+	p = vfmadd( p, m, vset1( -2.4999993993e-1f ) );
+	p = vfmadd( p, m, vset1( 3.3333331174e-1f ) );
+
+	VFloat y = vmul( vmul( p, m ), z );
+	y = vfmadd( e, vset1( -2.12194440e-4f ), y );
+	y = vfmadd( z, vset1( -0.5f ), y );
+	return vfmadd( e, vset1( 0.693359375f ), vadd( m, y ) );
+}
+//----------------------------------------------------------------------------
+
+// Transfer functions built on vexp and vlog. sigmoid stays within 3.2 ULP (libm 2.5 ULP),
+// elu and softplus lose the same relative accuracy to cancellation near zero as libm.
+inline VFloat vsigmoid( VFloat x )
+{
+	const VFloat one = vset1( 1.0f );
+	return vdiv( one, vadd( one, vexp( vsub( vzero(), x ) ) ) );
+}
+
+inline VFloat vsigmoidDerivative( VFloat y )	{ return vmul( y, vsub( vset1( 1.0f ), y ) ); }
+inline VFloat vrelu( VFloat x )					{ return vmax( vzero(), x ); }
+inline VFloat vreluDerivative( VFloat y )		{ return vselect( vless( vzero(), y ), vset1( 1.0f ), vzero() ); }
+
+// Evaluated as max( x, 0 ) + log( 1 + exp( -|x| ) ), which does not overflow
+inline VFloat vsoftplus( VFloat x )
+{
+	const VFloat negativeAbs = vmin( x, vsub( vzero(), x ) );
+	return vadd( vmax( x, vzero() ), vlog( vadd( vset1( 1.0f ), vexp( negativeAbs ) ) ) );
+}
+
+inline VFloat vsoftplusDerivative( VFloat x )	{ return vsigmoid( x ); }
+inline VFloat velu( VFloat x )					{ return vselect( vless( x, vzero() ), vsub( vexp( x ), vset1( 1.0f ) ), x ); }
+inline VFloat veluDerivative( VFloat y )		{ return vselect( vless( y, vzero() ), vexp( y ), vset1( 1.0f ) ); }
+//----------------------------------------------------------------------------
+
+// The tail goes through a padded vector so every element gets the same approximation
+template< VFloat ( *Function )( VFloat ) >
+inline void transform( float* pValues, size_t count )
+{
+	size_t i = 0;
+	for( ; i + s_width <= count; i += s_width )
+	{
+		vstore( &pValues[ i ], Function( vload( &pValues[ i ] ) ) );
+	}
+	if( i < count )
+	{
+		float tail[ s_width ] = {};
+		for( size_t t = 0; t < count - i; ++t )
+		{
+			tail[ t ] = pValues[ i + t ];
+		}
+		vstore( tail, Function( vload( tail ) ) );
+		for( size_t t = 0; t < count - i; ++t )
+		{
+			pValues[ i + t ] = tail[ t ];
+		}
+	}
+}
+//----------------------------------------------------------------------------
+
+template< VFloat ( *Derivative )( VFloat ) >
+inline void multiplyDerivative( const float* pValues, float* pDeltas, size_t count )
+{
+	size_t i = 0;
+	for( ; i + s_width <= count; i += s_width )
+	{
+		vstore( &pDeltas[ i ], vmul( vload( &pDeltas[ i ] ), Derivative( vload( &pValues[ i ] ) ) ) );
+	}
+	if( i < count )
+	{
+		float tail[ s_width ] = {};
+		for( size_t t = 0; t < count - i; ++t )
+		{
+			tail[ t ] = pValues[ i + t ];
+		}
+		vstore( tail, Derivative( vload( tail ) ) );
+		for( size_t t = 0; t < count - i; ++t )
+		{
+			pDeltas[ i + t ] *= tail[ t ];
+		}
+	}
+}
+//----------------------------------------------------------------------------
+
+inline void sigmoid( float* pValues, size_t count )										{ transform< vsigmoid >( pValues, count ); }
+inline void sigmoidDerivative( const float* pValues, float* pDeltas, size_t count )		{ multiplyDerivative< vsigmoidDerivative >( pValues, pDeltas, count ); }
+inline void relu( float* pValues, size_t count )										{ transform< vrelu >( pValues, count ); }
+inline void reluDerivative( const float* pValues, float* pDeltas, size_t count )		{ multiplyDerivative< vreluDerivative >( pValues, pDeltas, count ); }
+inline void softplus( float* pValues, size_t count )									{ transform< vsoftplus >( pValues, count ); }
+inline void softplusDerivative( const float* pValues, float* pDeltas, size_t count )	{ multiplyDerivative< vsoftplusDerivative >( pValues, pDeltas, count ); }
+inline void elu( float* pValues, size_t count )											{ transform< velu >( pValues, count ); }
+inline void eluDerivative( const float* pValues, float* pDeltas, size_t count )			{ multiplyDerivative< veluDerivative >( pValues, pDeltas, count ); }
+inline void exp( float* pValues, size_t count )											{ transform< vexp >( pValues, count ); }
+inline void log( float* pValues, size_t count )											{ transform< vlog >( pValues, count ); }
+//----------------------------------------------------------------------------
+
+// Philox4x32-10 on s_width blocks at once, one vector per word of the block
+inline void philoxBlocks( VInt* pWords, uint32_t key0, uint32_t key1 )
+{
+	const VInt m0 = viset1( s_philoxM0 );
+	const VInt m1 = viset1( s_philoxM1 );
+	for( int round = 0; round < 10; ++round )
+	{
+		const VInt hi0 = vimulhi( m0, pWords[ 0 ] );
+		const VInt lo0 = vimullo( m0, pWords[ 0 ] );
+		const VInt hi1 = vimulhi( m1, pWords[ 2 ] );
+		const VInt lo1 = vimullo( m1, pWords[ 2 ] );
+		pWords[ 0 ] = vixor( vixor( hi1, pWords[ 1 ] ), viset1( key0 ) );
+		pWords[ 1 ] = lo1;
+		pWords[ 2 ] = vixor( vixor( hi0, pWords[ 3 ] ), viset1( key1 ) );
+		pWords[ 3 ] = lo0;
+		key0 += s_philoxW0;
+		key1 += s_philoxW1;
+	}
+}
+
+// Whole groups in vectors, the unaligned head and the tail through the scalar reference.
+// A group starts on a multiple of 16 blocks, so the low counter word never carries
+// inside it and the high word is the same for the whole group.
+inline void uniform( uint64_t seed, uint64_t stream, uint64_t first, float* pValues, size_t count, float fScale )
+{
+	static const uint32_t s_laneIndices[ s_philoxGroupBlockCount ] = { 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15 };
+	const VInt laneIndices = viload( s_laneIndices );
+	const VInt bias = viset1( 0x800000 );
+	const VFloat scale = vset1( fScale * ( 1.0f / 8388608.0f ) );
+
+	size_t head = size_t( ( s_philoxGroupSize - first % s_philoxGroupSize ) % s_philoxGroupSize );
+	head = head < count ? head : count;
+	philoxUniform( seed, stream, first, pValues, head, fScale );
+
+	size_t i = head;
+	for( ; i + s_philoxGroupSize <= count; i += s_philoxGroupSize )
+	{
+		const uint64_t block = ( first + i ) / 4;
+		for( size_t b = 0; b < s_philoxGroupBlockCount; b += s_width )
+		{
+			VInt words[ 4 ] = {
+				viadd( viset1( uint32_t( block + b ) ), laneIndices ),
+				viset1( uint32_t( block >> 32 ) ),
+				viset1( uint32_t( stream ) ),
+				viset1( uint32_t( stream >> 32 ) ) };
+			philoxBlocks( words, uint32_t( seed ), uint32_t( seed >> 32 ) );
+			for( size_t word = 0; word < 4; ++word )
+			{
+				// ( word >> 8 ) - 2^23 as an exact float, then one multiply like philoxToFloat
+				const VFloat centered = vsub( vitofloat( words[ word ], 8 ), vitofloat( bias, 0 ) );
+				vstore( &pValues[ i + word * s_philoxGroupBlockCount + b ], vmul( centered, scale ) );
+			}
+		}
+	}
+	philoxUniform( seed, stream, first + i, &pValues[ i ], count - i, fScale );
+}
+//----------------------------------------------------------------------------
+
+// Optimizer updates, see Kernels::momentum. Each element is read and written once and
+// the tail goes through the scalar reference.
+inline void momentum( const OptimizerStep& step, float* pParameters, const float* pGradients, float* pVelocity, float* pUnused, size_t count )
+{
+	const VFloat learningRate = vset1( step.fLearningRate );
+	const VFloat gradientScale = vset1( step.fGradientScale );
+	const VFloat momentum = vset1( step.fMomentum );
+	size_t i = 0;
+	if( step.bNesterov )
+	{
+		for( ; i + s_width <= count; i += s_width )
+		{
+			const VFloat gradient = vmul( vload( &pGradients[ i ] ), gradientScale );
+			const VFloat velocity = vfmadd( momentum, vload( &pVelocity[ i ] ), gradient );
+			vstore( &pVelocity[ i ], velocity );
+			vstore( &pParameters[ i ], vfmadd( learningRate, vfmadd( momentum, velocity, gradient ), vload( &pParameters[ i ] ) ) );
+		}
+	}
+	else
+	{
+		for( ; i + s_width <= count; i += s_width )
+		{
+			const VFloat velocity = vfmadd( momentum, vload( &pVelocity[ i ] ), vmul( vload( &pGradients[ i ] ), gradientScale ) );
+			vstore( &pVelocity[ i ], velocity );
+			vstore( &pParameters[ i ], vfmadd( learningRate, velocity, vload( &pParameters[ i ] ) ) );
+		}
+	}
+	simd_scalar::momentum( step, &pParameters[ i ], &pGradients[ i ], &pVelocity[ i ], pUnused, count - i );
+}
+//----------------------------------------------------------------------------
+
+inline void rmsprop( const OptimizerStep& step, float* pParameters, const float* pGradients, float* pSquares, float* pUnused, size_t count )
+{
+	const VFloat learningRate = vset1( step.fLearningRate );
+	const VFloat gradientScale = vset1( step.fGradientScale );
+	const VFloat decay = vset1( step.fDecay );
+	const VFloat oneMinusDecay = vset1( 1.0f - step.fDecay );
+	const VFloat epsilon = vset1( step.fEpsilon );
+	size_t i = 0;
+	for( ; i + s_width <= count; i += s_width )
+	{
+		const VFloat gradient = vmul( vload( &pGradients[ i ] ), gradientScale );
+		const VFloat squares = vfmadd( decay, vload( &pSquares[ i ] ), vmul( oneMinusDecay, vmul( gradient, gradient ) ) );
+		vstore( &pSquares[ i ], squares );
+		const VFloat change = vdiv( vmul( learningRate, gradient ), vadd( vsqrt( squares ), epsilon ) );
+		vstore( &pParameters[ i ], vadd( vload( &pParameters[ i ] ), change ) );
+	}
+	simd_scalar::rmsprop( step, &pParameters[ i ], &pGradients[ i ], &pSquares[ i ], pUnused, count - i );
+}
+//----------------------------------------------------------------------------
+
+inline void adam( const OptimizerStep& step, float* pParameters, const float* pGradients, float* pMeans, float* pSquares, size_t count )
+{
+	const VFloat correctedRate = vset1( step.fLearningRate * step.fCorrection1 );
+	const VFloat gradientScale = vset1( step.fGradientScale );
+	const VFloat momentum = vset1( step.fMomentum );
+	const VFloat oneMinusMomentum = vset1( 1.0f - step.fMomentum );
+	const VFloat decay = vset1( step.fDecay );
+	const VFloat oneMinusDecay = vset1( 1.0f - step.fDecay );
+	const VFloat correction2 = vset1( step.fCorrection2 );
+	const VFloat epsilon = vset1( step.fEpsilon );
+	size_t i = 0;
+	for( ; i + s_width <= count; i += s_width )
+	{
+		const VFloat gradient = vmul( vload( &pGradients[ i ] ), gradientScale );
+		const VFloat means = vfmadd( momentum, vload( &pMeans[ i ] ), vmul( oneMinusMomentum, gradient ) );
+		const VFloat squares = vfmadd( decay, vload( &pSquares[ i ] ), vmul( oneMinusDecay, vmul( gradient, gradient ) ) );
+		vstore( &pMeans[ i ], means );
+		vstore( &pSquares[ i ], squares );
+		const VFloat change = vdiv( vmul( correctedRate, means ), vadd( vsqrt( vmul( squares, correction2 ) ), epsilon ) );
+		vstore( &pParameters[ i ], vadd( vload( &pParameters[ i ] ), change ) );
+	}
+	simd_scalar::adam( step, &pParameters[ i ], &pGradients[ i ], &pMeans[ i ], &pSquares[ i ], count - i );
+}
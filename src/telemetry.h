@@ -0,0 +1,258 @@
+/*=============================================================================
+
+MIT License
+
+Copyright (c) 2018 Ville Ruusutie
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+
+=============================================================================*/
+
+// Per epoch training metrics: what train() reports through TrainingParams::pMetricsSink,
+// sinks writing JSON lines or queueing for another thread, and the counters and phase
+// clock the training loops fill when a sink is set.
+
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <stdint.h>
+#include <stdio.h>
+#include <vector>
+//----------------------------------------------------------------------------
+
+// Parts of a training step timed separately. With TrainingParams::bFuseOutputLayer the
+// single pass over the output layer counts as update.
+enum Phase
+{
+	// Propagating values through the layers
+	Phase_Forward,
+	// Deltas, and gradient sums when an optimizer or threads need them
+	Phase_Backward,
+	// Changing the weights
+	Phase_Update,
+	Phase_Count
+};
+//----------------------------------------------------------------------------
+
+// What train() reports after every epoch, see MetricsSink
+struct EpochMetrics
+{
+	size_t	epoch;
+	size_t	sampleCount;
+	float	fLearningRate;
+	// Summed quadratic error of the epoch, what train() returns
+	float	fError;
+	// Summed quadratic error on TrainingParams' validation samples, NaN without them
+	float	fValidationError;
+	// Root mean square over the epoch's batches of the norm of the mean gradient,
+	// weights and biases of every layer together. Plain SGD never forms the gradient,
+	// so there only every s_gradientNormInterval-th batch of a thread is measured.
+	float	fGradientNorm;
+	double	fSeconds;
+	double	fSamplesPerSecond;
+	// Time spent in each phase, summed over training threads. Whatever is left of
+	// fSeconds went to gathering samples, waiting and bookkeeping.
+	double	fPhaseSeconds[ Phase_Count ];
+};
+//----------------------------------------------------------------------------
+
+// Receives the metrics of every epoch on the thread that called train(). Give one to
+// TrainingParams::pMetricsSink; without a sink train() times nothing inside an epoch
+// and computes no gradient norms.
+struct MetricsSink
+{
+	virtual ~MetricsSink() {}
+	virtual void record( const EpochMetrics& metrics ) = 0;
+};
+//----------------------------------------------------------------------------
+
+// Writes every epoch as one JSON object per line. The file stays open and owned by the
+// caller, output goes through stdio buffering.
+struct JsonLinesSink : MetricsSink
+{
+	explicit JsonLinesSink( FILE* pFile )
+		: m_pFile( pFile )
+	{
+	}
+	//------------------------------------------------------------------------
+
+	virtual void record( const EpochMetrics& metrics )
+	{
+		fprintf( m_pFile, "{ \"epoch\": %d, \"samples\": %d, \"learning_rate\": %.9g, \"error\": %.9g, ",
+			( int )metrics.epoch, ( int )metrics.sampleCount, metrics.fLearningRate, metrics.fError );
+		// JSON has no NaN
+		if( metrics.fValidationError == metrics.fValidationError )
+		{
+			fprintf( m_pFile, "\"validation_error\": %.9g, ", metrics.fValidationError );
+		}
+		fprintf( m_pFile, "\"gradient_norm\": %.9g, \"seconds\": %.9g, \"samples_per_second\": %.9g, "
+			"\"forward_seconds\": %.9g, \"backward_seconds\": %.9g, \"update_seconds\": %.9g }\n",
+			metrics.fGradientNorm, metrics.fSeconds, metrics.fSamplesPerSecond,
+			metrics.fPhaseSeconds[ Phase_Forward ], metrics.fPhaseSeconds[ Phase_Backward ], metrics.fPhaseSeconds[ Phase_Update ] );
+	}
+	//------------------------------------------------------------------------
+
+private:
+	FILE*	m_pFile;
+};
+//----------------------------------------------------------------------------
+
+// Fixed size queue of metrics for another thread to poll, for example a UI or a
+// monitoring exporter. One thread trains and one polls; neither ever waits. When the
+// poller falls behind by the whole capacity, new epochs are dropped and counted.
+struct MetricsRing : MetricsSink
+{
+	// capacity is rounded up to a power of two
+	explicit MetricsRing( size_t capacity = 1024 )
+		: m_writeIndex( 0 )
+		, m_readIndex( 0 )
+		, m_droppedCount( 0 )
+	{
+		size_t roundedCapacity = 1;
+		while( roundedCapacity < capacity )
+		{
+			roundedCapacity *= 2;
+		}
+		m_entries.resize( roundedCapacity );
+	}
+	//------------------------------------------------------------------------
+
+	virtual void record( const EpochMetrics& metrics )
+	{
+		const size_t writeIndex = m_writeIndex.load( std::memory_order_relaxed );
+		if( writeIndex - m_readIndex.load( std::memory_order_acquire ) == m_entries.size() )
+		{
+			m_droppedCount.fetch_add( 1, std::memory_order_relaxed );
+			return;
+		}
+		m_entries[ writeIndex & ( m_entries.size() - 1 ) ] = metrics;
+		m_writeIndex.store( writeIndex + 1, std::memory_order_release );
+	}
+	//------------------------------------------------------------------------
+
+	// Takes the oldest epoch not polled yet, returns false when there is none
+	bool poll( EpochMetrics& metrics )
+	{
+		const size_t readIndex = m_readIndex.load( std::memory_order_relaxed );
+		if( readIndex == m_writeIndex.load( std::memory_order_acquire ) )
+		{
+			return false;
+		}
+		metrics = m_entries[ readIndex & ( m_entries.size() - 1 ) ];
+		m_readIndex.store( readIndex + 1, std::memory_order_release );
+		return true;
+	}
+	//------------------------------------------------------------------------
+
+	uint64_t getDroppedCount() const	{ return m_droppedCount.load( std::memory_order_relaxed ); }
+	//------------------------------------------------------------------------
+
+private:
+	MetricsRing( const MetricsRing& ) = delete;
+	MetricsRing& operator=( const MetricsRing& ) = delete;
+
+	std::vector< EpochMetrics > m_entries;
+	std::atomic< size_t > m_writeIndex;
+	std::atomic< size_t > m_readIndex;
+	std::atomic< uint64_t > m_droppedCount;
+};
+//----------------------------------------------------------------------------
+
+// Plain SGD measures the gradient norm of one batch in this many. Without a gradient
+// slab the norm takes O( batch^2 * ( inputs + outputs ) ) per layer, about as much as
+// the backward pass of a large batch, so measuring every batch would slow training by
+// a fifth or more.
+constexpr uint64_t s_gradientNormInterval = 16;
+//----------------------------------------------------------------------------
+
+// What one training thread gathers over an epoch for EpochMetrics
+struct EpochCounters
+{
+	EpochCounters()
+		: fGradientNormSquaredSum( 0.0 )
+		, normBatchCount( 0 )
+		, batchCount( 0 )
+	{
+		for( int phase = 0; phase < Phase_Count; ++phase )
+		{
+			fPhaseSeconds[ phase ] = 0.0;
+		}
+	}
+
+	void add( const EpochCounters& counters )
+	{
+		for( int phase = 0; phase < Phase_Count; ++phase )
+		{
+			fPhaseSeconds[ phase ] += counters.fPhaseSeconds[ phase ];
+		}
+		fGradientNormSquaredSum += counters.fGradientNormSquaredSum;
+		normBatchCount += counters.normBatchCount;
+		batchCount += counters.batchCount;
+	}
+
+	double	fPhaseSeconds[ Phase_Count ];
+	double	fGradientNormSquaredSum;
+	// Batches whose norm went into fGradientNormSquaredSum
+	uint64_t normBatchCount;
+	uint64_t batchCount;
+};
+//----------------------------------------------------------------------------
+
+// Splits the time of a training step into phases. A clock without counters never
+// reads the time, so untimed training pays one branch per phase.
+struct PhaseClock
+{
+	explicit PhaseClock( EpochCounters* pCounters )
+		: m_pCounters( pCounters )
+	{
+		start();
+	}
+	//------------------------------------------------------------------------
+
+	// Time from here to the next lap is counted
+	void start()
+	{
+		if( m_pCounters != nullptr )
+		{
+			m_lapTime = Clock::now();
+		}
+	}
+
+	// Counts the time since start or the last lap towards phase
+	void lap( Phase phase )
+	{
+		if( m_pCounters != nullptr )
+		{
+			const Clock::time_point now = Clock::now();
+			m_pCounters->fPhaseSeconds[ phase ] += std::chrono::duration< double >( now - m_lapTime ).count();
+			m_lapTime = now;
+		}
+	}
+	//------------------------------------------------------------------------
+
+	EpochCounters* getCounters() const	{ return m_pCounters; }
+	//------------------------------------------------------------------------
+
+private:
+	typedef std::chrono::steady_clock Clock;
+
+	EpochCounters*		m_pCounters;
+	Clock::time_point	m_lapTime;
+};
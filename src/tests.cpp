@@ -0,0 +1,779 @@
+/*=============================================================================
+
+MIT License
+
+Copyright (c) 2018 Ville Ruusutie
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+
+=============================================================================*/
+
+// Unit tests with assertions, registered with ctest. Every failed check prints the
+// expression with its location, and the process exits with the number of failures.
+//   tests [name ...]
+// Without names every test runs.
+
+#include "checkpoint.h"
+#include "neuralnet.h"
+#include "quantized.h"
+#include "samplefile.h"
+
+#include <float.h>
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+#include <vector>
+//----------------------------------------------------------------------------
+
+static int s_failureCount = 0;
+
+#define CHECK( condition ) \
+	do \
+	{ \
+		if( !( condition ) ) \
+		{ \
+			printf( "%s:%d: check failed: %s\n", __FILE__, __LINE__, #condition ); \
+			++s_failureCount; \
+		} \
+	} while( false )
+
+static bool isSame( const float* pA, const float* pB, size_t count )
+{
+	return memcmp( pA, pB, count * sizeof( float ) ) == 0;
+}
+//----------------------------------------------------------------------------
+
+// A sigmoid net with one hidden layer, trained in double precision straight from the
+// textbook: deltas are ( target - output ) times the derivative, every sample of a
+// batch sees the same weights and the batch applies the mean change.
+struct ReferenceNet
+{
+	template< typename Net >
+	explicit ReferenceNet( const Net& net )
+		: inputCount( net.getInputCount() )
+		, hiddenCount( net.getHiddenLayer( 0 ).getOutputCount() )
+		, outputCount( net.getOutputCount() )
+		, hiddenWeights( net.getHiddenLayer( 0 ).getWeights(), net.getHiddenLayer( 0 ).getWeights() + hiddenCount * inputCount )
+		, hiddenBiases( net.getHiddenLayer( 0 ).getBiases(), net.getHiddenLayer( 0 ).getBiases() + hiddenCount )
+		, outputWeights( net.getOutputLayer().getWeights(), net.getOutputLayer().getWeights() + outputCount * hiddenCount )
+		, outputBiases( net.getOutputLayer().getBiases(), net.getOutputLayer().getBiases() + outputCount )
+	{
+	}
+
+	static double transfer( double fValue )	{ return 1.0 / ( 1.0 + exp( -fValue ) ); }
+
+	void trainBatch( const float* pInputs, const float* pExpected, size_t batchCount, double fLearningRate )
+	{
+		std::vector< double > hiddenChanges( hiddenWeights.size() + hiddenBiases.size(), 0.0 );
+		std::vector< double > outputChanges( outputWeights.size() + outputBiases.size(), 0.0 );
+		std::vector< double > hidden( hiddenCount );
+		std::vector< double > outputDeltas( outputCount );
+		for( size_t b = 0; b < batchCount; ++b )
+		{
+			const float* pSampleInputs = &pInputs[ inputCount * b ];
+			for( size_t h = 0; h < hiddenCount; ++h )
+			{
+				double fSum = hiddenBiases[ h ];
+				for( size_t i = 0; i < inputCount; ++i )
+				{
+					fSum += hiddenWeights[ inputCount * h + i ] * pSampleInputs[ i ];
+				}
+				hidden[ h ] = transfer( fSum );
+			}
+			for( size_t o = 0; o < outputCount; ++o )
+			{
+				double fSum = outputBiases[ o ];
+				for( size_t h = 0; h < hiddenCount; ++h )
+				{
+					fSum += outputWeights[ hiddenCount * o + h ] * hidden[ h ];
+				}
+				const double fOutput = transfer( fSum );
+				outputDeltas[ o ] = ( pExpected[ outputCount * b + o ] - fOutput ) * fOutput * ( 1.0 - fOutput );
+				for( size_t h = 0; h < hiddenCount; ++h )
+				{
+					outputChanges[ hiddenCount * o + h ] += outputDeltas[ o ] * hidden[ h ];
+				}
+				outputChanges[ outputWeights.size() + o ] += outputDeltas[ o ];
+			}
+			for( size_t h = 0; h < hiddenCount; ++h )
+			{
+				double fError = 0.0;
+				for( size_t o = 0; o < outputCount; ++o )
+				{
+					fError += outputDeltas[ o ] * outputWeights[ hiddenCount * o + h ];
+				}
+				const double fDelta = fError * hidden[ h ] * ( 1.0 - hidden[ h ] );
+				for( size_t i = 0; i < inputCount; ++i )
+				{
+					hiddenChanges[ inputCount * h + i ] += fDelta * pSampleInputs[ i ];
+				}
+				hiddenChanges[ hiddenWeights.size() + h ] += fDelta;
+			}
+		}
+
+		const double fScale = fLearningRate / double( batchCount );
+		for( size_t w = 0; w < hiddenWeights.size(); ++w )	hiddenWeights[ w ] += fScale * hiddenChanges[ w ];
+		for( size_t h = 0; h < hiddenCount; ++h )			hiddenBiases[ h ] += fScale * hiddenChanges[ hiddenWeights.size() + h ];
+		for( size_t w = 0; w < outputWeights.size(); ++w )	outputWeights[ w ] += fScale * outputChanges[ w ];
+		for( size_t o = 0; o < outputCount; ++o )			outputBiases[ o ] += fScale * outputChanges[ outputWeights.size() + o ];
+	}
+
+	// Largest difference to the net's parameters, relative to the largest parameter
+	template< typename Net >
+	double computeDistance( const Net& net ) const
+	{
+		double fDistance = 0.0;
+		double fMagnitude = 0.0;
+		auto compare = [ & ]( const std::vector< double >& reference, const float* pValues )
+		{
+			for( size_t i = 0; i < reference.size(); ++i )
+			{
+				fDistance = fabs( reference[ i ] - pValues[ i ] ) > fDistance ? fabs( reference[ i ] - pValues[ i ] ) : fDistance;
+				fMagnitude = fabs( reference[ i ] ) > fMagnitude ? fabs( reference[ i ] ) : fMagnitude;
+			}
+		};
+		compare( hiddenWeights, net.getHiddenLayer( 0 ).getWeights() );
+		compare( hiddenBiases, net.getHiddenLayer( 0 ).getBiases() );
+		compare( outputWeights, net.getOutputLayer().getWeights() );
+		compare( outputBiases, net.getOutputLayer().getBiases() );
+		return fDistance / fMagnitude;
+	}
+
+	size_t	inputCount;
+	size_t	hiddenCount;
+	size_t	outputCount;
+	std::vector< double > hiddenWeights;
+	std::vector< double > hiddenBiases;
+	std::vector< double > outputWeights;
+	std::vector< double > outputBiases;
+};
+//----------------------------------------------------------------------------
+
+static void makeSamples( std::vector< float >& inputs, std::vector< float >& outputs, size_t inputCount, size_t outputCount, size_t sampleCount )
+{
+	inputs.resize( inputCount * sampleCount );
+	outputs.resize( outputCount * sampleCount );
+	getKernels().uniform( 11, 0, 0, &inputs[ 0 ], inputs.size(), 1.0f );
+	getKernels().uniform( 12, 0, 0, &outputs[ 0 ], outputs.size(), 0.4f );
+	for( size_t o = 0; o < outputs.size(); ++o )
+	{
+		outputs[ o ] += 0.5f;
+	}
+}
+//----------------------------------------------------------------------------
+
+// A batch applies the mean of the per-sample changes at the weights it started from,
+// batchSize 1 applies every sample's change in turn. Both match the double precision
+// reference whether the output layer is fused or not and however the batch is split
+// between threads; a batched evaluate matches evaluating one sample at a time.
+static void testMinibatch()
+{
+	const size_t sampleCount = 24;
+	std::vector< float > inputs, outputs;
+	makeSamples( inputs, outputs, 5, 3, sampleCount );
+
+	const size_t batchSizes[] = { 1, 8, sampleCount };
+	for( size_t s = 0; s < sizeof( batchSizes ) / sizeof( batchSizes[ 0 ] ); ++s )
+	{
+		for( int variant = 0; variant < 3; ++variant )
+		{
+			NeuralNet< Sigmoid > net( { 5, 7, 3 } );
+			ReferenceNet reference( net );
+
+			TrainingParams params;
+			params.epochCount = 2;
+			params.fLearningRate = 0.5f;
+			params.batchSize = batchSizes[ s ];
+			params.bFuseOutputLayer = ( variant != 1 );
+			params.threadCount = ( variant == 2 ) ? 3 : 1;
+			params.bPrintProgress = false;
+			net.train( &inputs[ 0 ], &outputs[ 0 ], sampleCount, params );
+
+			for( size_t epoch = 0; epoch < params.epochCount; ++epoch )
+			{
+				for( size_t sample = 0; sample < sampleCount; sample += params.batchSize )
+				{
+					reference.trainBatch( &inputs[ 5 * sample ], &outputs[ 3 * sample ], params.batchSize, params.fLearningRate );
+				}
+			}
+			CHECK( reference.computeDistance( net ) < 1e-5 );
+		}
+	}
+
+	const NeuralNet< Sigmoid > net( { 5, 7, 3 } );
+	std::vector< float > batchOutputs( 3 * sampleCount );
+	Workspace batchWorkspace( net, sampleCount );
+	net.evaluate( &inputs[ 0 ], &batchOutputs[ 0 ], batchWorkspace, sampleCount );
+	Workspace workspace( net );
+	bool bSame = true;
+	for( size_t sample = 0; sample < sampleCount; ++sample )
+	{
+		float sampleOutputs[ 3 ];
+		net.evaluate( &inputs[ 5 * sample ], sampleOutputs, workspace );
+		bSame = bSame && isSame( sampleOutputs, &batchOutputs[ 3 * sample ], 3 );
+	}
+	CHECK( bSame );
+}
+//----------------------------------------------------------------------------
+
+// Synchronous data-parallel training reduces the shards in a fixed order, so a given
+// thread count gives the same weights on every run, Adam state included
+static void testDataParallelDeterminism()
+{
+	const size_t sampleCount = 512;
+	std::vector< float > inputs, outputs;
+	makeSamples( inputs, outputs, 16, 4, sampleCount );
+
+	for( int optimizer = Optimizer_Sgd; optimizer <= Optimizer_Adam; optimizer += Optimizer_Adam - Optimizer_Sgd )
+	{
+		for( size_t threadCount = 2; threadCount <= 4; threadCount += 2 )
+		{
+			TrainingParams params;
+			params.epochCount = 3;
+			params.fLearningRate = optimizer == Optimizer_Sgd ? 0.1f : 0.001f;
+			params.batchSize = 64;
+			params.threadCount = threadCount;
+			params.optimizer = Optimizer( optimizer );
+			params.shuffleMode = ShuffleMode_Full;
+			params.bPrintProgress = false;
+
+			NeuralNet< Relu, Sigmoid > first( { 16, 33, 17, 4 } );
+			NeuralNet< Relu, Sigmoid > second( { 16, 33, 17, 4 } );
+			const float fFirstError = first.train( &inputs[ 0 ], &outputs[ 0 ], sampleCount, params );
+			const float fSecondError = second.train( &inputs[ 0 ], &outputs[ 0 ], sampleCount, params );
+			CHECK( fFirstError == fSecondError );
+			CHECK( isSame( first.getParameters(), second.getParameters(), first.getParameterCount() ) );
+		}
+	}
+}
+//----------------------------------------------------------------------------
+
+static bool writeFile( const char* strPath, const std::vector< char >& bytes )
+{
+	FILE* pFile = fopen( strPath, "wb" );
+	if( pFile == nullptr )
+	{
+		return false;
+	}
+	const bool bWritten = fwrite( &bytes[ 0 ], 1, bytes.size(), pFile ) == bytes.size();
+	return ( fclose( pFile ) == 0 ) && bWritten;
+}
+
+static bool readFile( const char* strPath, std::vector< char >& bytes )
+{
+	FILE* pFile = fopen( strPath, "rb" );
+	if( pFile == nullptr )
+	{
+		return false;
+	}
+	bytes.clear();
+	char buffer[ 4096 ];
+	size_t readCount;
+	while( ( readCount = fread( buffer, 1, sizeof( buffer ), pFile ) ) > 0 )
+	{
+		bytes.insert( bytes.end(), buffer, buffer + readCount );
+	}
+	fclose( pFile );
+	return true;
+}
+//----------------------------------------------------------------------------
+
+// A saved net maps back bit for bit, and a checkpoint that was truncated, has a flipped
+// parameter bit, a foreign header or a layer size that disagrees with its parameter
+// count does not open
+static void testCheckpoint()
+{
+	const char* strPath = "tests_checkpoint.nncp";
+	const NeuralNet< Relu, Sigmoid > net( { 7, 19, 5 } );
+	CHECK( saveCheckpoint( net, strPath ) );
+	{
+		MappedCheckpoint checkpoint;
+		CHECK( checkpoint.open( strPath ) );
+		if( checkpoint.isOpen() )
+		{
+			CHECK( ( checkpoint.matches< Relu, Sigmoid >() ) );
+			CHECK( ( !checkpoint.matches< Elu, Sigmoid >() ) );
+			CHECK( checkpoint.getLayerSizeCount() == 3 );
+			CHECK( checkpoint.getHeader().parameterCount == net.getParameterCount() );
+			CHECK( isSame( checkpoint.getParameters(), net.getParameters(), net.getParameterCount() ) );
+
+			const NeuralNet< Relu, Sigmoid > mappedNet( checkpoint.getLayerSizes(), checkpoint.getLayerSizeCount(), checkpoint.getParameters() );
+			CHECK( mappedNet.isReadOnly() );
+			CHECK( mappedNet.getParameterCount() == net.getParameterCount() );
+		}
+	}
+
+	std::vector< char > bytes;
+	CHECK( readFile( strPath, bytes ) );
+	if( bytes.size() <= sizeof( CheckpointHeader ) )
+	{
+		CHECK( bytes.size() > sizeof( CheckpointHeader ) );
+		remove( strPath );
+		return;
+	}
+	CheckpointHeader header;
+	memcpy( &header, &bytes[ 0 ], sizeof( header ) );
+
+	MappedCheckpoint checkpoint;
+	std::vector< char > corrupt = bytes;
+	corrupt.resize( bytes.size() - sizeof( float ) );
+	CHECK( writeFile( strPath, corrupt ) && !checkpoint.open( strPath, false ) );
+
+	corrupt = bytes;
+	corrupt[ size_t( header.parameterOffset ) + 5 ] ^= 0x10;
+	CHECK( writeFile( strPath, corrupt ) && !checkpoint.open( strPath ) );
+	// Skipping the checksum is what lets such a file through
+	CHECK( checkpoint.open( strPath, false ) );
+	checkpoint.close();
+
+	corrupt = bytes;
+	corrupt[ 0 ] ^= 0x01;
+	CHECK( writeFile( strPath, corrupt ) && !checkpoint.open( strPath, false ) );
+
+	corrupt = bytes;
+	uint64_t hiddenSize = 20;
+	memcpy( &corrupt[ sizeof( CheckpointHeader ) + sizeof( uint64_t ) ], &hiddenSize, sizeof( hiddenSize ) );
+	CHECK( writeFile( strPath, corrupt ) && !checkpoint.open( strPath, false ) );
+
+	corrupt.assign( bytes.begin(), bytes.begin() + sizeof( CheckpointHeader ) / 2 );
+	CHECK( writeFile( strPath, corrupt ) && !checkpoint.open( strPath, false ) );
+	remove( strPath );
+}
+//----------------------------------------------------------------------------
+
+// float32 sample files map back exactly, float16 ones within half a unit in the last
+// place of a half and exactly what floatToHalf makes of the values, across chunks
+// that do not divide the sample count
+static void testSampleFile()
+{
+	const char* strPath = "tests_samples.nnsd";
+	const size_t sampleCount = 1000;
+	std::vector< float > inputs, outputs;
+	makeSamples( inputs, outputs, 3, 2, sampleCount );
+	inputs[ 0 ] = 65504.0f;
+	inputs[ 1 ] = -6.0e-8f;
+	inputs[ 2 ] = 0.0f;
+
+	for( int storage = SampleStorage_Float32; storage <= SampleStorage_Float16; ++storage )
+	{
+		SampleFileWriter writer;
+		bool bWritten = writer.open( strPath, 3, 2, sampleCount, SampleStorage( storage ) );
+		for( size_t s = 0; bWritten && s < sampleCount; ++s )
+		{
+			bWritten = writer.write( &inputs[ 3 * s ], &outputs[ 2 * s ] );
+		}
+		bWritten = writer.close() && bWritten;
+		CHECK( bWritten );
+
+		MappedSampleFile sampleFile;
+		CHECK( !sampleFile.open( strPath, 0 ) );
+		const bool bOpened = sampleFile.open( strPath, 300 );
+		CHECK( bOpened );
+		if( !bOpened )
+		{
+			continue;
+		}
+		CHECK( sampleFile.getStorage() == storage );
+		CHECK( sampleFile.getInputCount() == 3 && sampleFile.getOutputCount() == 2 && sampleFile.getSampleCount() == sampleCount );
+		CHECK( ( sampleFile.getInputs() != nullptr ) == ( storage == SampleStorage_Float32 ) );
+
+		size_t sample = 0;
+		bool bExact = true;
+		bool bClose = true;
+		DataChunk chunk;
+		while( sampleFile.next( chunk ) )
+		{
+			for( size_t i = 0; i < 3 * chunk.sampleCount; ++i )
+			{
+				const float fValue = inputs[ 3 * sample + i ];
+				const float fExpected = storage == SampleStorage_Float32 ? fValue : halfToFloat( floatToHalf( fValue ) );
+				bExact = bExact && memcmp( &chunk.pInputs[ i ], &fExpected, sizeof( float ) ) == 0;
+				bClose = bClose && fabsf( chunk.pInputs[ i ] - fValue ) <= fabsf( fValue ) * ( 1.0f / 2048.0f ) + 3.0e-8f;
+			}
+			for( size_t o = 0; o < 2 * chunk.sampleCount; ++o )
+			{
+				const float fValue = outputs[ 2 * sample + o ];
+				const float fExpected = storage == SampleStorage_Float32 ? fValue : halfToFloat( floatToHalf( fValue ) );
+				bExact = bExact && memcmp( &chunk.pOutputs[ o ], &fExpected, sizeof( float ) ) == 0;
+			}
+			sample += chunk.sampleCount;
+		}
+		CHECK( sample == sampleCount );
+		CHECK( bExact );
+		CHECK( bClose );
+		sampleFile.close();
+	}
+	remove( strPath );
+
+	// Every half converts up and back to itself, NaNs to a quiet NaN
+	bool bRoundTrip = true;
+	for( uint32_t value = 0; value < 0x10000; ++value )
+	{
+		const float fValue = halfToFloat( uint16_t( value ) );
+		const bool bNaN = ( value & 0x7c00 ) == 0x7c00 && ( value & 0x3ff ) != 0;
+		bRoundTrip = bRoundTrip && ( bNaN ? ( fValue != fValue && ( floatToHalf( fValue ) & 0x7e00 ) == 0x7e00 ) : floatToHalf( fValue ) == value );
+	}
+	CHECK( bRoundTrip );
+	CHECK( floatToHalf( 65520.0f ) == 0x7c00 );
+	CHECK( floatToHalf( 2.98e-8f ) == 0x0000 );
+	CHECK( floatToHalf( 1.0f + 1.0f / 2048.0f ) == 0x3c00 );
+	CHECK( floatToHalf( 1.0f + 3.0f / 2048.0f ) == 0x3c02 );
+}
+//----------------------------------------------------------------------------
+
+// dot, axpy, dotBf16 and dotU8S8 of every level against simd_scalar, on lengths that
+// leave every possible vector tail and on arrays starting off their alignment. The
+// integer dot is exact everywhere. Float sums only differ in their order, so they may
+// stray by the rounding error a sum of that length can pick up along the way.
+static void testKernels()
+{
+	const size_t maxCount = 1031;
+	const size_t maxOffset = 7;
+	std::vector< float > a( maxCount + maxOffset );
+	std::vector< float > b( maxCount + maxOffset );
+	std::vector< float > y( maxCount + maxOffset );
+	std::vector< uint16_t > aBf16( maxCount + maxOffset );
+	std::vector< uint8_t > aU8( maxCount + maxOffset );
+	std::vector< int8_t > bS8( maxCount + maxOffset );
+	getKernels().uniform( 31, 0, 0, &a[ 0 ], a.size(), 2.0f );
+	getKernels().uniform( 32, 0, 0, &b[ 0 ], b.size(), 2.0f );
+	getKernels().uniform( 33, 0, 0, &y[ 0 ], y.size(), 1.0f );
+	for( size_t i = 0; i < a.size(); ++i )
+	{
+		aBf16[ i ] = floatToBf16( a[ i ] );
+		// The largest magnitudes the kernels accept, so the pair sums are tested at their limit
+		aU8[ i ] = uint8_t( i % 3 == 0 ? 127 : ( i * 37 ) % 128 );
+		bS8[ i ] = int8_t( i % 5 == 0 ? -128 : int( ( i * 101 ) % 256 ) - 128 );
+	}
+
+	std::vector< size_t > counts;
+	for( size_t count = 0; count <= 70; ++count )
+	{
+		counts.push_back( count );
+	}
+	const size_t longCounts[] = { 127, 255, 257, 511, 1000, 1023, maxCount };
+	counts.insert( counts.end(), longCounts, longCounts + sizeof( longCounts ) / sizeof( longCounts[ 0 ] ) );
+
+	const float fEpsilon = 1.0f / 8388608.0f;
+	for( int level = 0; level < SimdLevel_Count; ++level )
+	{
+		const Kernels& kernels = getKernels( SimdLevel( level ) );
+		if( kernels.level != level )
+		{
+			continue;
+		}
+		size_t mismatchCount[ 4 ] = {};
+		std::vector< float > expectedY( y.size() );
+		std::vector< float > actualY( y.size() );
+		for( size_t c = 0; c < counts.size(); ++c )
+		{
+			const size_t count = counts[ c ];
+			for( size_t offset = 0; offset <= maxOffset; ++offset )
+			{
+				double fMagnitude = 0.0;
+				double fBf16Magnitude = 0.0;
+				for( size_t i = offset; i < offset + count; ++i )
+				{
+					fMagnitude += fabs( a[ i ] * b[ i ] );
+					fBf16Magnitude += fabs( bf16ToFloat( aBf16[ i ] ) * b[ i ] );
+				}
+				const double fTolerance = double( count + 2 ) * fEpsilon;
+
+				const float fDot = kernels.dot( &a[ offset ], &b[ offset ], count );
+				mismatchCount[ 0 ] += fabs( fDot - simd_scalar::dot( &a[ offset ], &b[ offset ], count ) ) > fTolerance * fMagnitude ? 1 : 0;
+
+				const float fDotBf16 = kernels.dotBf16( &aBf16[ offset ], &b[ offset ], count );
+				mismatchCount[ 1 ] += fabs( fDotBf16 - simd_scalar::dotBf16( &aBf16[ offset ], &b[ offset ], count ) ) > fTolerance * fBf16Magnitude ? 1 : 0;
+
+				mismatchCount[ 2 ] += kernels.dotU8S8( &aU8[ offset ], &bS8[ offset ], count ) != simd_scalar::dotU8S8( &aU8[ offset ], &bS8[ offset ], count ) ? 1 : 0;
+
+				// One multiply-add per element, fused or not, and nothing written past the end
+				expectedY = y;
+				actualY = y;
+				simd_scalar::axpy( 0.75f, &a[ offset ], &expectedY[ offset ], count );
+				kernels.axpy( 0.75f, &a[ offset ], &actualY[ offset ], count );
+				for( size_t i = 0; i < y.size(); ++i )
+				{
+					const double fElementTolerance = 2.0 * fEpsilon * ( fabs( 0.75f * a[ i ] ) + fabs( y[ i ] ) );
+					const bool bInside = i >= offset && i < offset + count;
+					mismatchCount[ 3 ] += ( bInside ? fabs( actualY[ i ] - expectedY[ i ] ) > fElementTolerance : actualY[ i ] != y[ i ] ) ? 1 : 0;
+				}
+			}
+		}
+
+		const char* strKernels[] = { "dot", "dotBf16", "dotU8S8", "axpy" };
+		for( int k = 0; k < 4; ++k )
+		{
+			if( mismatchCount[ k ] > 0 )
+			{
+				printf( "%s %s: %d mismatches\n", kernels.strName, strKernels[ k ], ( int )mismatchCount[ k ] );
+			}
+			CHECK( mismatchCount[ k ] == 0 );
+		}
+	}
+}
+//----------------------------------------------------------------------------
+
+// Error of a float result in units in the last place of the double reference, where a
+// unit is the spacing of floats at the reference's magnitude
+static double computeUlpError( float fValue, double fReference )
+{
+	int exponent;
+	frexp( fabs( fReference ), &exponent );
+	exponent = exponent - 24 < -149 ? -149 + 24 : exponent;
+	return fabs( double( fValue ) - fReference ) / ldexp( 1.0, exponent - 24 );
+}
+
+// Evenly spaced float bit patterns from fFrom to fTo, both non-negative, about
+// sampleCount of them and the ends included; negated with bNegate
+static void addFloatRange( std::vector< float >& values, float fFrom, float fTo, bool bNegate, size_t sampleCount )
+{
+	uint32_t fromBits, toBits;
+	memcpy( &fromBits, &fFrom, sizeof( fromBits ) );
+	memcpy( &toBits, &fTo, sizeof( toBits ) );
+	const uint32_t stride = ( toBits - fromBits ) / uint32_t( sampleCount ) + 1;
+	for( uint64_t bits = fromBits; bits <= toBits; bits += stride )
+	{
+		const uint32_t valueBits = uint32_t( bits ) | ( bNegate ? 0x80000000 : 0 );
+		float fValue;
+		memcpy( &fValue, &valueBits, sizeof( fValue ) );
+		values.push_back( fValue );
+	}
+	values.push_back( bNegate ? -fTo : fTo );
+}
+//----------------------------------------------------------------------------
+
+// exp, log and sigmoid of every level against double precision over their whole input
+// range, held to the errors simd_kernels.inl states: 1.3, 0.8 and 3.2 ULP. Levels on
+// libm, the scalar one or all of them with NEURALNET_EXACT_MATH, get 1 ULP for exp and
+// log, which covers the common libms; glibc logf alone reaches 0.82.
+static void testTransferAccuracy()
+{
+	const size_t sampleCount = size_t( 1 ) << 20;
+	std::vector< float > expInputs, logInputs;
+	addFloatRange( expInputs, 0.0f, 87.3f, true, sampleCount );
+	addFloatRange( expInputs, 0.0f, 88.3f, false, sampleCount );
+	addFloatRange( logInputs, FLT_MIN, FLT_MAX, false, 2 * sampleCount );
+
+	for( int level = 0; level < SimdLevel_Count; ++level )
+	{
+		const Kernels& kernels = getKernels( SimdLevel( level ) );
+		if( kernels.level != level )
+		{
+			continue;
+		}
+		const bool bLibm = ( kernels.exp == simd_scalar::exp );
+
+		double fMaxErrors[ 3 ] = {};
+		std::vector< float > values = expInputs;
+		kernels.exp( &values[ 0 ], values.size() );
+		for( size_t v = 0; v < values.size(); ++v )
+		{
+			const double fError = computeUlpError( values[ v ], exp( double( expInputs[ v ] ) ) );
+			fMaxErrors[ 0 ] = fError > fMaxErrors[ 0 ] ? fError : fMaxErrors[ 0 ];
+		}
+		values = logInputs;
+		kernels.log( &values[ 0 ], values.size() );
+		for( size_t v = 0; v < values.size(); ++v )
+		{
+			const double fError = computeUlpError( values[ v ], log( double( logInputs[ v ] ) ) );
+			fMaxErrors[ 1 ] = fError > fMaxErrors[ 1 ] ? fError : fMaxErrors[ 1 ];
+		}
+		values = expInputs;
+		kernels.sigmoid( &values[ 0 ], values.size() );
+		for( size_t v = 0; v < values.size(); ++v )
+		{
+			const double fError = computeUlpError( values[ v ], 1.0 / ( 1.0 + exp( -double( expInputs[ v ] ) ) ) );
+			fMaxErrors[ 2 ] = fError > fMaxErrors[ 2 ] ? fError : fMaxErrors[ 2 ];
+		}
+
+		printf( "%s%s: exp %.2f ULP, log %.2f ULP, sigmoid %.2f ULP\n", kernels.strName, bLibm ? " (libm)" : "", fMaxErrors[ 0 ], fMaxErrors[ 1 ], fMaxErrors[ 2 ] );
+		CHECK( fMaxErrors[ 0 ] <= ( bLibm ? 1.0 : 1.3 ) );
+		CHECK( fMaxErrors[ 1 ] <= ( bLibm ? 1.0 : 0.8 ) );
+		CHECK( fMaxErrors[ 2 ] <= 3.2 );
+	}
+}
+//----------------------------------------------------------------------------
+
+// Round to nearest, ties to even, on the scalar conversion and every toBf16 kernel
+static void testBf16()
+{
+	CHECK( floatToBf16( 1.0f ) == 0x3f80 );
+	CHECK( floatToBf16( -2.0f ) == 0xc000 );
+	// 1 + 2^-8 lies halfway between 0x3f80 and 0x3f81, 1 + 3 * 2^-8 between 0x3f81 and 0x3f82
+	CHECK( floatToBf16( 1.0f + 1.0f / 256.0f ) == 0x3f80 );
+	CHECK( floatToBf16( 1.0f + 3.0f / 256.0f ) == 0x3f82 );
+	CHECK( floatToBf16( 1.0f + 1.0f / 256.0f + 1.0f / 65536.0f ) == 0x3f81 );
+	CHECK( floatToBf16( -( 1.0f + 1.0f / 256.0f + 1.0f / 65536.0f ) ) == 0xbf81 );
+	CHECK( floatToBf16( 3.4e38f ) == 0x7f80 );
+	CHECK( floatToBf16( -INFINITY ) == 0xff80 );
+	CHECK( floatToBf16( NAN ) == 0x7fc0 );
+	CHECK( bf16ToFloat( 0x3f81 ) == 1.0f + 1.0f / 128.0f );
+
+	// Halfway cases, neighbours of them, specials and random bit patterns
+	std::vector< float > values;
+	const uint32_t specialBits[] = { 0x00000000, 0x80000000, 0x00000001, 0x00008000, 0x00018000, 0x7f7fffff, 0x7f7f8000, 0x7f800000, 0xff800000, 0x7fc00000, 0xffffffff, 0x7f800001 };
+	for( size_t s = 0; s < sizeof( specialBits ) / sizeof( specialBits[ 0 ] ); ++s )
+	{
+		float fValue;
+		memcpy( &fValue, &specialBits[ s ], sizeof( fValue ) );
+		values.push_back( fValue );
+	}
+	uint32_t state = 12345;
+	for( size_t i = 0; i < 4096; ++i )
+	{
+		state = state * 1664525u + 1013904223u;
+		uint32_t bits = state;
+		if( i % 4 == 0 )
+		{
+			bits = ( bits & 0xffff0000 ) | 0x8000 | ( ( i / 4 ) % 3 == 0 ? 0 : ( ( i / 4 ) % 3 == 1 ? 1 : 0xffff ) );
+			bits = ( i / 4 ) % 3 == 2 ? bits - 0x8000 + 0x7fff : bits;
+		}
+		float fValue;
+		memcpy( &fValue, &bits, sizeof( fValue ) );
+		values.push_back( fValue );
+	}
+
+	for( int level = 0; level < SimdLevel_Count; ++level )
+	{
+		const Kernels& kernels = getKernels( SimdLevel( level ) );
+		if( kernels.level != level )
+		{
+			continue;
+		}
+		std::vector< uint16_t > converted( values.size() );
+		kernels.toBf16( &values[ 0 ], &converted[ 0 ], values.size() );
+		size_t mismatchCount = 0;
+		for( size_t v = 0; v < values.size(); ++v )
+		{
+			mismatchCount += converted[ v ] != floatToBf16( values[ v ] ) ? 1 : 0;
+		}
+		if( mismatchCount > 0 )
+		{
+			printf( "%s toBf16: %d mismatches\n", kernels.strName, ( int )mismatchCount );
+		}
+		CHECK( mismatchCount == 0 );
+	}
+}
+//----------------------------------------------------------------------------
+
+// A single Relu layer is exact up to rounding the weights to their row scale and the
+// inputs to the sample's range, so each output of the quantized net may only stray by
+//   sum |w_i| * sa / 2 + sum |x_i| * sw / 2 + n * sa * sw / 4
+// for input step sa and weight step sw; Relu cannot widen that. Deeper nets are held
+// to a share of their largest output.
+static void testQuantized()
+{
+	const size_t inputCount = 37;
+	const size_t outputCount = 11;
+	const size_t sampleCount = 64;
+	std::vector< float > inputs( inputCount * sampleCount );
+	getKernels().uniform( 21, 0, 0, &inputs[ 0 ], inputs.size(), 2.0f );
+
+	{
+		const NeuralNet< Relu > net( { inputCount, outputCount } );
+		const QuantizedNet< Relu > quantizedNet( net );
+		std::vector< float > outputs( outputCount * sampleCount );
+		std::vector< float > quantizedOutputs( outputCount * sampleCount );
+		Workspace workspace( net, sampleCount );
+		Workspace quantizedWorkspace( quantizedNet, sampleCount );
+		net.evaluate( &inputs[ 0 ], &outputs[ 0 ], workspace, sampleCount );
+		quantizedNet.evaluate( &inputs[ 0 ], &quantizedOutputs[ 0 ], quantizedWorkspace, sampleCount );
+
+		const Layer< Relu >& layer = net.getOutputLayer();
+		bool bWithinBound = true;
+		for( size_t s = 0; s < sampleCount; ++s )
+		{
+			const float* pSampleInputs = &inputs[ inputCount * s ];
+			float fMin = pSampleInputs[ 0 ];
+			float fMax = pSampleInputs[ 0 ];
+			double fInputMagnitude = 0.0;
+			for( size_t i = 0; i < inputCount; ++i )
+			{
+				fMin = pSampleInputs[ i ] < fMin ? pSampleInputs[ i ] : fMin;
+				fMax = pSampleInputs[ i ] > fMax ? pSampleInputs[ i ] : fMax;
+				fInputMagnitude += fabs( pSampleInputs[ i ] );
+			}
+			const double fInputStep = ( fMax - fMin ) / s_activationLevels;
+			for( size_t o = 0; o < outputCount; ++o )
+			{
+				const float* pRow = &layer.getWeights()[ inputCount * o ];
+				double fWeightMagnitude = 0.0;
+				double fMaxWeight = 0.0;
+				for( size_t i = 0; i < inputCount; ++i )
+				{
+					fWeightMagnitude += fabs( pRow[ i ] );
+					fMaxWeight = fabs( pRow[ i ] ) > fMaxWeight ? fabs( pRow[ i ] ) : fMaxWeight;
+				}
+				const double fWeightStep = fMaxWeight / 127.0;
+				const double fBound = fWeightMagnitude * fInputStep / 2.0 + fInputMagnitude * fWeightStep / 2.0 + double( inputCount ) * fInputStep * fWeightStep / 4.0;
+				const double fError = fabs( quantizedOutputs[ outputCount * s + o ] - outputs[ outputCount * s + o ] );
+				bWithinBound = bWithinBound && fError <= fBound * 1.001 + 1e-5;
+			}
+		}
+		CHECK( bWithinBound );
+	}
+
+	{
+		const NeuralNet< Relu, Sigmoid > net( { inputCount, 64, 64, outputCount } );
+		const QuantizedNet< Relu, Sigmoid > quantizedNet( net );
+		const QuantizationReport report = compareQuantized( net, quantizedNet, &inputs[ 0 ], sampleCount );
+		CHECK( report.sampleCount == sampleCount );
+		CHECK( report.fMaxAbsError <= 0.02f * report.fMaxOutput );
+		CHECK( report.fMeanAbsError <= report.fMaxAbsError );
+		CHECK( report.fArgmaxAgreement >= 0.9f );
+	}
+}
+//----------------------------------------------------------------------------
+
+int main( int argc, const char** argv )
+{
+	struct Test
+	{
+		const char* strName;
+		void ( *function )();
+	};
+	const Test tests[] = {
+		{ "minibatch", testMinibatch },
+		{ "determinism", testDataParallelDeterminism },
+		{ "checkpoint", testCheckpoint },
+		{ "samplefile", testSampleFile },
+		{ "kernels", testKernels },
+		{ "transfer", testTransferAccuracy },
+		{ "bf16", testBf16 },
+		{ "quantized", testQuantized },
+	};
+
+	printf( "kernels: %s\n", getKernels().strName );
+	for( size_t t = 0; t < sizeof( tests ) / sizeof( tests[ 0 ] ); ++t )
+	{
+		bool bRun = ( argc <= 1 );
+		for( int a = 1; a < argc; ++a )
+		{
+			bRun = bRun || strcmp( argv[ a ], tests[ t ].strName ) == 0;
+		}
+		if( bRun )
+		{
+			const int failureCount = s_failureCount;
+			tests[ t ].function();
+			printf( "%-12s %s\n", tests[ t ].strName, s_failureCount == failureCount ? "ok" : "FAILED" );
+		}
+	}
+	return s_failureCount;
+}
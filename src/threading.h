@@ -0,0 +1,308 @@
+/*=============================================================================
+
+MIT License
+
+Copyright (c) 2018 Ville Ruusutie
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+
+=============================================================================*/
+
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <stddef.h>
+#include <thread>
+#include <utility>
+#include <vector>
+//----------------------------------------------------------------------------
+
+// Blocks until threadCount threads have called wait, then releases them all.
+// Reusable, the next round starts as soon as the previous one is released.
+struct Barrier
+{
+	explicit Barrier( size_t threadCount )
+		: m_threadCount( threadCount )
+		, m_waitingCount( 0 )
+		, m_generation( 0 )
+	{
+	}
+	//------------------------------------------------------------------------
+
+	void wait()
+	{
+		std::unique_lock< std::mutex > lock( m_mutex );
+		const size_t generation = m_generation;
+		if( ++m_waitingCount == m_threadCount )
+		{
+			m_waitingCount = 0;
+			++m_generation;
+			m_condition.notify_all();
+			return;
+		}
+
+		while( generation == m_generation )
+		{
+			m_condition.wait( lock );
+		}
+	}
+	//------------------------------------------------------------------------
+
+private:
+	Barrier( const Barrier& ) = delete;
+	Barrier& operator=( const Barrier& ) = delete;
+
+	std::mutex				m_mutex;
+	std::condition_variable	m_condition;
+	size_t					m_threadCount;
+	size_t					m_waitingCount;
+	size_t					m_generation;
+};
+//----------------------------------------------------------------------------
+
+// Runs worker( t ) for t in [ 0, threadCount ), index 0 on the calling thread
+template< typename Worker >
+void runThreads( size_t threadCount, Worker& worker )
+{
+	std::vector< std::thread > threads;
+	for( size_t t = 1; t < threadCount; ++t )
+	{
+		threads.push_back( std::thread( std::ref( worker ), t ) );
+	}
+	worker( 0 );
+	for( size_t t = 0; t < threads.size(); ++t )
+	{
+		threads[ t ].join();
+	}
+}
+//----------------------------------------------------------------------------
+
+// Threads kept alive between jobs, so a caller that runs many short jobs pays for
+// thread creation once. run( worker ) calls worker( t ) for t in [ 0, threadCount ),
+// index 0 on the calling thread like runThreads, and returns when all have finished.
+struct ThreadTeam
+{
+	explicit ThreadTeam( size_t threadCount )
+		: m_threadCount( threadCount > 1 ? threadCount : 1 )
+		, m_pJob( nullptr )
+		, m_generation( 0 )
+		, m_busyCount( 0 )
+		, m_bStopping( false )
+	{
+		for( size_t t = 1; t < m_threadCount; ++t )
+		{
+			m_threads.push_back( std::thread( &ThreadTeam::loop, this, t ) );
+		}
+	}
+
+	~ThreadTeam()
+	{
+		{
+			std::lock_guard< std::mutex > lock( m_mutex );
+			m_bStopping = true;
+		}
+		m_startCondition.notify_all();
+		for( size_t t = 0; t < m_threads.size(); ++t )
+		{
+			m_threads[ t ].join();
+		}
+	}
+	//------------------------------------------------------------------------
+
+	template< typename Worker >
+	void run( Worker& worker )
+	{
+		std::function< void( size_t ) > job( std::ref( worker ) );
+		{
+			std::lock_guard< std::mutex > lock( m_mutex );
+			m_pJob = &job;
+			m_busyCount = m_threadCount - 1;
+			++m_generation;
+		}
+		m_startCondition.notify_all();
+
+		worker( 0 );
+
+		std::unique_lock< std::mutex > lock( m_mutex );
+		while( m_busyCount > 0 )
+		{
+			m_doneCondition.wait( lock );
+		}
+		m_pJob = nullptr;
+	}
+	//------------------------------------------------------------------------
+
+	size_t getThreadCount() const	{ return m_threadCount; }
+	//------------------------------------------------------------------------
+
+private:
+	ThreadTeam( const ThreadTeam& ) = delete;
+	ThreadTeam& operator=( const ThreadTeam& ) = delete;
+
+	void loop( size_t t )
+	{
+		size_t generation = 0;
+		std::unique_lock< std::mutex > lock( m_mutex );
+		for( ;; )
+		{
+			while( generation == m_generation && !m_bStopping )
+			{
+				m_startCondition.wait( lock );
+			}
+			if( m_bStopping )
+			{
+				return;
+			}
+			generation = m_generation;
+			std::function< void( size_t ) >* pJob = m_pJob;
+
+			lock.unlock();
+			( *pJob )( t );
+			lock.lock();
+
+			if( --m_busyCount == 0 )
+			{
+				m_doneCondition.notify_one();
+			}
+		}
+	}
+	//------------------------------------------------------------------------
+
+	std::vector< std::thread >			m_threads;
+	std::mutex							m_mutex;
+	std::condition_variable				m_startCondition;
+	std::condition_variable				m_doneCondition;
+	size_t								m_threadCount;
+	std::function< void( size_t ) >*	m_pJob;
+	size_t								m_generation;
+	size_t								m_busyCount;
+	bool								m_bStopping;
+};
+//----------------------------------------------------------------------------
+
+// Bounded multi-producer multi-consumer queue after Dmitry Vyukov. Every cell carries a
+// sequence number that tells producers and consumers whose turn it is, so push and pop
+// are a single compare-exchange on the shared position and never take a lock.
+// Capacity is rounded up to a power of two.
+template< typename T >
+struct MpmcQueue
+{
+	explicit MpmcQueue( size_t capacity )
+		: m_enqueuePos( 0 )
+		, m_dequeuePos( 0 )
+	{
+		size_t cellCount = 2;
+		while( cellCount < capacity )
+		{
+			cellCount *= 2;
+		}
+		m_mask = cellCount - 1;
+		m_pCells.reset( new Cell[ cellCount ] );
+		for( size_t i = 0; i < cellCount; ++i )
+		{
+			m_pCells[ i ].sequence.store( i, std::memory_order_relaxed );
+		}
+	}
+	//------------------------------------------------------------------------
+
+	// Moves value into the queue, leaves it untouched and returns false when full
+	bool tryPush( T& value )
+	{
+		size_t pos = m_enqueuePos.load( std::memory_order_relaxed );
+		for( ;; )
+		{
+			Cell& cell = m_pCells[ pos & m_mask ];
+			const size_t sequence = cell.sequence.load( std::memory_order_acquire );
+			const ptrdiff_t difference = ( ptrdiff_t )sequence - ( ptrdiff_t )pos;
+			if( difference == 0 )
+			{
+				if( m_enqueuePos.compare_exchange_weak( pos, pos + 1, std::memory_order_relaxed ) )
+				{
+					cell.value = std::move( value );
+					cell.sequence.store( pos + 1, std::memory_order_release );
+					return true;
+				}
+			}
+			else if( difference < 0 )
+			{
+				return false;
+			}
+			else
+			{
+				pos = m_enqueuePos.load( std::memory_order_relaxed );
+			}
+		}
+	}
+	//------------------------------------------------------------------------
+
+	bool tryPop( T& value )
+	{
+		size_t pos = m_dequeuePos.load( std::memory_order_relaxed );
+		for( ;; )
+		{
+			Cell& cell = m_pCells[ pos & m_mask ];
+			const size_t sequence = cell.sequence.load( std::memory_order_acquire );
+			const ptrdiff_t difference = ( ptrdiff_t )sequence - ( ptrdiff_t )( pos + 1 );
+			if( difference == 0 )
+			{
+				if( m_dequeuePos.compare_exchange_weak( pos, pos + 1, std::memory_order_relaxed ) )
+				{
+					value = std::move( cell.value );
+					cell.sequence.store( pos + m_mask + 1, std::memory_order_release );
+					return true;
+				}
+			}
+			else if( difference < 0 )
+			{
+				return false;
+			}
+			else
+			{
+				pos = m_dequeuePos.load( std::memory_order_relaxed );
+			}
+		}
+	}
+	//------------------------------------------------------------------------
+
+	size_t getCapacity() const	{ return m_mask + 1; }
+	//------------------------------------------------------------------------
+
+private:
+	MpmcQueue( const MpmcQueue& ) = delete;
+	MpmcQueue& operator=( const MpmcQueue& ) = delete;
+
+	struct Cell
+	{
+		std::atomic< size_t >	sequence;
+		T						value;
+	};
+
+	// Padding keeps the two positions on separate cache lines
+	std::unique_ptr< Cell[] >	m_pCells;
+	size_t						m_mask;
+	char						m_padding0[ 64 ];
+	std::atomic< size_t >		m_enqueuePos;
+	char						m_padding1[ 64 ];
+	std::atomic< size_t >		m_dequeuePos;
+	char						m_padding2[ 64 ];
+};
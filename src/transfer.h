@@ -0,0 +1,40 @@
+/*=============================================================================
+
+MIT License
+
+Copyright (c) 2018 Ville Ruusutie
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+
+=============================================================================*/
+
+#pragma once
+
+#include <math.h>
+//----------------------------------------------------------------------------
+
+// Transfer functions and their derivatives
+inline float sigmoid( float fValue )			{ return 1.0f / ( 1.0f + expf( -fValue ) ); }
+inline float sigmoidDerivative( float fValue )	{ return fValue * ( 1.0f - fValue ); }
+inline float relu( float fValue )				{ return fmaxf( 0.0f, fValue ); }
+inline float reluDerivative( float fValue )		{ return fValue > 0.0f ? 1.0f : 0.0f; }
+inline float softplus( float fValue )			{ return logf( 1.0f + expf( fValue )  ); }
+inline float softplusDerivative( float fValue )	{ return sigmoid( fValue ); }
+inline float elu( float fValue )				{ return fValue >= 0.0f ? fValue : ( expf( fValue ) - 1.0f ); }
+inline float eluDerivative( float fValue )		{ return fValue >= 0.0f ? 1.0f : expf( fValue ); }